@@ -1,6 +1,7 @@
 import argparse
 from PIL import Image
 import pathlib
+import struct
 
 class ImgBin:
     # VGA color constants (each value is 0xXX; lower nibble is the 4bpp index)
@@ -42,6 +43,95 @@ class ImgBin:
         'white':     (0xFF, 0xFF, 0xFF)
     }
 
+    # Header of the planar format: magic, width and height (little endian)
+    PLANAR_MAGIC = b'VPLN'
+    PLANAR_HEADER = '<4sHH'
+
+    @staticmethod
+    def get_planar(img: Image.Image) -> bytes:
+        """
+        Converts the image into the planar format that the kernel copies straight to the VGA.
+        After the header come the four bitplanes, one after the other. Each plane row has
+        (width + 7) // 8 bytes, with the leftmost pixel in the most significant bit.
+        """
+
+        packed = ImgBin.get_binary(img)
+        width, height = img.size
+        row_bytes = (width + 7) // 8
+
+        planes = [bytearray(row_bytes * height) for _ in range(4)]
+
+        for y in range(height):
+            for x in range(width):
+                index = y * width + x
+                color = packed[index >> 1]
+                color = (color & 0x0F) if (index & 1) else (color >> 4)
+
+                bit = 0x80 >> (x & 7)
+                offset = y * row_bytes + (x >> 3)
+                for plane in range(4):
+                    if color & (1 << plane):
+                        planes[plane][offset] |= bit
+
+        header = struct.pack(ImgBin.PLANAR_HEADER, ImgBin.PLANAR_MAGIC, width, height)
+        return header + b''.join(bytes(plane) for plane in planes)
+
+    # Header of the compressed planar format: magic, width, height and data size
+    COMPRESSED_MAGIC = b'VPLZ'
+    COMPRESSED_HEADER = '<4sHHI'
+
+    @staticmethod
+    def pack_bits(data: bytes) -> bytes:
+        """
+        PackBits: a control byte n from 0 to 127 is followed by n + 1 literal bytes,
+        from -127 to -1 (as a signed byte) by a single byte repeated 1 - n times.
+        """
+
+        output = bytearray()
+        size = len(data)
+        i = 0
+
+        while i < size:
+            run = 1
+            while i + run < size and run < 128 and data[i + run] == data[i]:
+                run += 1
+
+            if run >= 3:
+                output.append(257 - run)
+                output.append(data[i])
+                i += run
+            else:
+                # Literals until the next run of three (or 128 bytes)
+                start = i
+                while i < size and (i - start) < 128:
+                    if i + 2 < size and data[i] == data[i + 1] == data[i + 2]:
+                        break
+                    i += 1
+                output.append(i - start - 1)
+                output += data[start:i]
+
+        return bytes(output)
+
+    @staticmethod
+    def get_compressed(img: Image.Image) -> bytes:
+        """
+        Converts the image into the compressed planar format. The planes come one after
+        the other as in the planar format, but each plane row is packed with PackBits,
+        so the kernel can unpack the image row by row straight into the VGA memory.
+        """
+
+        planar = ImgBin.get_planar(img)
+        width, height = img.size
+        row_bytes = (width + 7) // 8
+        planes = planar[struct.calcsize(ImgBin.PLANAR_HEADER):]
+
+        data = bytearray()
+        for row in range(height * 4):
+            data += ImgBin.pack_bits(planes[row * row_bytes:(row + 1) * row_bytes])
+
+        header = struct.pack(ImgBin.COMPRESSED_HEADER, ImgBin.COMPRESSED_MAGIC, width, height, len(data))
+        return header + bytes(data)
+
     @staticmethod
     def get_binary(img: Image.Image) -> bytes:
         """
@@ -93,7 +183,7 @@ class ImgBin:
         return bytes(output)
 
     @staticmethod
-    def convert_file(input_file, verbose=False):
+    def convert_file(input_file, verbose=False, planar=False, compressed=False):
         # Only process BMP files
         if input_file.suffix.lower() != '.bmp':
             if verbose:
@@ -115,6 +205,26 @@ class ImgBin:
             if verbose:
                 print(f"Successfully converted to {output_file}")
                 print(f"Output file size: {len(binary_data)} bytes")
+
+            if planar:
+                planar_file = str(input_file.with_suffix('.pln'))
+                planar_data = ImgBin.get_planar(img)
+                with open(planar_file, 'wb') as f:
+                    f.write(planar_data)
+
+                if verbose:
+                    print(f"Successfully converted to {planar_file}")
+                    print(f"Output file size: {len(planar_data)} bytes")
+
+            if compressed:
+                compressed_file = str(input_file.with_suffix('.plz'))
+                compressed_data = ImgBin.get_compressed(img)
+                with open(compressed_file, 'wb') as f:
+                    f.write(compressed_data)
+
+                if verbose:
+                    print(f"Successfully converted to {compressed_file}")
+                    print(f"Output file size: {len(compressed_data)} bytes")
             return True
 
         except Exception as e:
@@ -122,7 +232,7 @@ class ImgBin:
             return False
 
     @staticmethod
-    def convert_directory(directory, verbose=False):
+    def convert_directory(directory, verbose=False, planar=False, compressed=False):
         dir_path = pathlib.Path(directory)
         if not dir_path.is_dir():
             print(f"Error: {directory} is not a directory")
@@ -137,7 +247,7 @@ class ImgBin:
         if verbose:
             print(f"Found {len(bmp_files)} BMP files in {directory}")
 
-        success_count = sum(1 for f in bmp_files if ImgBin.convert_file(f, verbose))
+        success_count = sum(1 for f in bmp_files if ImgBin.convert_file(f, verbose, planar, compressed))
 
         if verbose:
             print(f"\nProcessing complete: {success_count}/{len(bmp_files)} files converted successfully")
@@ -147,10 +257,12 @@ if __name__ == '__main__':
     parser = argparse.ArgumentParser(description='Convert BMP images (4bpp) to a packed 4bpp binary format')
     parser.add_argument('input', help='BMP file or directory containing BMP files')
     parser.add_argument('-v', '--verbose', action='store_true', help='Enable verbose output')
+    parser.add_argument('-p', '--planar', action='store_true', help='Also write the planar format (.pln)')
+    parser.add_argument('-c', '--compressed', action='store_true', help='Also write the compressed planar format (.plz)')
     args = parser.parse_args()
 
     input_path = pathlib.Path(args.input)
     if input_path.is_dir():
-        ImgBin.convert_directory(input_path, args.verbose)
+        ImgBin.convert_directory(input_path, args.verbose, args.planar, args.compressed)
     else:
-        ImgBin.convert_file(input_path, args.verbose)
+        ImgBin.convert_file(input_path, args.verbose, args.planar, args.compressed)
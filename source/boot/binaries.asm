@@ -23,24 +23,7 @@
 INCLUDE_BIN butterfly_logo, "source/binaries/butterfly.txt"
 
 
-; include wallapapers :)
-INCLUDE_BIN bigeye_480, "source/binaries/480_bigeye.bin"
-INCLUDE_BIN myfall_480, "source/binaries/480_myfall.bin"
-INCLUDE_BIN myfood_480, "source/binaries/480_myfood.bin"
-INCLUDE_BIN mylamb_480, "source/binaries/480_mylamb.bin"
-INCLUDE_BIN mylife_480, "source/binaries/480_mylife.bin"
-INCLUDE_BIN mymind_480, "source/binaries/480_mymind.bin"
-INCLUDE_BIN theman_480, "source/binaries/480_theman.bin"
-
-INCLUDE_BIN candle_640, "source/binaries/640_candle.bin"
-INCLUDE_BIN choice_640, "source/binaries/640_choice.bin"
-INCLUDE_BIN clouds_640, "source/binaries/640_clouds.bin"
-INCLUDE_BIN myhill_640, "source/binaries/640_myhill.bin"
-INCLUDE_BIN mypain_640, "source/binaries/640_mypain.bin"
-INCLUDE_BIN mypath_640, "source/binaries/640_mypath.bin"
-INCLUDE_BIN myroad_640, "source/binaries/640_myroad.bin"
-INCLUDE_BIN mywork_640, "source/binaries/640_mywork.bin"
-INCLUDE_BIN wchess_640, "source/binaries/640_wchess.bin"
+; the wallpapers aren't linked in anymore, they go in the /assets directory of the ISO
 
 
 ; include more files to be used, an example can be found in binaries.h
@@ -0,0 +1,206 @@
+#include "compress.h"
+
+/*
+ * A tiny LZ4-like block compressor. Every sequence starts with a token byte, whose
+ * upper nibble is the literal count and the lower nibble the match length minus 4,
+ * followed by the literals, a 16-bit little endian offset and the length extensions
+ * (runs of 255 bytes when a nibble overflows). The last sequence only has literals.
+ *
+ * It isn't the best ratio you can get, but it's really cheap to decode, and that is
+ * what we want for data that is read a lot more than it is written.
+ *
+ * @see https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md
+ */
+
+#define MIN_MATCH       4
+#define LAST_LITERALS   5   // The last 5 bytes are always literals
+#define MATCH_LIMIT     12  // A match can't start in the last 12 bytes
+
+#define HASH_BITS       10
+#define HASH_SIZE       (1 << HASH_BITS)
+
+/* Positions of the last seen 4-byte sequences, stale entries are validated on use */
+static uint16_t hash_table[HASH_SIZE];
+
+
+static inline uint32_t readSequence(const uint8_t *pointer) {
+    return pointer[0] | (pointer[1] << 8) | (pointer[2] << 16) | ((uint32_t) pointer[3] << 24);
+}
+
+static inline uint32_t hashSequence(uint32_t sequence) {
+    return (sequence * 2654435761U) >> (32 - HASH_BITS);
+}
+
+/* Write a length extension (the part that didn't fit in the token nibble) */
+static inline uint8_t *writeLength(uint8_t *output, uint32_t length) {
+    while (length >= 255) {
+        *output++ = 255;
+        length -= 255;
+    }
+    *output++ = (uint8_t) length;
+    return output;
+}
+
+
+uint32_t compressBlock(const uint8_t *source, uint32_t length, uint8_t *destination, uint32_t capacity) {
+    if (!source || !destination || length > 0xFFFF) {
+        return 0; // Offsets and the hash table only cover 64 KB
+    }
+
+    const uint8_t *input = source;
+    const uint8_t *anchor = source;
+    const uint8_t *end = source + length;
+
+    uint8_t *output = destination;
+    uint8_t *limit = destination + capacity;
+
+    if (length > MATCH_LIMIT) {
+        const uint8_t *search_end = end - MATCH_LIMIT;
+        const uint8_t *match_end = end - LAST_LITERALS;
+
+        while (input < search_end) {
+            uint32_t sequence = readSequence(input);
+            uint32_t hash = hashSequence(sequence);
+
+            const uint8_t *reference = source + hash_table[hash];
+            hash_table[hash] = (uint16_t) (input - source);
+
+            // The entry can be stale (from a previous block), so we check everything
+            if ((reference >= input) || (readSequence(reference) != sequence)) {
+                input++;
+                continue;
+            }
+
+            // Extend the match as far as we can
+            const uint8_t *match = input + MIN_MATCH;
+            const uint8_t *copy = reference + MIN_MATCH;
+            while ((match < match_end) && (*match == *copy)) {
+                match++;
+                copy++;
+            }
+
+            uint32_t literals = input - anchor;
+            uint32_t extra = (match - input) - MIN_MATCH;
+
+            // Token + literals + extensions + offset, worst case
+            if ((output + 1 + literals + (literals / 255) + 1 + 2 + (extra / 255) + 1) > limit) {
+                return 0;
+            }
+
+            uint8_t *token = output++;
+            *token = (uint8_t) ((MIN(literals, 15U) << 4) | MIN(extra, 15U));
+
+            if (literals >= 15) {
+                output = writeLength(output, literals - 15);
+            }
+
+            for (uint32_t i = 0; i < literals; i++) {
+                *output++ = anchor[i];
+            }
+
+            uint16_t offset = (uint16_t) (input - reference);
+            *output++ = (uint8_t) (offset & 0xFF);
+            *output++ = (uint8_t) (offset >> 8);
+
+            if (extra >= 15) {
+                output = writeLength(output, extra - 15);
+            }
+
+            input = match;
+            anchor = input;
+        }
+    }
+
+    // Flush the remaining bytes as a literal-only sequence
+    uint32_t literals = end - anchor;
+    if ((output + 1 + literals + (literals / 255) + 1) > limit) {
+        return 0;
+    }
+
+    *output++ = (uint8_t) (MIN(literals, 15U) << 4);
+    if (literals >= 15) {
+        output = writeLength(output, literals - 15);
+    }
+
+    for (uint32_t i = 0; i < literals; i++) {
+        *output++ = anchor[i];
+    }
+
+    return output - destination;
+}
+
+
+uint32_t decompressBlock(const uint8_t *source, uint32_t length, uint8_t *destination, uint32_t capacity) {
+    if (!source || !destination) {
+        return 0;
+    }
+
+    const uint8_t *input = source;
+    const uint8_t *end = source + length;
+
+    uint8_t *output = destination;
+    uint8_t *limit = destination + capacity;
+
+    while (input < end) {
+        uint8_t token = *input++;
+
+        // Literal run
+        uint32_t literals = token >> 4;
+        if (literals == 15) {
+            uint8_t value;
+            do {
+                if (input >= end) return 0;
+                value = *input++;
+                literals += value;
+            } while (value == 255);
+        }
+
+        if ((literals > (uint32_t) (end - input)) || (literals > (uint32_t) (limit - output))) {
+            return 0; // Corrupted block, or the output is too small
+        }
+
+        for (uint32_t i = 0; i < literals; i++) {
+            *output++ = *input++;
+        }
+
+        // The last sequence has no match part
+        if (input >= end) {
+            break;
+        }
+
+        if ((end - input) < 2) {
+            return 0;
+        }
+
+        uint32_t offset = input[0] | (input[1] << 8);
+        input += 2;
+
+        if ((offset == 0) || (offset > (uint32_t) (output - destination))) {
+            return 0;
+        }
+
+        // Match run
+        uint32_t count = token & 0x0F;
+        if (count == 15) {
+            uint8_t value;
+            do {
+                if (input >= end) return 0;
+                value = *input++;
+                count += value;
+            } while (value == 255);
+        }
+        count += MIN_MATCH;
+
+        if (count > (uint32_t) (limit - output)) {
+            return 0;
+        }
+
+        // Byte by byte, the match can overlap with the output (that is how runs work)
+        const uint8_t *copy = output - offset;
+        while (count--) {
+            *output++ = *copy++;
+        }
+    }
+
+    return output - destination;
+}
@@ -0,0 +1,31 @@
+#ifndef _LIB_COMPRESS_H
+#define _LIB_COMPRESS_H 1
+
+#include "common.h"
+
+/** Worst case size of a compressed block, when the data doesn't compress at all */
+#define COMPRESS_BOUND(length) ((length) + ((length) / 255) + 16)
+
+/**
+ * Compress a block of memory using a LZ4-like block format.
+ *
+ * @param source        Pointer to the data to compress
+ * @param length        Number of bytes to compress (up to 64 KB)
+ * @param destination   Pointer to the output buffer
+ * @param capacity      Size of the output buffer
+ * @return              Number of compressed bytes, or 0 if the output doesn't fit
+ */
+uint32_t compressBlock(const uint8_t *source, uint32_t length, uint8_t *destination, uint32_t capacity);
+
+/**
+ * Decompress a block produced by compressBlock().
+ *
+ * @param source        Pointer to the compressed data
+ * @param length        Number of compressed bytes
+ * @param destination   Pointer to the output buffer
+ * @param capacity      Size of the output buffer
+ * @return              Number of decompressed bytes, or 0 if the block is corrupted
+ */
+uint32_t decompressBlock(const uint8_t *source, uint32_t length, uint8_t *destination, uint32_t capacity);
+
+#endif /* ! _LIB_COMPRESS_H */
@@ -1,9 +1,12 @@
 #include "filesystem.h"
 
+#include "../CPU/CPU.h"
 #include "../memory/heap.h"
 #include "../memory/memory.h"
 #include "../modules/terminal.h"
 
+#include "../../common/compress.h"
+
 /*
  * My 'Temp File System' implementation (BFS - Butterfly File System).
  *
@@ -21,15 +24,223 @@ Directory *BFS_PRIMARY_DIR;
 Directory *BFS_CURRENT_DIR;
 
 
+/** A decompressed copy of a chunk, so sequential reads don't decode it again */
+typedef struct {
+    const Chunk *chunk;
+    uint32_t stamp;
+    uint8_t data[BFS_CHUNK_SIZE];
+} ChunkCache;
+
+static ChunkCache chunk_cache[BFS_CACHE_ENTRIES];
+static uint32_t cache_clock = 0;
+
+/* Scratch space for compressBlock(), big enough for the worst case */
+static uint8_t chunk_buffer[COMPRESS_BOUND(BFS_CHUNK_SIZE)];
+
+static struct {
+    uint32_t logical_bytes;     // Bytes the files say they have
+    uint32_t stored_bytes;      // Bytes really kept in the chunks
+
+    uint64_t compress_cycles;
+    uint64_t compress_bytes;
+    uint64_t decompress_cycles;
+    uint64_t decompress_bytes;
+
+    uint32_t cache_hits;
+    uint32_t cache_misses;
+} bfs_stats;
+
+
+/** Copy at most 'length' chars of a name and terminate it */
+static char *bfsCopyName(char *string, const char *name, uint32_t length) {
+    memoryCopy(string, name, length);
+    string[length] = '\0';
+    return string;
+}
+
+
+/**
+ * Store a name for a node living inside 'owner'. Short names are kept inside the
+ * node label, and longer ones are packed into the owner directory string pool.
+ */
+static char *bfsStoreName(Directory *owner, char *label, const char *name) {
+    uint32_t length = strlen(name);
+    if (length > (MAX_NAME_LEN - 1)) {
+        length = MAX_NAME_LEN - 1; // Same limit as the old fixed name buffers
+    }
+
+    if ((length < BFS_INLINE_NAME_LEN) || !owner) {
+        return bfsCopyName(label, name, MIN(length, BFS_INLINE_NAME_LEN - 1U));
+    }
+
+    // Look for a chunk with enough room left
+    NamePool *pool = owner->names;
+    while (pool && ((pool->used + length + 1) > BFS_POOL_CHUNK_SIZE)) {
+        pool = pool->next;
+    }
+
+    if (!pool) {
+        pool = (NamePool *) memoryAllocateBlock(sizeof(NamePool));
+        if (!pool) {
+            // Out of memory, better a truncated name than no name at all
+            return bfsCopyName(label, name, BFS_INLINE_NAME_LEN - 1);
+        }
+
+        pool->used = 0;
+        pool->live = 0;
+        pool->next = owner->names;
+        owner->names = pool;
+    }
+
+    char *string = bfsCopyName(pool->data + pool->used, name, length);
+
+    pool->used += length + 1;
+    pool->live++;
+
+    return string;
+}
+
+
+/** Drop a name previously stored with bfsStoreName(), freeing its chunk when empty */
+static void bfsReleaseName(Directory *owner, char *name, char *label) {
+    if ((name == label) || !owner) {
+        return; // Inline names go away with the node
+    }
+
+    NamePool **current = &owner->names;
+    while (*current) {
+        NamePool *pool = *current;
+
+        if ((name >= pool->data) && (name < (pool->data + BFS_POOL_CHUNK_SIZE))) {
+            if (--pool->live == 0) {
+                *current = pool->next;
+                memoryFreeBlock(pool);
+            }
+            return;
+        }
+
+        current = &pool->next;
+    }
+}
+
+
+/** Forget any cached copy of a chunk, must be called before the chunk is freed */
+static void bfsForgetChunk(const Chunk *chunk) {
+    for (uint8_t i = 0; i < BFS_CACHE_ENTRIES; i++) {
+        if (chunk_cache[i].chunk == chunk) {
+            chunk_cache[i].chunk = NULL;
+        }
+    }
+}
+
+
+static void bfsFreeChunks(File *file) {
+    while (file->chunks) {
+        Chunk *chunk = file->chunks;
+        file->chunks = chunk->next;
+
+        bfs_stats.logical_bytes -= chunk->length;
+        bfs_stats.stored_bytes -= chunk->stored;
+
+        bfsForgetChunk(chunk);
+        memoryFreeBlock(chunk);
+    }
+    file->size = 0;
+}
+
+
+/** Make a new chunk out of 'length' bytes, compressing them if asked and worth it */
+static Chunk *bfsStoreChunk(const uint8_t *data, uint16_t length, bool compress) {
+    const uint8_t *source = data;
+    uint16_t stored = length;
+
+    if (compress) {
+        uint64_t start = processorGetCycles();
+        uint32_t result = compressBlock(data, length, chunk_buffer, sizeof(chunk_buffer));
+
+        bfs_stats.compress_cycles += processorGetCycles() - start;
+        bfs_stats.compress_bytes += length;
+
+        // Keep it raw if it doesn't get smaller, decoding it would be wasted time
+        if (result && (result < length)) {
+            source = chunk_buffer;
+            stored = (uint16_t) result;
+        } else {
+            compress = false;
+        }
+    }
+
+    Chunk *chunk = (Chunk *) memoryAllocateBlock(sizeof(Chunk) + stored);
+    if (!chunk) {
+        fprintf(serial, "[ERROR] Unable to allocate a BFS chunk of %d bytes!\n", stored);
+        return NULL;
+    }
+
+    chunk->next = NULL;
+    chunk->length = length;
+    chunk->stored = stored;
+    chunk->compressed = compress;
+    memoryCopy(chunk->data, source, stored);
+
+    bfs_stats.logical_bytes += length;
+    bfs_stats.stored_bytes += stored;
+
+    return chunk;
+}
+
+
+/** Get the decompressed data of a chunk, through the chunk cache */
+static const uint8_t *bfsLoadChunk(const Chunk *chunk) {
+    if (!chunk->compressed) {
+        return chunk->data;
+    }
+
+    ChunkCache *victim = &chunk_cache[0];
+    for (uint8_t i = 0; i < BFS_CACHE_ENTRIES; i++) {
+        ChunkCache *entry = &chunk_cache[i];
+
+        if (entry->chunk == chunk) {
+            entry->stamp = ++cache_clock;
+            bfs_stats.cache_hits++;
+            return entry->data;
+        }
+
+        // Empty entries go first, then the least recently used one
+        if (!entry->chunk || (victim->chunk && (entry->stamp < victim->stamp))) {
+            victim = entry;
+        }
+    }
+
+    bfs_stats.cache_misses++;
+
+    uint64_t start = processorGetCycles();
+    uint32_t result = decompressBlock(chunk->data, chunk->stored, victim->data, BFS_CHUNK_SIZE);
+
+    bfs_stats.decompress_cycles += processorGetCycles() - start;
+    bfs_stats.decompress_bytes += chunk->length;
+
+    if (result != chunk->length) {
+        fprintf(serial, "[ERROR] Corrupted BFS chunk at %#X!\n", (uint32_t) chunk);
+        victim->chunk = NULL;
+        return NULL;
+    }
+
+    victim->chunk = chunk;
+    victim->stamp = ++cache_clock;
+    return victim->data;
+}
+
+
 void mountFileSystem(void) {
     BFS_PRIMARY_DIR = (Directory *) memoryAllocateBlock(sizeof(Directory));
-    BFS_PRIMARY_DIR->name = (char *) memoryAllocateBlock(MAX_NAME_LEN);
-    strcpy(BFS_PRIMARY_DIR->name, "/");
+    BFS_PRIMARY_DIR->name = bfsStoreName(NULL, BFS_PRIMARY_DIR->label, "/");
+    BFS_PRIMARY_DIR->hash = bfsHashName(BFS_PRIMARY_DIR->name);
 
     BFS_PRIMARY_DIR->parent = NULL;
     BFS_PRIMARY_DIR->subdirs = NULL;
     BFS_PRIMARY_DIR->next = NULL;
     BFS_PRIMARY_DIR->files = NULL;
+    BFS_PRIMARY_DIR->names = NULL;
 
     BFS_CURRENT_DIR = BFS_PRIMARY_DIR;
 }
@@ -40,6 +251,10 @@ bool bfsCheckName(const char *name) {
         return false; // If the name is empty or is only an space
     }
 
+    if (strlen(name) > (MAX_NAME_LEN - 1)) {
+        return false; // Longer than what a node keeps
+    }
+
     const char *invalidChars = "\\/:;*?\"<>|-";
     while (*name) {
         if (strchr(invalidChars, *name)) {
@@ -51,6 +266,19 @@ bool bfsCheckName(const char *name) {
 }
 
 
+/** FNV-1a hash of a (truncated) node name, lookups compare this before the string */
+uint32_t bfsHashName(const char *name) {
+    uint32_t hash = 0x811C9DC5;
+
+    for (uint32_t i = 0; name[i] && (i < (MAX_NAME_LEN - 1)); i++) {
+        hash ^= (uint8_t) name[i];
+        hash *= 0x01000193;
+    }
+
+    return hash;
+}
+
+
 /* If you think this is complete spaghetti, I recommend you see the vprintFormat() code, LOL */
 static void bfsCreateTree(Directory *directory, uint8_t level, bool *branch_flags) {
     // Print the leading characters for the current level's tree structure
@@ -136,10 +364,12 @@ static void bfsCreateTree(Directory *directory, uint8_t level, bool *branch_flag
 File *bfsCreateFile(Directory *parent, const char *name) {
     File *file = (File *) memoryAllocateBlock(sizeof(File));
 
-    file->name = (char *) memoryAllocateBlock(MAX_NAME_LEN);
-    strcpy(file->name, name);
+    file->name = bfsStoreName(parent, file->label, name);
+    file->hash = bfsHashName(file->name);
 
     file->size = 0; // Empty file, lol
+    file->chunks = NULL;
+    file->flags = 0;
 
     file->next = parent->files;
     parent->files = file;
@@ -151,13 +381,14 @@ File *bfsCreateFile(Directory *parent, const char *name) {
 Directory *bfsCreateDirectory(Directory *parent, const char *name) {
     Directory *directory = (Directory *) memoryAllocateBlock(sizeof(Directory));
 
-    directory->name = (char *) memoryAllocateBlock(MAX_NAME_LEN);
-    strcpy(directory->name, name);
+    directory->name = bfsStoreName(parent, directory->label, name);
+    directory->hash = bfsHashName(directory->name);
 
     directory->parent = parent;
     directory->subdirs = NULL;
     directory->next = NULL;
     directory->files = NULL;
+    directory->names = NULL;
 
     directory->next = parent->subdirs;
     parent->subdirs = directory;
@@ -167,9 +398,11 @@ Directory *bfsCreateDirectory(Directory *parent, const char *name) {
 
 
 Directory *bfsFindDirectoryRel(Directory *start, const char *name) {
+    uint32_t hash = bfsHashName(name);
+
     Directory *dir = start->subdirs;
     while (dir) {
-        if (strcmp(dir->name, name) == 0) {
+        if ((dir->hash == hash) && (strcmp(dir->name, name) == 0)) {
             return dir;
         }
         dir = dir->next;
@@ -232,9 +465,10 @@ Directory *bfsFindDirectory(const char *path) {
         // Look for the directory in current's subdirectories
         Directory *found = NULL;
         Directory *subdir = current->subdirs;
+        uint32_t hash = bfsHashName(part);
 
         while (subdir) {
-            if (strcmp(subdir->name, part) == 0) {
+            if ((subdir->hash == hash) && (strcmp(subdir->name, part) == 0)) {
                 found = subdir;
                 break;
             }
@@ -269,8 +503,10 @@ File *bfsFindFile(const char *path) {
         return NULL; // Directory not found
     }
 
+    uint32_t hash = bfsHashName(path);
+
     File *file = directory->files;
-    while ((file) && (strcmp(file->name, path) != 0)) {
+    while ((file) && ((file->hash != hash) || (strcmp(file->name, path) != 0))) {
         file = file->next;
     }
 
@@ -282,21 +518,43 @@ void bfsCopyFile(File *file, Directory *destination, const char *newName) {
     if (!file || !destination) return;
 
     File *newFile = bfsCreateFile(destination, newName ? newName : file->name);
-    strncpy(newFile->content, file->content, MAX_CONTENT_LEN);
-    newFile->size = file->size;
+    newFile->flags = file->flags;
+
+    // The chunks are copied as they are, there is no need to encode them again
+    Chunk **tail = &newFile->chunks;
+    for (Chunk *chunk = file->chunks; chunk; chunk = chunk->next) {
+        Chunk *copy = (Chunk *) memoryAllocateBlock(sizeof(Chunk) + chunk->stored);
+        if (!copy) {
+            fprintf(serial, "[ERROR] Unable to copy the BFS file %s!\n", file->name);
+            break;
+        }
+
+        memoryCopy(copy, chunk, sizeof(Chunk) + chunk->stored);
+        copy->next = NULL;
+
+        bfs_stats.logical_bytes += copy->length;
+        bfs_stats.stored_bytes += copy->stored;
+        newFile->size += copy->length;
+
+        *tail = copy;
+        tail = &copy->next;
+    }
 }
 
 
 void bfsRemoveFile(Directory *parent, const char *name) {
+    uint32_t hash = bfsHashName(name);
+
     File **current = &parent->files;
-    while ((*current) && (strcmp((*current)->name, name) != 0)) {
+    while ((*current) && (((*current)->hash != hash) || (strcmp((*current)->name, name) != 0))) {
         current = &(*current)->next;
     }
 
     if (*current) {
         File *temp = *current;
         *current = (*current)->next;
-        memoryFreeBlock(temp->name); // Free memory from name
+        bfsFreeChunks(temp); // Free the file data
+        bfsReleaseName(parent, temp->name, temp->label); // Free the pooled name (if any)
         memoryFreeBlock(temp); // Free mmeory from struct
     }
 }
@@ -309,7 +567,8 @@ void bfsRemoveDirectory(Directory *directory) {
     while (directory->files) {
         File *temp = directory->files;
         directory->files = directory->files->next;
-        memoryFreeBlock(temp->name); // Free memory from filenames
+        bfsFreeChunks(temp); // Free the file data
+        bfsReleaseName(directory, temp->name, temp->label); // Free pooled filenames
         memoryFreeBlock(temp); // free memory from files
     }
 
@@ -321,19 +580,172 @@ void bfsRemoveDirectory(Directory *directory) {
     }
 
     /* Finally we remove the directory */
-    memoryFreeBlock(directory->name); // Free memory from name
+    bfsReleaseName(directory->parent, directory->name, directory->label); // Free memory from name
     memoryFreeBlock(directory); // Free memory from struct
 }
 
 
+void bfsWriteData(File *file, const uint8_t *data, uint32_t length) {
+    bfsFreeChunks(file);
+
+    bool compress = (file->flags & BFS_FILE_COMPRESSED) != 0;
+
+    Chunk **tail = &file->chunks;
+    uint32_t offset = 0;
+
+    while (offset < length) {
+        uint16_t count = (uint16_t) MIN(length - offset, (uint32_t) BFS_CHUNK_SIZE);
+
+        Chunk *chunk = bfsStoreChunk(data + offset, count, compress);
+        if (!chunk) {
+            break; // Out of memory, keep what we could write
+        }
+
+        *tail = chunk;
+        tail = &chunk->next;
+
+        offset += count;
+    }
+
+    file->size = offset;
+}
+
+
+uint32_t bfsReadData(File *file, uint32_t offset, uint8_t *buffer, uint32_t length) {
+    uint32_t position = 0;  // Logical offset of the current chunk
+    uint32_t count = 0;
+
+    for (Chunk *chunk = file->chunks; chunk && (count < length); chunk = chunk->next) {
+        if ((offset + count) >= (position + chunk->length)) {
+            position += chunk->length;
+            continue; // Skip whole chunks until we reach the offset
+        }
+
+        const uint8_t *data = bfsLoadChunk(chunk);
+        if (!data) {
+            break;
+        }
+
+        uint32_t start = (offset + count) - position;
+        uint32_t bytes = MIN(chunk->length - start, length - count);
+
+        memoryCopy(buffer + count, data + start, bytes);
+
+        count += bytes;
+        position += chunk->length;
+    }
+
+    return count;
+}
+
+
 void bfsWriteFile(File *file, const char *content) {
-    strncpy(file->content, content, MAX_CONTENT_LEN);
-    file->size = strlen(content);
+    bfsWriteData(file, (const uint8_t *) content, strlen(content));
 }
 
 
 void bfsReadFile(File *file) {
-    printf("# Content of %s: %s\n", file->name, file->content);
+    char buffer[BFS_CHUNK_SIZE + 1];
+    uint32_t offset = 0;
+
+    printf("# Content of %s: ", file->name);
+
+    while (offset < file->size) {
+        uint32_t count = bfsReadData(file, offset, (uint8_t *) buffer, BFS_CHUNK_SIZE);
+        if (!count) {
+            break;
+        }
+
+        buffer[count] = '\0';
+        printf("%s", buffer);
+
+        offset += count;
+    }
+
+    printf("\n");
+}
+
+
+void bfsSetCompression(File *file, bool enabled) {
+    if (((file->flags & BFS_FILE_COMPRESSED) != 0) == enabled) {
+        return; // Nothing to do
+    }
+
+    uint8_t *data = NULL;
+    uint32_t length = file->size;
+
+    if (length) {
+        data = (uint8_t *) memoryAllocateBlock(length);
+        if (!data) {
+            fprintf(serial, "[ERROR] Not enough memory to re-encode %s!\n", file->name);
+            return;
+        }
+        length = bfsReadData(file, 0, data, length);
+    }
+
+    if (enabled) {
+        file->flags |= BFS_FILE_COMPRESSED;
+    } else {
+        file->flags &= ~BFS_FILE_COMPRESSED;
+    }
+
+    bfsWriteData(file, data, length);
+
+    if (data) {
+        memoryFreeBlock(data);
+    }
+}
+
+
+uint32_t bfsGetStoredSize(File *file) {
+    uint32_t stored = 0;
+    for (Chunk *chunk = file->chunks; chunk; chunk = chunk->next) {
+        stored += chunk->stored;
+    }
+    return stored;
+}
+
+
+/** Bytes per second for 'bytes' processed in 'cycles', given the TSC rate in kHz */
+static double bfsThroughput(uint64_t bytes, uint64_t cycles, uint32_t frequency) {
+    if (!cycles) {
+        return 0.0;
+    }
+    // Through int64_t, unsigned 64-bit conversions would need libgcc
+    return ((double) (int64_t) bytes * frequency * 1000.0) / (double) (int64_t) cycles;
+}
+
+
+void bfsGetStatus(void) {
+    uint32_t frequency = processorGetFrequency();
+
+    printl(INFO, "File System Status:\n");
+
+    printf(" * Logical data: %d bytes\n", bfs_stats.logical_bytes);
+    printf(" * Stored data:  %d bytes\n", bfs_stats.stored_bytes);
+
+    if (bfs_stats.stored_bytes) {
+        printf(" * Compression ratio: %f\n\n", (double) bfs_stats.logical_bytes / bfs_stats.stored_bytes);
+    } else {
+        printf(" * Compression ratio: -\n\n");
+    }
+
+    if (bfs_stats.compress_bytes) {
+        printf(" * Compress:   %f cycles/byte, %d KB/s\n",
+            (double) (int64_t) bfs_stats.compress_cycles / (double) (int64_t) bfs_stats.compress_bytes,
+            (uint32_t) (bfsThroughput(bfs_stats.compress_bytes, bfs_stats.compress_cycles, frequency) / 1024.0)
+        );
+    }
+
+    if (bfs_stats.decompress_bytes) {
+        printf(" * Decompress: %f cycles/byte, %d KB/s\n",
+            (double) (int64_t) bfs_stats.decompress_cycles / (double) (int64_t) bfs_stats.decompress_bytes,
+            (uint32_t) (bfsThroughput(bfs_stats.decompress_bytes, bfs_stats.decompress_cycles, frequency) / 1024.0)
+        );
+    }
+
+    printf(" * Chunk cache: %d hits, %d misses\n", bfs_stats.cache_hits, bfs_stats.cache_misses);
+    printf(" * CPU frequency: %d kHz\n\n", frequency);
 }
 
 
@@ -4,21 +4,66 @@
 #include "../../common/common.h"
 
 #define MAX_NAME_LEN 32
-#define MAX_CONTENT_LEN 1024
+
+/** Names up to this length (including the terminator) live inside the node itself */
+#define BFS_INLINE_NAME_LEN 12
+
+/** Size of each chunk of a directory string pool, longer names are packed here */
+#define BFS_POOL_CHUNK_SIZE 256
+
+/** File data is split in chunks of this size, each one compressed on its own */
+#define BFS_CHUNK_SIZE 512
+
+/** Number of decompressed chunks kept around for reads */
+#define BFS_CACHE_ENTRIES 4
+
+/** The file data chunks are compressed */
+#define BFS_FILE_COMPRESSED 0x01
+
+/**
+ * A chunk of packed, null-terminated names owned by a directory. Chunks are never
+ * moved, so the node name pointers stay valid, and a chunk is freed as soon as the
+ * last name stored inside it goes away.
+ */
+typedef struct NamePool {
+    struct NamePool *next;
+    uint16_t used;   // Bytes handed out from 'data'
+    uint16_t live;   // Names still referencing this chunk
+    char data[BFS_POOL_CHUNK_SIZE];
+} NamePool;
+
+/**
+ * A piece of file data. When the chunk is compressed, 'data' holds the compressed
+ * stream and 'length' the size it expands to. Chunks that don't get smaller are
+ * always stored raw, even inside compressed files.
+ */
+typedef struct Chunk {
+    struct Chunk *next;
+    uint16_t length;    // Logical (decompressed) bytes
+    uint16_t stored;    // Bytes kept in 'data'
+    bool compressed;
+    uint8_t data[];
+} Chunk;
 
 typedef struct File {
     uint32_t size;
-    char *name;
-    char *content;
+    uint32_t hash;   // Cached name hash, compared before the string
+    char *name;      // Points to 'label' or into the parent directory pool
+    struct Chunk *chunks;
     struct File *next;
+    uint8_t flags;   // BFS_FILE_* flags
+    char label[BFS_INLINE_NAME_LEN];
 } File;
 
 typedef struct Directory {
-    char *name;
+    uint32_t hash;   // Cached name hash, compared before the string
+    char *name;      // Points to 'label' or into the parent directory pool
     struct Directory *parent;
     struct Directory *subdirs;
     struct Directory *next;
     struct File *files;
+    struct NamePool *names; // Long names of the entries inside this directory
+    char label[BFS_INLINE_NAME_LEN];
 } Directory;
 
 extern Directory *BFS_PRIMARY_DIR;
@@ -27,6 +72,7 @@ extern Directory *BFS_CURRENT_DIR;
 void mountFileSystem(void);
 
 bool bfsCheckName(const char *name);
+uint32_t bfsHashName(const char *name);
 
 File *bfsCreateFile(Directory *parent, const char *name);
 Directory *bfsCreateDirectory(Directory *parent, const char *name);
@@ -38,9 +84,26 @@ void bfsCopyFile(File *file, Directory *destination, const char *newName);
 void bfsRemoveFile(Directory *parent, const char *name);
 void bfsRemoveDirectory(Directory *directory);
 
+void bfsWriteData(File *file, const uint8_t *data, uint32_t length);
+uint32_t bfsReadData(File *file, uint32_t offset, uint8_t *buffer, uint32_t length);
+
 void bfsWriteFile(File *file, const char *content);
 void bfsReadFile(File *file);
 
+/**
+ * Enable or disable the compression of a file, the current data is re-encoded.
+ *
+ * @param file      The file to change
+ * @param enabled   True to compress the file chunks
+ */
+void bfsSetCompression(File *file, bool enabled);
+
+/** Get the number of bytes the file data really takes in memory (without headers) */
+uint32_t bfsGetStoredSize(File *file);
+
+/** Print the compression ratio, the throughput and the chunk cache statistics */
+void bfsGetStatus(void);
+
 void bfsPrintTree(Directory *directory, uint8_t level);
 
 #endif /* _KERNEL_FILESYSTEM_H */
@@ -3,16 +3,37 @@
 
 #include "../binaries.h"
 #include "../CPU/PIT/timer.h"
+#include "../ISO/iso9660.h"
+#include "../memory/heap.h"
 #include "../drivers/graphics.h"
+#include "../drivers/VGA/bochs.h"
+
+
+// Make a surface from a packed bitmap of the boot disc, NULL if it isn't there
+static Surface* loadSurface(const char* path, uint16_t width, uint16_t height) {
+    uint32_t size = 0;
+    uint8_t* pixels = (uint8_t*) isoLoadFile(path, &size);
+    if (!pixels) return NULL;
+
+    Surface* surface = NULL;
+    if (size >= (uint32_t) BMP_SIZE(width, height)) {
+        surface = bglCreateSurfaceFrom(pixels, width, height);
+    }
+
+    memoryFreeBlock(pixels);
+    return surface;
+}
 
 
 void bglPlayWork(void) {
-    // We create the main surface, we use existing bitmap pixels
-    Surface* wallpaper = bglCreateSurfaceFrom(myhill_640, 640, 480);
+    // We create the main surface, with the pixels of a bitmap from the disc
+    Surface* wallpaper = loadSurface("/assets/640_myhill.bin", 640, 480);
+    if (!wallpaper) return;
+
     bglFlipSurface(wallpaper, false, true); // We flip the wallpaper surface
 
     // We create another surface ...
-    Surface* overlay = bglCreateSurfaceFrom(mywork_640, 640, 480);
+    Surface* overlay = loadSurface("/assets/640_mywork.bin", 640, 480);
     if (!overlay) {
         bglDestroySurface(wallpaper); // Clean up if we fail
         return;
@@ -48,7 +69,7 @@ void bglPlayDemo(void) {
     if (!screen) return;
 
     // We need a pretty background for our animation
-    Surface* background = bglCreateSurfaceFrom(myhill_640, 640, 480);
+    Surface* background = loadSurface("/assets/640_myhill.bin", 640, 480);
     if (!background) {
         bglDestroySurface(screen);    // Oops, clean up and return if we fail
         return;
@@ -166,13 +187,13 @@ void bglPlayDemoEx(void) {
     if (!screen) return;
 
     // Create background surface
-    Surface* background = bglCreateSurfaceFrom(myhill_640, 640, 480);
+    Surface* background = loadSurface("/assets/640_myhill.bin", 640, 480);
     if (!background) {
         bglDestroySurface(screen);
         return;
     }
 
-    Surface* spritesheet = bglCreateSurfaceFrom(bigeye_480, 480, 480);
+    Surface* spritesheet = loadSurface("/assets/480_bigeye.bin", 480, 480);
     if (!spritesheet) {
         bglDestroySurface(background);
         bglDestroySurface(screen);
@@ -248,3 +269,98 @@ void bglPlayDemoEx(void) {
     bglDestroySurface(sprite);
     bglDestroyDirtyRectList(dirtyRects);
 }
+
+
+void bglPlayPages(void) {
+    const uint16_t SQUARE_SIZE = 32;
+    const uint16_t MOVE_SPEED = 2;
+
+    // Same as the other demos, but at 320x240 with page flipping
+    Surface* screen = bglCreateSurface(320, 240);
+    if (!screen) return;
+
+    // The middle of the hill wallpaper is our background
+    Surface* wallpaper = loadSurface("/assets/640_myhill.bin", 640, 480);
+    if (!wallpaper) {
+        bglDestroySurface(screen);
+        return;
+    }
+
+    Surface* background = bglCreateSprite(wallpaper, (Rect) {160, 120, 320, 240});
+    bglDestroySurface(wallpaper);
+
+    if (!background) {
+        bglDestroySurface(screen);
+        return;
+    }
+
+    uint16_t square_x = 40;
+    uint16_t square_y = 40;
+    int8_t square_dx = MOVE_SPEED;
+    int8_t square_dy = MOVE_SPEED;
+
+    initializePages();
+
+    uint16_t frame = 0;
+
+    // Every frame is drawn whole, the page flip hides it until it's done
+    while ((frame++) < 256) {
+        square_x += square_dx;
+        square_y += square_dy;
+
+        if (square_x <= 0 || square_x >= 320 - SQUARE_SIZE) square_dx = -square_dx;
+        if (square_y <= 0 || square_y >= 240 - SQUARE_SIZE) square_dy = -square_dy;
+
+        Rect square = {square_x, square_y, SQUARE_SIZE, SQUARE_SIZE};
+
+        bglBlit(background, NULL, screen, NULL);
+        bglFillRect(screen, &square, PX_LTGREEN);
+
+        presentPage(screen->pixels);
+    }
+
+    bglDestroySurface(background);
+    bglDestroySurface(screen);
+}
+
+
+void bglPlayFramebuffer(void) {
+    const uint16_t SQUARE_SIZE = 64;
+
+    const bga_device_t *device = bgaGetDevice();
+    if (!device || !device->enabled) return;
+
+    Surface* wallpaper = loadSurface("/assets/640_myhill.bin", 640, 480);
+    if (!wallpaper) return;
+
+    // The wallpaper in the middle of the screen, the rest in black
+    int16_t left = ((int16_t) device->width - 640) / 2;
+    int16_t top = ((int16_t) device->height - 480) / 2;
+
+    bgaFillRect(PX_BLACK, 0, 0, device->width, device->height);
+    bglBlitToFramebuffer(wallpaper, NULL, left, top);
+
+    uint16_t square_x = 40;
+    uint16_t square_y = 40;
+    int8_t square_dx = 2;
+    int8_t square_dy = 2;
+
+    uint16_t frame = 0;
+
+    // Only the square moves, so only its old place is put back from the wallpaper
+    while ((frame++) < 512) {
+        Rect old = {square_x, square_y, SQUARE_SIZE, SQUARE_SIZE};
+        bglBlitToFramebuffer(wallpaper, &old, left + square_x, top + square_y);
+
+        square_x += square_dx;
+        square_y += square_dy;
+
+        if (square_x <= 0 || square_x >= 640 - SQUARE_SIZE) square_dx = -square_dx;
+        if (square_y <= 0 || square_y >= 480 - SQUARE_SIZE) square_dy = -square_dy;
+
+        bgaFillRect(PX_LTGREEN, left + square_x, top + square_y, SQUARE_SIZE, SQUARE_SIZE);
+        timerSleep(10);
+    }
+
+    bglDestroySurface(wallpaper);
+}
@@ -7,5 +7,7 @@
 void bglPlayWork(void);
 void bglPlayDemo(void);
 void bglPlayDemoEx(void);
+void bglPlayPages(void);
+void bglPlayFramebuffer(void);
 
 #endif /* _KERNEL_GRAPHICS_DEMO_H */
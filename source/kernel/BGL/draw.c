@@ -1,69 +1,85 @@
 #include "draw.h"
+#include "../drivers/graphics.h"
 #include "../memory/memory.h"
 #include "../memory/heap.h"
 
 
-// Helper function to merge overlapping rectangles
-static void mergeRects(Rect* r1, Rect* r2) {
-    uint16_t x1 = MIN(r1->x, r2->x);
-    uint16_t y1 = MIN(r1->y, r2->y);
-    uint16_t x2 = MAX(r1->x + r1->w, r2->x + r2->w);
-    uint16_t y2 = MAX(r1->y + r1->h, r2->y + r2->h);
+// A span of a surface row, clipped, the odd pixels at the ends take half a byte
+static void fillSurfaceSpan(Surface* surface, int32_t x, int32_t y, int32_t length, uint8_t color) {
+    if ((y < 0) || (y >= surface->h)) return;
 
-    r1->x = x1;
-    r1->y = y1;
-    r1->w = x2 - x1;
-    r1->h = y2 - y1;
+    int32_t end = MIN(x + length, (int32_t) surface->w);
+    x = MAX(x, 0);
+    if (x >= end) return;
+
+    uint8_t* pixel = surface->pixels + (y * surface->pitch) + (x >> 1);
+    length = end - x;
+
+    if (x & 1) {
+        *pixel = (*pixel & 0xF0) | color;
+        pixel++;
+        length--;
+    }
+
+    fastFastMemorySet(pixel, (color << 4) | color, length >> 1);
+
+    if (length & 1) {
+        pixel += length >> 1;
+        *pixel = (*pixel & 0x0F) | (color << 4);
+    }
+}
+
+
+// Span callback for the scan functions of graphics.h
+typedef struct {
+    Surface* surface;
+    uint8_t color;
+} SpanFill;
+
+static void fillSpanCallback(void* context, int16_t x, int16_t y, uint16_t length) {
+    SpanFill* fill = (SpanFill*) context;
+    fillSurfaceSpan(fill->surface, x, y, length, fill->color);
 }
 
 
 DirtyRectList* bglCreateDirtyRectList(uint16_t max_rects) {
-    if (max_rects > MAX_DIRTY_RECTS) max_rects = MAX_DIRTY_RECTS;
     DirtyRectList* list = (DirtyRectList*) memoryAllocateBlock(sizeof(DirtyRectList));
     if (list) {
-        list->count = 0;
-        list->max = max_rects;
+        bglInitRegion(&list->region);
+        list->max = MAX(max_rects, 1);
     }
     return list;
 }
 
 
 void bglDestroyDirtyRectList(DirtyRectList* list) {
-    if (list) memoryFreeBlock(list);
+    if (!list) return;
+    bglDestroyRegion(&list->region);
+    memoryFreeBlock(list);
 }
 
 
 void bglAddDirtyRect(DirtyRectList* list, Rect* rect) {
-    if (!list || !rect || list->count >= list->max) return;
-
-    // Try to merge with existing rectangles
-    for (uint16_t i = 0; i < list->count; i++) {
-        Rect* current = &list->rects[i];
-        // Check if rectangles overlap
-        if (!(current->x + current->w < rect->x ||
-              current->x > rect->x + rect->w ||
-              current->y + current->h < rect->y ||
-              current->y > rect->y + rect->h)) {
-            mergeRects(current, rect);
-            return;
-        }
-    }
+    if (!list || !rect) return;
 
-    // Add as new rectangle if no merge possible
-    list->rects[list->count++] = *rect;
+    // Overlaps are only counted once, and nothing that didn't change gets in
+    bglUnionRegionRect(&list->region, rect);
 }
 
 
 void bglClearDirtyRects(DirtyRectList* list) {
-    if (list) list->count = 0;
+    if (list) bglClearRegion(&list->region);
 }
 
 
 inline void bglUpdateRects(Surface* dst, Surface* src, DirtyRectList* list) {
     if (!dst || !src || !list) return;
 
-    for (uint16_t i = 0; i < list->count; i++) {
-        Rect* rect = &list->rects[i];
+    // Rects close enough are cheaper to redraw as one, and never more than the list max
+    bglSimplifyRegion(&list->region, BGL_RECT_COST, list->max);
+
+    for (uint16_t i = 0; i < list->region.count; i++) {
+        Rect* rect = &list->region.rects[i];
         bglBlit(src, rect, dst, rect);
     }
 }
@@ -133,17 +149,13 @@ void bglDrawRect(Surface* surface, Rect* rect, uint8_t color) {
 
 
 void bglFillRect(Surface* surface, Rect* rect, uint8_t color) {
-    if (!surface || !rect) return;
+    if (!surface || !surface->pixels || !rect) return;
 
-    uint16_t start_x = MAX(rect->x, 0);
-    uint16_t start_y = MAX(rect->y, 0);
-    uint16_t end_x = MIN(rect->x + rect->w, surface->w);
-    uint16_t end_y = MIN(rect->y + rect->h, surface->h);
+    int32_t start_y = MAX((int32_t) rect->y, 0);
+    int32_t end_y = MIN((int32_t) rect->y + rect->h, (int32_t) surface->h);
 
-    for (uint16_t y = start_y; y < end_y; y++) {
-        for (uint16_t x = start_x; x < end_x; x++) {
-            bglSetPixel(surface, x, y, color);
-        }
+    for (int32_t y = start_y; y < end_y; y++) {
+        fillSurfaceSpan(surface, rect->x, y, rect->w, color & 0x0F);
     }
 }
 
@@ -178,77 +190,234 @@ void bglDrawCircle(Surface* surface, uint16_t x0, uint16_t y0, uint16_t radius,
 
 
 void bglFillCircle(Surface* surface, uint16_t x, uint16_t y, uint16_t radius, uint8_t color) {
-    for (int16_t i = -radius; i <= radius; i++) {
-        for (int16_t j = -radius; j <= radius; j++) {
-            if (((j * j) + (i * i)) < ((radius * radius) - radius)) {
-                bglSetPixel(surface, x + j, y + i, color);
-            }
-        }
-    }
+    if (!surface || !surface->pixels) return;
+
+    SpanFill fill = { surface, color & 0x0F };
+    scanCircle(x, y, radius, fillSpanCallback, &fill);
+}
+
+
+void bglFillPolygon(Surface* surface, Point* points, uint16_t count, uint8_t color) {
+    if (!surface || !surface->pixels) return;
+
+    SpanFill fill = { surface, color & 0x0F };
+    scanPolygon(points, count, 0, surface->h, fillSpanCallback, &fill);
+}
+
+
+void bglFillTriangle(Surface* surface, Point a, Point b, Point c, uint8_t color) {
+    Point points[3] = { a, b, c };
+    bglFillPolygon(surface, points, 3, color);
 }
 
 
 // Surface transformation functions
+
+static inline uint8_t getNibble(const uint8_t* row, int32_t x) {
+    return (x & 1) ? (row[x >> 1] & 0x0F) : (row[x >> 1] >> 4);
+}
+
+static inline void setNibble(uint8_t* row, int32_t x, uint8_t color) {
+    uint8_t* pixel = &row[x >> 1];
+    *pixel = (x & 1) ? ((*pixel & 0xF0) | color) : ((*pixel & 0x0F) | (color << 4));
+}
+
+
+// Move 'w' pixels from column 'sx' of a row to column 'dx' of another one, or of the same one
+static void moveRowPixels(uint8_t* dst, int32_t dx, const uint8_t* src, int32_t sx, int32_t w) {
+    if (w <= 0) return;
+
+    // Same nibble phase, the ends by hand and the whole bytes in between with one memmove
+    if (!((dx ^ sx) & 1)) {
+        uint8_t first = getNibble(src, sx);
+        uint8_t last = getNibble(src, sx + w - 1);
+        int32_t head = dx & 1;
+
+        memoryMove(dst + ((dx + head) >> 1), src + ((sx + head) >> 1), (w - head) >> 1);
+
+        if (head) setNibble(dst, dx, first);
+        if ((w - head) & 1) setNibble(dst, dx + w - 1, last);
+        return;
+    }
+
+    // Otherwise every pixel changes byte, go in the direction that never reads one already written
+    if ((dst < src) || ((dst == src) && (dx < sx))) {
+        for (int32_t i = 0; i < w; i++) setNibble(dst, dx + i, getNibble(src, sx + i));
+    } else {
+        for (int32_t i = w - 1; i >= 0; i--) setNibble(dst, dx + i, getNibble(src, sx + i));
+    }
+}
+
+
 void bglScrollSurface(Surface* surface, Rect* rect, int16_t dx, int16_t dy) {
-    if (!surface || !rect) return;
+    if (!surface || !surface->pixels || !rect) return;
+
+    // What the surface has of the rect, then where it lands inside the clip rect
+    int32_t sx = MAX((int32_t) rect->x, 0), sy = MAX((int32_t) rect->y, 0);
+    int32_t w = MIN((int32_t) rect->x + rect->w, (int32_t) surface->w) - sx;
+    int32_t h = MIN((int32_t) rect->y + rect->h, (int32_t) surface->h) - sy;
+    int32_t tx = sx + dx, ty = sy + dy;
+
+    int32_t left = MAX((int32_t) surface->clip_rect.x, 0);
+    int32_t top = MAX((int32_t) surface->clip_rect.y, 0);
+    int32_t right = MIN((int32_t) surface->clip_rect.x + surface->clip_rect.w, (int32_t) surface->w);
+    int32_t bottom = MIN((int32_t) surface->clip_rect.y + surface->clip_rect.h, (int32_t) surface->h);
+
+    if (tx < left) { sx += left - tx; w -= left - tx; tx = left; }
+    if (ty < top) { sy += top - ty; h -= top - ty; ty = top; }
+    w = MIN(w, right - tx);
+    h = MIN(h, bottom - ty);
+
+    // Moving down the rows go from the bottom, so none is overwritten before it is moved
+    if ((w > 0) && (h > 0)) {
+        for (int32_t i = 0; i < h; i++) {
+            int32_t row = (dy > 0) ? (h - 1 - i) : i;
+            moveRowPixels(surface->pixels + ((ty + row) * surface->pitch), tx, surface->pixels + ((sy + row) * surface->pitch), sx, w);
+        }
+    } else {
+        h = 0;
+    }
 
-    Surface* temp = bglCreateSurface(rect->w, rect->h);
-    if (!temp) return;
+    // And what the content left behind in the rect is cleared
+    int32_t first = MAX((int32_t) rect->y, 0);
+    int32_t last = MIN((int32_t) rect->y + rect->h, (int32_t) surface->h);
+
+    for (int32_t y = first; y < last; y++) {
+        if ((y < ty) || (y >= (ty + h))) {
+            fillSurfaceSpan(surface, rect->x, y, rect->w, 0);
+        } else {
+            int32_t end = MAX(tx + w, (int32_t) rect->x);
+            fillSurfaceSpan(surface, rect->x, y, MIN(tx, (int32_t) rect->x + rect->w) - rect->x, 0);
+            fillSurfaceSpan(surface, end, y, ((int32_t) rect->x + rect->w) - end, 0);
+        }
+    }
+}
+
+
+// The scaler samples at the pixel centers in 16.16 fixed point, so the source position never
+// goes past the last pixel. The source columns are worked out once per call, on the stack up
+// to this width and on the heap above it
+#define SCALE_CHUNK     256U
+
+static inline uint32_t scaleStep(uint16_t from, uint16_t to) {
+    return ((uint32_t) from << 16) / to;
+}
 
-    // Copy region to temp surface
-    bglBlit(surface, rect, temp, NULL);
 
-    // Clear original region
-    uint8_t zero = 0;
-    bglFillRect(surface, rect, zero);
+// A row two or three times wider, each source byte (two pixels) gives two or three bytes
+static void expandRow(uint8_t* dst, const uint8_t* src, uint16_t width, uint8_t factor) {
+    uint16_t pairs = width >> 1;
 
-    // Calculate new position
-    Rect dst = {
-        rect->x + dx,
-        rect->y + dy,
-        rect->w,
-        rect->h
-    };
+    for (uint16_t i = 0; i < pairs; i++) {
+        uint8_t a = src[i] >> 4, b = src[i] & 0x0F;
 
-    // Copy back with offset
-    bglBlit(temp, NULL, surface, &dst);
-    bglDestroySurface(temp);
+        *dst++ = a * 0x11;
+        if (factor == 3) *dst++ = (a << 4) | b;
+        *dst++ = b * 0x11;
+    }
+
+    // The last pixel of an odd width, the third copy goes with the padding nibble
+    if (width & 1) {
+        uint8_t a = src[pairs] >> 4;
+
+        *dst++ = a * 0x11;
+        if (factor == 3) *dst = a * 0x11;
+    }
 }
 
 
-void bglResizeSurface(Surface* surface, uint16_t new_width, uint16_t new_height) {
-    if (!surface || !surface->pixels) return;
+// 'count' pixels from the source columns, from an even destination column
+static void scaleRow(uint8_t* dst, const uint8_t* src, const uint16_t* columns, uint16_t count) {
+    uint16_t i = 0;
 
-    // Create a new pixel buffer
-    uint16_t new_pitch = (new_width + 1) >> 1;
-    uint8_t* new_pixels = (uint8_t*) memoryAllocateBlock(new_pitch * new_height);
-    if (!new_pixels) return;
-
-    // Calculate scaling factors
-    float x_scale = (float)new_width / surface->w;
-    float y_scale = (float)new_height / surface->h;
-
-    // Resize the surface using nearest neighbor scaling
-    for (uint16_t y = 0; y < new_height; y++) {
-        for (uint16_t x = 0; x < new_width; x++) {
-            uint16_t src_x = (uint16_t)(x / x_scale);
-            uint16_t src_y = (uint16_t)(y / y_scale);
-
-            // Get the pixel color from the original surface
-            uint8_t color = bglGetPixel(surface, src_x, src_y);
-
-            // Set the pixel color in the new buffer
-            uint32_t offset = (y * new_pitch) + (x >> 1);
-            if (x & 1) {
-                new_pixels[offset] = (new_pixels[offset] & 0xF0) | color;
-            } else {
-                new_pixels[offset] = (new_pixels[offset] & 0x0F) | (color << 4);
+    for (; (i + 1) < count; i += 2) {
+        *dst++ = (getNibble(src, columns[i]) << 4) | getNibble(src, columns[i + 1]);
+    }
+
+    if (i < count) {
+        *dst = (*dst & 0x0F) | (getNibble(src, columns[i]) << 4);
+    }
+}
+
+
+void bglScaleSurface(Surface* src, uint8_t* pixels, uint16_t width, uint16_t height) {
+    if (!src || !src->pixels || !src->w || !src->h || !pixels || !width || !height) return;
+
+    uint16_t pitch = (width + 1) >> 1;
+    uint32_t x_step = scaleStep(src->w, width);
+    uint32_t y_step = scaleStep(src->h, height);
+    uint32_t y_position = y_step >> 1;
+
+    uint8_t factor = (width == (src->w * 2)) ? 2 : ((width == (src->w * 3)) ? 3 : 0);
+    uint16_t chunk[SCALE_CHUNK];
+    uint16_t* columns = chunk;
+    uint32_t span = MIN((uint32_t) width, SCALE_CHUNK); // Columns the table holds
+    bool ready = false;
+    int32_t previous = -1;
+
+    if (!factor && (width > SCALE_CHUNK)) {
+        uint16_t* table = (uint16_t*) memoryAllocateBlock(width * sizeof(uint16_t));
+        if (table) {
+            columns = table;
+            span = width;
+        }
+    }
+
+    for (uint16_t y = 0; y < height; y++, y_position += y_step) {
+        int32_t row = y_position >> 16;
+        uint8_t* line = pixels + (y * pitch);
+
+        // Integer upscales (and the rounding ones) repeat the row above, that is just a copy
+        if (row == previous) {
+            fastFastMemoryCopy(line, line - pitch, pitch);
+            continue;
+        }
+
+        const uint8_t* source = src->pixels + (row * src->pitch);
+        previous = row;
+
+        if (factor) {
+            expandRow(line, source, src->w, factor);
+            continue;
+        }
+
+        for (uint32_t first = 0; first < width; first += span) {
+            uint16_t count = MIN(width - first, span);
+
+            // A table for the whole row is only worked out for the first row, without the
+            // memory for it the chunks are worked out again on every row
+            if (!ready || (span < width)) {
+                uint32_t x_position = (x_step >> 1) + (first * x_step);
+                for (uint16_t i = 0; i < count; i++, x_position += x_step) {
+                    columns[i] = x_position >> 16;
+                }
+                ready = true;
             }
+
+            scaleRow(line + (first >> 1), source, columns, count);
         }
     }
 
+    if (columns != chunk) {
+        memoryFreeBlock(columns);
+    }
+}
+
+
+// Shrinking an owned buffer is done in place, every pixel comes from one at or after it
+static bool resizePixels(Surface* surface, uint16_t new_width, uint16_t new_height) {
+    if (!new_width || !new_height) return false;
+
+    bool in_place = (surface->flags & BGL_SURFACE_OWNED) && (new_width <= surface->w) && (new_height <= surface->h);
+    uint16_t new_pitch = (new_width + 1) >> 1;
+
+    uint8_t* new_pixels = in_place ? surface->pixels : (uint8_t*) memoryAllocateBlock(new_pitch * new_height);
+    if (!new_pixels) return false;
+
+    bglScaleSurface(surface, new_pixels, new_width, new_height);
+
     // Free the old pixel data
-    if (surface->flags & BGL_SURFACE_OWNED) {
+    if (!in_place && (surface->flags & BGL_SURFACE_OWNED)) {
         memoryFreeBlock(surface->pixels);
     }
 
@@ -257,79 +426,69 @@ void bglResizeSurface(Surface* surface, uint16_t new_width, uint16_t new_height)
     surface->w = new_width;
     surface->h = new_height;
     surface->pitch = new_pitch;
-    surface->flags |= BGL_SURFACE_OWNED;  // Mark that we own these pixels
 
     // Update clip rectangle
     surface->clip_rect.w = new_width;
     surface->clip_rect.h = new_height;
+    return true;
 }
 
 
-void bglFlipSurface(Surface* surface, bool vertical, bool horizontal) {
+void bglResizeSurface(Surface* surface, uint16_t new_width, uint16_t new_height) {
     if (!surface || !surface->pixels) return;
 
-    // Create a temporary surface to hold the flipped data
-    Surface* temp = bglCreateSurface(surface->w, surface->h);
-    if (!temp) return;
-
-    // Flip the surface
-    for (uint16_t y = 0; y < surface->h; y++) {
-        for (uint16_t x = 0; x < surface->w; x++) {
-            uint16_t new_x = horizontal ? (surface->w - 1 - x) : x;
-            uint16_t new_y = vertical ? (surface->h - 1 - y) : y;
-
-            uint8_t color = bglGetPixel(surface, new_x, new_y);
-            bglSetPixel(temp, x, y, color);
-        }
+    if (resizePixels(surface, new_width, new_height)) {
+        surface->flags |= BGL_SURFACE_OWNED;  // Mark that we own these pixels
     }
+}
 
-    // Copy the flipped data back to the original surface
-    fastFastMemoryCopy(surface->pixels, temp->pixels, surface->pitch * surface->h);
 
-    // Clean up
-    bglDestroySurface(temp);
+// A packed byte with its two pixels swapped
+static inline uint8_t swapNibbles(uint8_t pixels) {
+    return (uint8_t) ((pixels << 4) | (pixels >> 4));
 }
 
 
-void bglResizeSprite(Surface* sprite, uint16_t new_width, uint16_t new_height) {
-    if (!sprite || !sprite->pixels || !(sprite->flags & BGL_SURFACE_SPRITE)) return;
+void bglFlipSurface(Surface* surface, bool vertical, bool horizontal) {
+    if (!surface || !surface->pixels || (!vertical && !horizontal)) return;
 
-    // Create a new pixel buffer
-    uint16_t new_pitch = (new_width + 1) >> 1;
-    uint8_t* new_pixels = (uint8_t*) memoryAllocateBlock(new_pitch * new_height);
-    if (!new_pixels) return;
-
-    // Calculate scaling factors
-    float x_scale = (float)new_width / sprite->w;
-    float y_scale = (float)new_height / sprite->h;
-
-    // Resize using nearest neighbor scaling
-    for (uint16_t y = 0; y < new_height; y++) {
-        for (uint16_t x = 0; x < new_width; x++) {
-            uint16_t src_x = (uint16_t)(x / x_scale);
-            uint16_t src_y = (uint16_t)(y / y_scale);
-
-            uint8_t color = bglGetPixel(sprite, src_x, src_y);
-
-            uint32_t offset = (y * new_pitch) + (x >> 1);
-            if (x & 1) {
-                new_pixels[offset] = (new_pixels[offset] & 0xF0) | color;
-            } else {
-                new_pixels[offset] = (new_pixels[offset] & 0x0F) | (color << 4);
+    uint32_t pitch = surface->pitch;
+    uint16_t rows = surface->h;
+
+    // Row 'y' swaps with its mirror (or with itself), mirrored byte by byte when horizontal
+    for (uint16_t y = 0; y < (vertical ? ((rows + 1) >> 1) : rows); y++) {
+        uint8_t* a = surface->pixels + (y * pitch);
+        uint8_t* b = vertical ? (surface->pixels + ((rows - 1 - y) * pitch)) : a;
+
+        if (!horizontal) {
+            for (uint32_t i = 0; i < pitch; i++) {
+                uint8_t pixels = a[i];
+                a[i] = b[i];
+                b[i] = pixels;
             }
+            continue;
+        }
+
+        // On the same row only half of the bytes go, the other half comes back with them
+        uint32_t count = (a == b) ? ((pitch + 1) >> 1) : pitch;
+        for (uint32_t i = 0; i < count; i++) {
+            uint8_t pixels = a[i];
+            a[i] = swapNibbles(b[pitch - 1 - i]);
+            b[pitch - 1 - i] = swapNibbles(pixels);
+        }
+
+        // An odd width has the padding nibble mirrored to the front, the row goes one pixel left
+        if (surface->w & 1) {
+            moveRowPixels(a, 0, a, 1, surface->w);
+            if (a != b) moveRowPixels(b, 0, b, 1, surface->w);
         }
     }
+}
 
-    // Free the old pixel data since sprites always own their pixels
-    memoryFreeBlock(sprite->pixels);
 
-    // Update sprite properties
-    sprite->pixels = new_pixels;
-    sprite->w = new_width;
-    sprite->h = new_height;
-    sprite->pitch = new_pitch;
+void bglResizeSprite(Surface* sprite, uint16_t new_width, uint16_t new_height) {
+    if (!sprite || !sprite->pixels || !(sprite->flags & BGL_SURFACE_SPRITE)) return;
 
-    // Update clip rectangle
-    sprite->clip_rect.w = new_width;
-    sprite->clip_rect.h = new_height;
+    // Sprites always own their pixels, so shrinking them never allocates
+    resizePixels(sprite, new_width, new_height);
 }
@@ -2,15 +2,16 @@
 #define _KERNEL_GRAPHICS_DRAW_H 1
 
 #include "surface.h"
+#include "region.h"
 
-// Maximum number of dirty rectangles to track
-#define MAX_DIRTY_RECTS 32
+// What a rectangle costs to redraw on top of its pixels, in pixels (the call, the
+// clipping and the setup of each row), redraws merge rectangles closer than this
+#define BGL_RECT_COST 256
 
-// Dirty rectangle tracking structure
+// Dirty rectangle tracking structure, the region has exactly the changed pixels
 typedef struct {
-    Rect rects[MAX_DIRTY_RECTS];
-    uint16_t count;
-    uint16_t max;
+    Region region;
+    uint16_t max;                 // Most rectangles bglUpdateRects will redraw
 } DirtyRectList;
 
 // Dirty Rectangle Management
@@ -32,12 +33,15 @@ void bglCopySurfaceRegion(Surface* src, Rect* srcrect, Surface* dst, Rect* dstre
 void bglScrollSurface(Surface* surface, Rect* rect, int16_t dx, int16_t dy);
 void bglResizeSurface(Surface* surface, uint16_t new_width, uint16_t new_height);
 void bglResizeSprite(Surface* sprite, uint16_t new_width, uint16_t new_height);
+void bglScaleSurface(Surface* src, uint8_t* pixels, uint16_t width, uint16_t height); // Into ((width + 1) / 2) * height bytes of the caller
 void bglFlipSurface(Surface* surface, bool vertical, bool horizontal);
 
 /// Surface Region Management
 void bglFillCircle(Surface* surface, uint16_t x, uint16_t y, uint16_t radius, uint8_t color);
 void bglDrawCircle(Surface* surface, uint16_t x, uint16_t y, uint16_t radius, uint8_t color);
 void bglFillRect(Surface* surface, Rect* rect, uint8_t color);
+void bglFillPolygon(Surface* surface, Point* points, uint16_t count, uint8_t color);
+void bglFillTriangle(Surface* surface, Point a, Point b, Point c, uint8_t color);
 void bglDrawRect(Surface* surface, Rect* rect, uint8_t color);
 void bglDrawLine(Surface* surface, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, uint8_t color);
 
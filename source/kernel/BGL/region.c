@@ -0,0 +1,372 @@
+#include "region.h"
+#include "../memory/memory.h"
+#include "../memory/heap.h"
+
+/*
+ * The operations sweep both regions from the top, in slabs of rows where neither of
+ * them changes. Each slab is a band of the result, its spans come from a walk over the
+ * x edges of both bands (inside A, inside B, or both), and it is merged into the band
+ * above when they touch and have the same spans. Same idea as the X11 miRegionOp.
+ */
+
+#define REGION_UNION        0
+#define REGION_INTERSECT    1
+#define REGION_SUBTRACT     2
+
+#define REGION_GROWTH       16U
+#define REGION_INFINITY     0x7FFFFFFF
+
+
+static bool regionReserve(Region* region, uint32_t count) {
+    if (count <= region->capacity) return true;
+    if (count > 0xFFFF) return false;
+
+    uint32_t capacity = MIN(MAX(count, (uint32_t) region->capacity * 2), 0xFFFFU);
+    capacity = MAX(capacity, REGION_GROWTH);
+
+    Rect* rects = (Rect*) memoryAllocateBlock(capacity * sizeof(Rect));
+    if (!rects) return false;
+
+    if (region->rects) {
+        memoryCopy(rects, region->rects, region->count * sizeof(Rect));
+        memoryFreeBlock(region->rects);
+    }
+
+    region->rects = rects;
+    region->capacity = capacity;
+    return true;
+}
+
+
+// First rectangle after the band that starts at 'start'
+static inline uint16_t bandEnd(Region* region, uint16_t start) {
+    uint16_t end = start + 1;
+    while ((end < region->count) && (region->rects[end].y == region->rects[start].y)) end++;
+    return end;
+}
+
+
+// Left edges are the even ones, right edges the odd ones
+static inline int32_t spanEdge(const Rect* band, uint16_t edge) {
+    const Rect* rect = &band[edge >> 1];
+    return (edge & 1) ? (rect->x + rect->w) : rect->x;
+}
+
+
+static void regionUpdateExtents(Region* region) {
+    if (!region->count) {
+        region->extents = (Rect) {0, 0, 0, 0};
+        return;
+    }
+
+    int32_t left = REGION_INFINITY, right = -REGION_INFINITY;
+    for (uint16_t i = 0; i < region->count; i++) {
+        left = MIN(left, (int32_t) region->rects[i].x);
+        right = MAX(right, (int32_t) region->rects[i].x + region->rects[i].w);
+    }
+
+    Rect* last = &region->rects[region->count - 1];
+    region->extents = (Rect) {left, region->rects[0].y, right - left, last->y + last->h - region->rects[0].y};
+}
+
+
+// Add the rows [top, bottom) of the result, 'previous' is the first rect of the band above
+static bool regionAddBand(Region* result, uint16_t* previous, int32_t top, int32_t bottom, const Rect* a, uint16_t na, const Rect* b, uint16_t nb, uint8_t op) {
+    if (!regionReserve(result, (uint32_t) result->count + na + nb)) return false;
+
+    uint16_t start = result->count;
+    uint16_t i = 0, j = 0;
+    bool inside = false;
+    int32_t left = 0;
+
+    while ((i < (na * 2)) || (j < (nb * 2))) {
+        int32_t edge_a = (i < (na * 2)) ? spanEdge(a, i) : REGION_INFINITY;
+        int32_t edge_b = (j < (nb * 2)) ? spanEdge(b, j) : REGION_INFINITY;
+        int32_t x = MIN(edge_a, edge_b);
+
+        if (edge_a == x) i++;
+        if (edge_b == x) j++;
+
+        // An odd edge count means we are inside a span of that band
+        bool in_a = i & 1, in_b = j & 1;
+        bool now;
+
+        switch (op) {
+            case REGION_UNION:      now = in_a || in_b; break;
+            case REGION_INTERSECT:  now = in_a && in_b; break;
+            default:                now = in_a && !in_b; break;
+        }
+
+        if (now && !inside) {
+            left = x;
+        } else if (!now && inside) {
+            result->rects[result->count++] = (Rect) {left, top, x - left, bottom - top};
+        }
+
+        inside = now;
+    }
+
+    uint16_t count = result->count - start;
+    if (!count) return true;
+
+    // The same spans right below the previous band only make it taller
+    if (start) {
+        Rect* above = &result->rects[*previous];
+        bool same = ((start - *previous) == count) && ((above->y + above->h) == top);
+
+        for (uint16_t k = 0; same && (k < count); k++) {
+            same = (above[k].x == result->rects[start + k].x) && (above[k].w == result->rects[start + k].w);
+        }
+
+        if (same) {
+            for (uint16_t k = 0; k < count; k++) above[k].h += bottom - top;
+            result->count = start;
+            return true;
+        }
+    }
+
+    *previous = start;
+    return true;
+}
+
+
+static bool regionOperate(Region* dst, Region* a, Region* b, uint8_t op) {
+    Region result;
+    bglInitRegion(&result);
+
+    uint16_t ia = 0, ib = 0, previous = 0;
+    int32_t y = -REGION_INFINITY;
+
+    while ((ia < a->count) || (ib < b->count)) {
+        // Nothing more can come out of an intersection or a subtraction
+        if ((op != REGION_UNION) && (ia >= a->count)) break;
+        if ((op == REGION_INTERSECT) && (ib >= b->count)) break;
+
+        uint16_t ea = (ia < a->count) ? bandEnd(a, ia) : ia;
+        uint16_t eb = (ib < b->count) ? bandEnd(b, ib) : ib;
+
+        int32_t a_top = (ia < a->count) ? a->rects[ia].y : REGION_INFINITY;
+        int32_t b_top = (ib < b->count) ? b->rects[ib].y : REGION_INFINITY;
+        int32_t a_bottom = (ia < a->count) ? a_top + a->rects[ia].h : REGION_INFINITY;
+        int32_t b_bottom = (ib < b->count) ? b_top + b->rects[ib].h : REGION_INFINITY;
+
+        // Skip the rows above both bands, then go down to the next place where one changes
+        y = MAX(y, MIN(a_top, b_top));
+
+        bool in_a = y >= a_top, in_b = y >= b_top;
+        int32_t bottom = MIN(in_a ? a_bottom : a_top, in_b ? b_bottom : b_top);
+
+        if (!regionAddBand(&result, &previous, y, bottom, &a->rects[ia], in_a ? (ea - ia) : 0, &b->rects[ib], in_b ? (eb - ib) : 0, op)) {
+            bglDestroyRegion(&result);
+            return false;
+        }
+
+        y = bottom;
+        if (y >= a_bottom) ia = ea;
+        if (y >= b_bottom) ib = eb;
+    }
+
+    regionUpdateExtents(&result);
+
+    // Done with the operands, so the destination can be one of them
+    bglDestroyRegion(dst);
+    *dst = result;
+    return true;
+}
+
+
+void bglInitRegion(Region* region) {
+    if (!region) return;
+    region->rects = NULL;
+    region->count = 0;
+    region->capacity = 0;
+    region->extents = (Rect) {0, 0, 0, 0};
+}
+
+
+void bglDestroyRegion(Region* region) {
+    if (!region) return;
+    if (region->rects) memoryFreeBlock(region->rects);
+    bglInitRegion(region);
+}
+
+
+void bglClearRegion(Region* region) {
+    if (!region) return;
+    region->count = 0;
+    region->extents = (Rect) {0, 0, 0, 0};
+}
+
+
+bool bglSetRegionRect(Region* region, Rect* rect) {
+    if (!region) return false;
+    bglClearRegion(region);
+
+    if (!rect || !rect->w || !rect->h) return true;
+    if (!regionReserve(region, 1)) return false;
+
+    region->rects[0] = *rect;
+    region->count = 1;
+    region->extents = *rect;
+    return true;
+}
+
+
+bool bglUnionRegion(Region* dst, Region* a, Region* b) {
+    if (!dst || !a || !b) return false;
+    return regionOperate(dst, a, b, REGION_UNION);
+}
+
+
+bool bglIntersectRegion(Region* dst, Region* a, Region* b) {
+    if (!dst || !a || !b) return false;
+    return regionOperate(dst, a, b, REGION_INTERSECT);
+}
+
+
+bool bglSubtractRegion(Region* dst, Region* a, Region* b) {
+    if (!dst || !a || !b) return false;
+    return regionOperate(dst, a, b, REGION_SUBTRACT);
+}
+
+
+bool bglUnionRegionRect(Region* region, Rect* rect) {
+    if (!region) return false;
+    if (!rect || !rect->w || !rect->h) return true;
+    if (!region->count) return bglSetRegionRect(region, rect);
+
+    // The rect as a region of its own, only read by the operation
+    Region single = { rect, 1, 0, *rect };
+    return regionOperate(region, region, &single, REGION_UNION);
+}
+
+
+uint32_t bglGetRegionArea(Region* region) {
+    if (!region) return 0;
+
+    uint32_t area = 0;
+    for (uint16_t i = 0; i < region->count; i++) {
+        area += (uint32_t) region->rects[i].w * region->rects[i].h;
+    }
+    return area;
+}
+
+
+bool bglRegionContains(Region* region, int16_t x, int16_t y) {
+    if (!region) return false;
+
+    for (uint16_t i = 0; i < region->count; i++) {
+        Rect* rect = &region->rects[i];
+        if (y < rect->y) return false; // The bands below start even lower
+        if ((y < rect->y + rect->h) && (x >= rect->x) && (x < rect->x + rect->w)) return true;
+    }
+    return false;
+}
+
+
+// Pixels that don't belong to the region but get in when [first, end) becomes its bounding box
+static uint32_t regionWaste(Region* region, uint16_t first, uint16_t end) {
+    int32_t left = REGION_INFINITY, right = -REGION_INFINITY;
+    uint32_t area = 0;
+
+    for (uint16_t i = first; i < end; i++) {
+        Rect* rect = &region->rects[i];
+        left = MIN(left, (int32_t) rect->x);
+        right = MAX(right, (int32_t) rect->x + rect->w);
+        area += (uint32_t) rect->w * rect->h;
+    }
+
+    Rect* last = &region->rects[end - 1];
+    uint32_t height = last->y + last->h - region->rects[first].y;
+    return ((uint32_t) (right - left) * height) - area;
+}
+
+
+// Replace the rects [first, end) (whole bands, one after the other) by their bounding box
+static void regionCollapse(Region* region, uint16_t first, uint16_t end) {
+    int32_t left = REGION_INFINITY, right = -REGION_INFINITY;
+
+    for (uint16_t i = first; i < end; i++) {
+        left = MIN(left, (int32_t) region->rects[i].x);
+        right = MAX(right, (int32_t) region->rects[i].x + region->rects[i].w);
+    }
+
+    Rect* last = &region->rects[end - 1];
+    region->rects[first] = (Rect) {left, region->rects[first].y, right - left, last->y + last->h - region->rects[first].y};
+
+    memoryMove(&region->rects[first + 1], &region->rects[end], (region->count - end) * sizeof(Rect));
+    region->count -= end - first - 1;
+}
+
+
+void bglSimplifyRegion(Region* region, uint32_t cost, uint16_t max_rects) {
+    if (!region || !region->count) return;
+    max_rects = MAX(max_rects, 1);
+
+    // Rects of a band closer than what a rect costs become one
+    uint16_t count = 0;
+    for (uint16_t i = 0; i < region->count; i++) {
+        Rect* rect = &region->rects[i];
+
+        if (count) {
+            Rect* last = &region->rects[count - 1];
+            if ((last->y == rect->y) && (((uint32_t) (rect->x - (last->x + last->w)) * rect->h) <= cost)) {
+                last->w = rect->x + rect->w - last->x;
+                continue;
+            }
+        }
+
+        region->rects[count++] = *rect;
+    }
+    region->count = count;
+
+    // Same for two bands of a single rect, one above the other
+    uint16_t first = 0;
+    while (first < region->count) {
+        uint16_t second = bandEnd(region, first);
+        if (second >= region->count) break;
+
+        uint16_t end = bandEnd(region, second);
+
+        if (((second - first) == 1) && ((end - second) == 1) && (regionWaste(region, first, end) <= cost)) {
+            regionCollapse(region, first, end);
+        } else {
+            first = second;
+        }
+    }
+
+    // Then the cheapest merges, a band into one rect or two bands into one, until there are few enough
+    while (region->count > max_rects) {
+        uint16_t best_first = 0, best_end = region->count;
+        uint32_t best_waste = 0xFFFFFFFF;
+
+        for (first = 0; first < region->count; ) {
+            uint16_t second = bandEnd(region, first);
+
+            if ((second - first) > 1) {
+                uint32_t waste = regionWaste(region, first, second);
+                if (waste < best_waste) {
+                    best_waste = waste;
+                    best_first = first;
+                    best_end = second;
+                }
+            }
+
+            if (second < region->count) {
+                uint16_t end = bandEnd(region, second);
+                uint32_t waste = regionWaste(region, first, end);
+                if (waste < best_waste) {
+                    best_waste = waste;
+                    best_first = first;
+                    best_end = end;
+                }
+            }
+
+            first = second;
+        }
+
+        regionCollapse(region, best_first, best_end);
+    }
+
+    regionUpdateExtents(region);
+}
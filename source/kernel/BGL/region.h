@@ -0,0 +1,36 @@
+#ifndef _KERNEL_GRAPHICS_REGION_H
+#define _KERNEL_GRAPHICS_REGION_H 1
+
+#include "../../common/common.h"
+
+// Region structure (like the X11 and pixman regions), a set of pixels as rectangles
+// in y-bands: the rectangles of a band share y and h, are sorted by x and don't touch,
+// the bands are sorted by y and don't overlap, and equal touching bands are merged
+typedef struct {
+    Rect* rects;                  // Rectangles, band by band from the top
+    uint16_t count;               // Rectangles in use
+    uint16_t capacity;            // Rectangles allocated
+    Rect extents;                 // Bounding box, all zero when empty
+} Region;
+
+// Create / destroy regions
+void bglInitRegion(Region* region);
+void bglDestroyRegion(Region* region);
+void bglClearRegion(Region* region);
+bool bglSetRegionRect(Region* region, Rect* rect);
+
+// Region algebra, the result can be one of the operands (false if out of memory)
+bool bglUnionRegion(Region* dst, Region* a, Region* b);
+bool bglIntersectRegion(Region* dst, Region* a, Region* b);
+bool bglSubtractRegion(Region* dst, Region* a, Region* b);
+bool bglUnionRegionRect(Region* region, Rect* rect);
+
+// Region properties
+uint32_t bglGetRegionArea(Region* region);
+bool bglRegionContains(Region* region, int16_t x, int16_t y);
+
+// Trade extra pixels for fewer rectangles, 'cost' is what a rectangle costs (in pixels)
+// on top of its area, and there are never more than 'max_rects' rectangles left
+void bglSimplifyRegion(Region* region, uint32_t cost, uint16_t max_rects);
+
+#endif /* _KERNEL_GRAPHICS_REGION_H */
@@ -1,6 +1,7 @@
 #include "surface.h"
 
 #include "../drivers/graphics.h"
+#include "../drivers/VGA/bochs.h"
 #include "../memory/memory.h"
 #include "../memory/heap.h"
 
@@ -8,30 +9,218 @@
 // I like SDL so ... let's make a simple version of it
 // Imagine make videogames using this ... LOL
 
-// Helper function to clip rectangles
-static bool clipRects(Rect* src, Rect* dst, Rect* clip) {
-    int16_t dx = clip->x - dst->x;
-    int16_t dy = clip->y - dst->y;
+/*
+ * Blits work on 8 pixels at a time, as 32 bit words (SWAR). The destination is taken
+ * byte aligned (an odd first pixel goes alone), and when the source is half a byte off
+ * its words are shifted by a nibble while loaded. Color keys become a nibble mask.
+ *
+ * Blending is a table lookup: every mode has a 16x16 table of what a color becomes over
+ * another one, and a 256x256 one built from it for two packed bytes, so two pixels are
+ * blended with a single lookup.
+ */
 
-    if (dx > 0) {
-        src->x += dx;
-        src->w -= dx;
-        dst->x = clip->x;
+#define BGL_NIBBLES     0x11111111U
+
+/* The blended color of a pair of colors, indexed by (source << 4) | destination */
+static uint8_t blend_colors[BGL_BLEND_COUNT][256];
+static bool blend_ready = false;
+
+/* Two blended pixels of a pair of packed bytes, indexed by (source << 8) | destination */
+static uint8_t* blend_pairs[BGL_BLEND_COUNT];
+
+
+// The CGA colors of the VGA palette: 0xAA per color bit, 0x55 more when bright, brown has half the green
+static inline uint8_t paletteComponent(uint8_t color, uint8_t bit) {
+    uint8_t value = ((color >> bit) & 1) ? 0xAA : 0x00;
+    if ((color == 0x06) && (bit == 1)) value = 0x55;
+    return value + ((color & 0x08) ? 0x55 : 0x00);
+}
+
+
+static uint8_t blendColor(BlendMode mode, uint8_t s, uint8_t d) {
+    switch (mode) {
+        case BGL_BLEND_ADD:         return (s + d) & 0x0F;
+        case BGL_BLEND_MOD:         return (s * d) >> 4;
+        case BGL_BLEND_SUB:         return (d > s) ? (d - s) : 0;
+        case BGL_BLEND_MULTIPLY:    return ((s * d) + 7) / 15;
+        case BGL_BLEND_SCREEN:      return 15 - ((((15 - s) * (15 - d)) + 7) / 15);
+
+        case BGL_BLEND_AVERAGE: {
+            uint8_t best = 0;
+            uint32_t distance = 0xFFFFFFFF;
+
+            for (uint8_t color = 0; color < 16; color++) {
+                uint32_t sum = 0;
+                for (uint8_t bit = 0; bit < 3; bit++) {
+                    int32_t delta = ((paletteComponent(s, bit) + paletteComponent(d, bit)) >> 1) - paletteComponent(color, bit);
+                    sum += delta * delta;
+                }
+
+                if (sum < distance) {
+                    distance = sum;
+                    best = color;
+                }
+            }
+            return best;
+        }
+
+        default:                    return s;
     }
-    if (dy > 0) {
-        src->y += dy;
-        src->h -= dy;
-        dst->y = clip->y;
+}
+
+
+// The tables of a mode, NULL for the modes that just copy
+static const uint8_t* getBlendColors(BlendMode mode) {
+    if ((mode == BGL_BLEND_NONE) || (mode == BGL_BLEND_ALPHA) || (mode >= BGL_BLEND_COUNT)) return NULL;
+
+    if (!blend_ready) {
+        for (uint8_t m = 0; m < BGL_BLEND_COUNT; m++) {
+            for (uint16_t i = 0; i < 256; i++) {
+                blend_colors[m][i] = blendColor(m, i >> 4, i & 0x0F);
+            }
+        }
+        blend_ready = true;
     }
 
-    if (dst->x + src->w > clip->x + clip->w) {
-        src->w = clip->x + clip->w - dst->x;
+    return blend_colors[mode];
+}
+
+
+// Built on first use (64 KB each), without memory the blits take the color table per nibble
+static const uint8_t* getBlendPairs(BlendMode mode) {
+    const uint8_t* colors = getBlendColors(mode);
+    if (!colors) return NULL;
+
+    if (!blend_pairs[mode]) {
+        uint8_t* pairs = (uint8_t*) memoryAllocateBlock(256 * 256);
+        if (!pairs) return NULL;
+
+        for (uint32_t i = 0; i < (256 * 256); i++) {
+            uint8_t s = i >> 8, d = i & 0xFF;
+            pairs[i] = (colors[(s & 0xF0) | (d >> 4)] << 4) | colors[((s & 0x0F) << 4) | (d & 0x0F)];
+        }
+
+        blend_pairs[mode] = pairs;
     }
-    if (dst->y + src->h > clip->y + clip->h) {
-        src->h = clip->y + clip->h - dst->y;
+
+    return blend_pairs[mode];
+}
+
+
+// Helper function to clip a blit, against the source surface and the destination clip rect
+static bool clipRects(Surface* src, Rect* sr, Surface* dst, Rect* dr) {
+    int32_t sx = sr->x, sy = sr->y, w = sr->w, h = sr->h;
+    int32_t dx = dr->x, dy = dr->y;
+
+    // Only what the source has, the destination moves along
+    if (sx < 0) { dx -= sx; w += sx; sx = 0; }
+    if (sy < 0) { dy -= sy; h += sy; sy = 0; }
+    w = MIN(w, (int32_t) src->w - sx);
+    h = MIN(h, (int32_t) src->h - sy);
+
+    int32_t left = MAX((int32_t) dst->clip_rect.x, 0);
+    int32_t top = MAX((int32_t) dst->clip_rect.y, 0);
+    int32_t right = MIN((int32_t) dst->clip_rect.x + dst->clip_rect.w, (int32_t) dst->w);
+    int32_t bottom = MIN((int32_t) dst->clip_rect.y + dst->clip_rect.h, (int32_t) dst->h);
+
+    if (dx < left) { sx += left - dx; w -= left - dx; dx = left; }
+    if (dy < top) { sy += top - dy; h -= top - dy; dy = top; }
+    w = MIN(w, right - dx);
+    h = MIN(h, bottom - dy);
+
+    if ((w <= 0) || (h <= 0)) return false;
+
+    *sr = (Rect) {sx, sy, w, h};
+    *dr = (Rect) {dx, dy, w, h};
+    return true;
+}
+
+
+static inline uint32_t blendWord(uint32_t s, uint32_t d, const uint8_t* colors, const uint8_t* pairs) {
+    uint32_t result = 0;
+
+    if (pairs) {
+        for (uint8_t shift = 0; shift < 32; shift += 8) {
+            result |= (uint32_t) pairs[(((s >> shift) & 0xFF) << 8) | ((d >> shift) & 0xFF)] << shift;
+        }
+    } else {
+        for (uint8_t shift = 0; shift < 32; shift += 4) {
+            result |= (uint32_t) colors[(((s >> shift) & 0x0F) << 4) | ((d >> shift) & 0x0F)] << shift;
+        }
     }
 
-    return (src->w > 0 && src->h > 0);
+    return result;
+}
+
+
+// 0xF on the nibbles that are not the key color, 0 on the others
+static inline uint32_t keyMask(uint32_t s, uint32_t keys) {
+    uint32_t bits = s ^ keys;
+    bits |= bits >> 1;
+    bits |= bits >> 2; // Bit 0 of a nibble is now the OR of its 4 bits
+    return (bits & BGL_NIBBLES) * 0x0F;
+}
+
+
+// Eight pixels from any pixel of a row, in the byte layout they'd have starting on a byte
+static inline uint32_t loadPixels(const uint8_t* row, uint32_t pixel) {
+    const uint8_t* bytes = row + (pixel >> 1);
+    uint32_t word = *(const uint32_t*) bytes;
+
+    if (pixel & 1) {
+        word = ((word << 4) & 0xF0F0F0F0U) | ((word >> 12) & 0x000F0F0FU) | ((uint32_t) (bytes[4] >> 4) << 24);
+    }
+    return word;
+}
+
+
+static inline void blitPixel(const uint8_t* src, uint32_t sx, uint8_t* dst, uint32_t dx, const uint8_t* colors, bool keyed, uint8_t key) {
+    uint8_t s = (sx & 1) ? (src[sx >> 1] & 0x0F) : (src[sx >> 1] >> 4);
+    if (keyed && (s == key)) return;
+
+    uint8_t* pixel = &dst[dx >> 1];
+    uint8_t color = colors ? colors[(s << 4) | ((dx & 1) ? (*pixel & 0x0F) : (*pixel >> 4))] : s;
+
+    *pixel = (dx & 1) ? ((*pixel & 0xF0) | color) : ((*pixel & 0x0F) | (color << 4));
+}
+
+
+static void blitRow(const uint8_t* src, uint32_t sx, uint8_t* dst, uint32_t dx, uint16_t w, const uint8_t* colors, const uint8_t* pairs, bool keyed, uint8_t key) {
+    uint32_t keys = key * BGL_NIBBLES;
+    uint16_t x = 0;
+
+    // An odd first destination pixel, so the rest starts on a byte
+    if (dx & 1) {
+        blitPixel(src, sx, dst, dx, colors, keyed, key);
+        x = 1;
+    }
+
+    uint8_t* output = dst + ((dx + x) >> 1);
+
+    if (!keyed && !colors && !((sx + x) & 1)) {
+        // Both sides on a byte, a plain copy
+        uint16_t bytes = (w - x) >> 1;
+        fastFastMemoryCopy(output, src + ((sx + x) >> 1), bytes);
+        x += bytes << 1;
+    } else {
+        for (; (x + 8) <= w; x += 8, output += 4) {
+            uint32_t s = loadPixels(src, sx + x);
+            uint32_t d = *(uint32_t*) output;
+            uint32_t result = colors ? blendWord(s, d, colors, pairs) : s;
+
+            if (keyed) {
+                uint32_t mask = keyMask(s, keys);
+                result = (result & mask) | (d & ~mask);
+            }
+
+            *(uint32_t*) output = result;
+        }
+    }
+
+    // And the last few pixels one by one
+    for (; x < w; x++) {
+        blitPixel(src, sx + x, dst, dx + x, colors, keyed, key);
+    }
 }
 
 
@@ -148,64 +337,28 @@ void bglFillSurface(Surface* surface, uint8_t color) {
 
 
 void bglBlit(Surface* src, Rect* srcrect, Surface* dst, Rect* dstrect) {
-    if (!src || !dst) return;
+    if (!src || !dst || !src->pixels || !dst->pixels) return;
 
     Rect sr = srcrect ? *srcrect : (Rect) {0, 0, src->w, src->h};
     Rect dr = dstrect ? *dstrect : (Rect) {0, 0, sr.w, sr.h};
 
-    // Clip against destination surface
-    if (!clipRects(&sr, &dr, &dst->clip_rect)) return;
-
-    // Calculate starting positions
-    uint32_t srcOffset = (sr.y * src->pitch) + (sr.x >> 1);
-    uint32_t dstOffset = (dr.y * dst->pitch) + (dr.x >> 1);
-
-    uint8_t* srcPtr = src->pixels + srcOffset;
-    uint8_t* dstPtr = dst->pixels + dstOffset;
-
-    // Copy rows with blending
-    for (uint16_t y = 0; y < sr.h; y++) {
-
-        if (src->blend_mode == BGL_BLEND_NONE) {
-            fastFastMemoryCopy(dstPtr, srcPtr, sr.w >> 1);
+    if (!clipRects(src, &sr, dst, &dr)) return;
 
-        } else {
-            // Handle other blend modes
-            for (uint16_t x = 0; x < sr.w; x++) {
-                uint8_t src_val = srcPtr[x >> 1];
-                uint8_t dst_val = dstPtr[x >> 1];
+    const uint8_t* colors = getBlendColors(src->blend_mode);
+    const uint8_t* pairs = getBlendPairs(src->blend_mode);
 
-                uint8_t srcColor = (x & 1) ? (src_val & 0x0F) : (src_val >> 4);
+    // The color key is only used by the blending modes, the plain copy takes everything
+    bool keyed = (src->blend_mode != BGL_BLEND_NONE) && (src->flags & BGL_SURFACE_COLORKEY);
+    uint8_t key = src->colorkey >> 4;
 
-                // FIX: Compare with the lower nibble of colorkey instead of full value
-                if (src->flags & BGL_SURFACE_COLORKEY && srcColor == (src->colorkey >> 4)) continue;
+    const uint8_t* srcRow = src->pixels + (sr.y * src->pitch);
+    uint8_t* dstRow = dst->pixels + (dr.y * dst->pitch);
 
-                uint8_t dstColor = (x & 1) ? (dst_val & 0x0F) : (dst_val >> 4);
-
-                uint8_t finalColor = srcColor;
-                switch (src->blend_mode) {
-                    case BGL_BLEND_ADD:
-                        finalColor = (srcColor + dstColor) & 0x0F;
-                        break;
-
-                    case BGL_BLEND_MOD:
-                        finalColor = ((srcColor * dstColor) >> 4) & 0x0F;
-                        break;
-
-                    default:
-                        break;
-                }
-
-                if (x & 1) {
-                    dstPtr[x >> 1] = (dst_val & 0xF0) | finalColor;
-                } else {
-                    dstPtr[x >> 1] = (dst_val & 0x0F) | (finalColor << 4);
-                }
-            }
-        }
+    for (uint16_t y = 0; y < sr.h; y++) {
+        blitRow(srcRow, sr.x, dstRow, dr.x, sr.w, colors, pairs, keyed, key);
 
-        srcPtr += src->pitch;
-        dstPtr += dst->pitch;
+        srcRow += src->pitch;
+        dstRow += dst->pitch;
     }
 }
 
@@ -217,6 +370,23 @@ void bglBlitToScreen(Surface* surface, Rect* srcrect, uint16_t x, uint16_t y) {
 
     // Draw directly to screen using existing function
     drawBitmapFast(surface->pixels, x, y, sr.w, sr.h);
+    presentScreen();
+}
+
+
+void bglBlitToFramebuffer(Surface* surface, Rect* srcrect, int16_t x, int16_t y) {
+    if (!surface) return;
+
+    Rect sr = srcrect ? *srcrect : (Rect) {0, 0, surface->w, surface->h};
+
+    // Keep the source rectangle inside the surface
+    if (sr.x < 0) { sr.w = (sr.w > -sr.x) ? sr.w + sr.x : 0; x -= sr.x; sr.x = 0; }
+    if (sr.y < 0) { sr.h = (sr.h > -sr.y) ? sr.h + sr.y : 0; y -= sr.y; sr.y = 0; }
+    if (sr.x + sr.w > surface->w) sr.w = (sr.x < surface->w) ? surface->w - sr.x : 0;
+    if (sr.y + sr.h > surface->h) sr.h = (sr.y < surface->h) ? surface->h - sr.y : 0;
+
+    // Rows are straight copies through the 4bpp to 8/32 bpp tables
+    bgaDrawBitmap(surface->pixels + (sr.y * surface->pitch), surface->pitch, sr.x, x, y, sr.w, sr.h);
 }
 
 
@@ -3,12 +3,18 @@
 
 #include "../../common/common.h"
 
-// Surface blend modes (like SDL)
+// Surface blend modes (like SDL), each one is a table of what a color becomes over
+// another (see blendColor in surface.c), so adding one doesn't touch the blitter
 typedef enum {
     BGL_BLEND_NONE,     // No blending
     BGL_BLEND_ALPHA,    // Alpha blending (simulated with color matching)
     BGL_BLEND_ADD,      // Additive blending
-    BGL_BLEND_MOD       // Modulate blending
+    BGL_BLEND_MOD,      // Modulate blending
+    BGL_BLEND_SUB,      // Subtractive blending, the destination minus the source
+    BGL_BLEND_MULTIPLY, // Multiply blending, darkens
+    BGL_BLEND_SCREEN,   // Screen blending, lightens
+    BGL_BLEND_AVERAGE,  // Half of each, as the nearest palette color
+    BGL_BLEND_COUNT
 } BlendMode;
 
 
@@ -48,6 +54,7 @@ void bglDestroySurface(Surface* surface);
 void bglFillSurface(Surface* surface, uint8_t color);
 void bglBlit(Surface* src, Rect* srcrect, Surface* dst, Rect* dstrect);
 void bglBlitToScreen(Surface* surface, Rect* srcrect, uint16_t x, uint16_t y);
+void bglBlitToFramebuffer(Surface* surface, Rect* srcrect, int16_t x, int16_t y); // BGA linear framebuffer
 
 // Surface properties
 void bglSetColorKey(Surface* surface, uint8_t color);
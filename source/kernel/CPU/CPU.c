@@ -1,5 +1,7 @@
 #include "CPU.h"
 
+#include "PIT/timer.h"
+
 #include "../modules/terminal.h"
 
 #define EDX_SYSCALL                     (1 << 11)   // SYSCALL/SYSRET
@@ -189,3 +191,36 @@ uint32_t processorGetTicks(void) {
     ASM VOLATILE ("rdtsc" : "=a" (ticks));
     return ticks;
 }
+
+
+uint64_t processorGetCycles(void) {
+    uint32_t lower, upper;
+    ASM VOLATILE ("rdtsc" : "=a" (lower), "=d" (upper));
+    return ((uint64_t) upper << 32) | lower;
+}
+
+
+uint32_t processorGetFrequency(void) {
+    static uint32_t frequency = 0;
+
+    if (frequency) {
+        return frequency;
+    }
+
+    // Align to a tick edge first, so we measure complete ticks
+    uint32_t start = timerGetTicks();
+    while (timerGetTicks() == start) {
+        ASM VOLATILE ("pause");
+    }
+
+    // 5 ticks are 50 ms at 100 Hz, the delta fits in 32 bits up to ~85 GHz
+    uint32_t begin = processorGetTicks();
+    start = timerGetTicks();
+    while ((timerGetTicks() - start) < 5) {
+        ASM VOLATILE ("pause");
+    }
+    uint32_t elapsed = processorGetTicks() - begin;
+
+    frequency = elapsed / ((5 * 1000) / PIT_TICKS_PER_SECOND);
+    return frequency;
+}
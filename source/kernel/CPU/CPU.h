@@ -6,4 +6,15 @@
 void processorGetStatus(void);
 uint32_t processorGetTicks(void);
 
+/** Get the full 64-bit time stamp counter */
+uint64_t processorGetCycles(void);
+
+/**
+ * Get the time stamp counter frequency, calibrated against the PIT on the first call.
+ *
+ * @note Interrupts must be enabled, since the calibration waits for PIT ticks.
+ * @return The TSC frequency in kHz (cycles per millisecond).
+ */
+uint32_t processorGetFrequency(void);
+
 #endif /* _CPU_ID_H */
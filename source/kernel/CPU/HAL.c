@@ -102,6 +102,62 @@ inline void writeWordToPort(uint16_t port, uint16_t data) {
 }
 
 
+/**
+ * Read a double word (4 bytes) from the specified port (inl)
+ *
+ * @param port The port number to read from
+ * @return The value read from the port
+ */
+inline uint32_t readLongFromPort(uint16_t port) {
+    uint32_t result;
+
+    ASM VOLATILE ("in %%dx, %%eax" : "=a" (result) : "d" (port));
+
+    /* Make a little delay */
+    OPERATION_WAIT
+
+    return result;
+}
+
+
+/**
+ * Write a double word (4 bytes) to the specified port (outl)
+ *
+ * @param port The port number to write to
+ * @param data The data to write to the port
+ */
+inline void writeLongToPort(uint16_t port, uint32_t data) {
+    ASM VOLATILE ("out %%eax, %%dx" : : "a" (data), "d" (port));
+
+    /* Make a little delay */
+    OPERATION_WAIT
+}
+
+
+/**
+ * Read 'count' words from the specified port into a buffer (rep insw)
+ *
+ * @param port      The port number to read from
+ * @param buffer    The destination buffer
+ * @param count     The number of words to read
+ */
+void readWordsFromPort(uint16_t port, void *buffer, uint32_t count) {
+    ASM VOLATILE ("rep insw" : "+D" (buffer), "+c" (count) : "d" (port) : "memory");
+}
+
+
+/**
+ * Write 'count' words from a buffer to the specified port (rep outsw)
+ *
+ * @param port      The port number to write to
+ * @param buffer    The source buffer
+ * @param count     The number of words to write
+ */
+void writeWordsToPort(uint16_t port, const void *buffer, uint32_t count) {
+    ASM VOLATILE ("rep outsw" : "+S" (buffer), "+c" (count) : "d" (port) : "memory");
+}
+
+
 /**
  * Read a value from the specified register
  *
@@ -54,6 +54,48 @@ unsigned short readWordFromPort(uint16_t port);
 void writeWordToPort(uint16_t port, uint16_t data);
 
 
+/**
+ * Read a double word (4 bytes) from the specified port (inl)
+ *
+ * @param port The port number to read from
+ * @return The value read from the port
+ */
+uint32_t readLongFromPort(uint16_t port);
+
+
+/**
+ * Write a double word (4 bytes) to the specified port (outl)
+ *
+ * @param port The port number to write to
+ * @param data The data to write to the port
+ */
+void writeLongToPort(uint16_t port, uint32_t data);
+
+
+/**
+ * Read 'count' words from the specified port into a buffer (rep insw)
+ *
+ * @note There is no delay between the reads, the device sets the pace
+ *
+ * @param port      The port number to read from
+ * @param buffer    The destination buffer
+ * @param count     The number of words to read
+ */
+void readWordsFromPort(uint16_t port, void *buffer, uint32_t count);
+
+
+/**
+ * Write 'count' words from a buffer to the specified port (rep outsw)
+ *
+ * @note There is no delay between the writes, the device sets the pace
+ *
+ * @param port      The port number to write to
+ * @param buffer    The source buffer
+ * @param count     The number of words to write
+ */
+void writeWordsToPort(uint16_t port, const void *buffer, uint32_t count);
+
+
 /**
  * Read a value from the specified register
  *
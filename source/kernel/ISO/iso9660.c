@@ -0,0 +1,383 @@
+#include "iso9660.h"
+
+#include "../drivers/ATA/ata.h"
+#include "../memory/heap.h"
+#include "../memory/memory.h"
+#include "../modules/terminal.h"
+
+/*
+ * Read-only ISO9660 reader, for the disc we boot from.
+ *
+ * Directories are lists of variable length records that never cross a sector, a zero
+ * length byte means the rest of the sector is padding. The boot ISO is made with Rock
+ * Ridge (-R), so the real file names come from the NM entries of the System Use area,
+ * and the truncated ISO9660 names are only used when there is none.
+ *
+ * @see https://wiki.osdev.org/ISO_9660
+ */
+
+/* Offsets inside a directory record */
+#define ISO_RECORD_LENGTH   0
+#define ISO_RECORD_EXTENT   2
+#define ISO_RECORD_SIZE     10
+#define ISO_RECORD_FLAGS    25
+#define ISO_RECORD_NAME_LEN 32
+#define ISO_RECORD_NAME     33
+
+/* Offsets inside the primary volume descriptor */
+#define ISO_PVD_VOLUME_ID   40
+#define ISO_PVD_ROOT        156
+
+/** Rock Ridge NM flags, the name goes on in the next NM entry */
+#define ISO_NM_CONTINUE     0x01
+
+/** The drive holding the mounted volume */
+static uint8_t iso_bus;
+static uint8_t iso_drive;
+static bool iso_mounted = false;
+
+static iso_entry_t iso_root;
+static char iso_volume[33];
+
+/* Last sector read, directory lookups hit the same one again and again */
+static uint8_t iso_sector[ISO_SECTOR_SIZE];
+static uint32_t iso_sector_lba = 0xFFFFFFFF;
+
+/** Called for each record of a directory, returns false to stop the walk */
+typedef bool (*iso_visitor_t)(const iso_entry_t *entry, void *context);
+
+
+static inline uint32_t isoReadLong(const uint8_t *pointer) {
+    // Both-endian fields, we take the little endian half
+    return pointer[0] | (pointer[1] << 8) | (pointer[2] << 16) | ((uint32_t) pointer[3] << 24);
+}
+
+
+static inline char isoUpper(char character) {
+    return ((character >= 'a') && (character <= 'z')) ? (character - 'a' + 'A') : character;
+}
+
+
+static const uint8_t *isoReadSector(uint32_t lba) {
+    if (lba != iso_sector_lba) {
+        if (!atapiRead(iso_bus, iso_drive, lba, 1, iso_sector)) {
+            iso_sector_lba = 0xFFFFFFFF;
+            return NULL;
+        }
+        iso_sector_lba = lba;
+    }
+    return iso_sector;
+}
+
+
+/** Get the name of a record, the Rock Ridge one if there is one */
+static void isoParseName(const uint8_t *record, uint8_t length, char *name) {
+    uint8_t name_length = record[ISO_RECORD_NAME_LEN];
+    uint8_t used = 0;
+
+    // The System Use area follows the name, padded to an even offset
+    uint32_t offset = ISO_RECORD_NAME + name_length + ((name_length & 1) ? 0 : 1);
+
+    while ((offset + 4) <= length) {
+        const uint8_t *field = record + offset;
+        uint8_t size = field[2];
+
+        if ((size < 4) || ((offset + size) > length)) {
+            break;
+        }
+
+        if ((field[0] == 'N') && (field[1] == 'M') && (size > 5)) {
+            for (uint8_t i = 5; (i < size) && (used < (ISO_NAME_LEN - 1)); i++) {
+                name[used++] = (char) field[i];
+            }
+
+            if (!(field[4] & ISO_NM_CONTINUE)) {
+                name[used] = '\0';
+                return;
+            }
+        }
+
+        offset += size;
+    }
+
+    if (used) {
+        name[used] = '\0';
+        return;
+    }
+
+    // Plain ISO9660 name, without the ";1" version and the dot of extensionless files
+    for (uint8_t i = 0; (i < name_length) && (used < (ISO_NAME_LEN - 1)); i++) {
+        char character = (char) record[ISO_RECORD_NAME + i];
+        if (character == ';') {
+            break;
+        }
+        name[used++] = character;
+    }
+
+    if (used && (name[used - 1] == '.')) {
+        used--;
+    }
+    name[used] = '\0';
+}
+
+
+/** Call the visitor for each entry of a directory, except "." and ".." */
+static bool isoWalkDirectory(const iso_entry_t *directory, iso_visitor_t visitor, void *context) {
+    uint32_t offset = 0;
+
+    while (offset < directory->size) {
+        uint32_t position = offset % ISO_SECTOR_SIZE;
+
+        const uint8_t *sector = isoReadSector(directory->extent + (offset / ISO_SECTOR_SIZE));
+        if (!sector) {
+            return false;
+        }
+
+        const uint8_t *record = sector + position;
+        uint8_t length = record[ISO_RECORD_LENGTH];
+
+        // Padding up to the next sector
+        if (length == 0) {
+            offset += ISO_SECTOR_SIZE - position;
+            continue;
+        }
+
+        if ((length <= ISO_RECORD_NAME) || ((position + length) > ISO_SECTOR_SIZE) || ((ISO_RECORD_NAME + record[ISO_RECORD_NAME_LEN]) > length)) {
+            fprintf(serial, "FAIL: Corrupted ISO9660 directory record at sector %d\n", directory->extent + (offset / ISO_SECTOR_SIZE));
+            return false;
+        }
+
+        offset += length;
+
+        // "." and ".." have the single byte names 0x00 and 0x01
+        if ((record[ISO_RECORD_NAME_LEN] == 1) && (record[ISO_RECORD_NAME] <= 1)) {
+            continue;
+        }
+
+        iso_entry_t entry;
+        entry.extent = isoReadLong(record + ISO_RECORD_EXTENT);
+        entry.size = isoReadLong(record + ISO_RECORD_SIZE);
+        entry.directory = (record[ISO_RECORD_FLAGS] & ISO_FLAG_DIRECTORY) != 0;
+        isoParseName(record, length, entry.name);
+
+        if (!visitor(&entry, context)) {
+            break;
+        }
+    }
+
+    return true;
+}
+
+
+bool initializeISO(void) {
+    iso_mounted = false;
+
+    for (uint8_t bus = ATA_PRIMARY; bus <= ATA_SECONDARY; bus++) {
+        for (uint8_t drive = ATA_MASTER; drive <= ATA_SLAVE; drive++) {
+            const ata_device_t *device = ataGetDevice(bus, drive);
+            if (!device || !device->atapi || !device->sectors) {
+                continue;
+            }
+
+            iso_bus = bus;
+            iso_drive = drive;
+            iso_sector_lba = 0xFFFFFFFF;
+
+            // Walk the volume descriptors until the primary one (or the terminator)
+            for (uint32_t lba = ISO_VOLUME_START; lba < (ISO_VOLUME_START + 32); lba++) {
+                const uint8_t *descriptor = isoReadSector(lba);
+
+                if (!descriptor || (memoryCompare(descriptor + 1, "CD001", 5) != 0) || (descriptor[0] == ISO_DESCRIPTOR_TERMINATOR)) {
+                    break;
+                }
+
+                if (descriptor[0] != ISO_DESCRIPTOR_PRIMARY) {
+                    continue;
+                }
+
+                const uint8_t *root = descriptor + ISO_PVD_ROOT;
+                iso_root.extent = isoReadLong(root + ISO_RECORD_EXTENT);
+                iso_root.size = isoReadLong(root + ISO_RECORD_SIZE);
+                iso_root.directory = true;
+                strcpy(iso_root.name, "/");
+
+                memoryCopy(iso_volume, descriptor + ISO_PVD_VOLUME_ID, 32);
+                iso_volume[32] = '\0';
+                for (int8_t i = 31; (i >= 0) && (iso_volume[i] == ' '); i--) {
+                    iso_volume[i] = '\0';
+                }
+
+                iso_mounted = true;
+                fprintf(serial, "[ISO] Mounted volume '%s' from %d:%d\n", iso_volume, bus, drive);
+                return true;
+            }
+        }
+    }
+
+    fprintf(serial, "[ISO] No ISO9660 disc found\n");
+    return false;
+}
+
+
+/* Looking for a name inside a directory */
+typedef struct {
+    const char *name;
+    uint32_t length;
+    iso_entry_t *result;
+    bool found;
+} iso_search_t;
+
+
+static bool isoMatchEntry(const iso_entry_t *entry, void *context) {
+    iso_search_t *search = (iso_search_t *) context;
+
+    for (uint32_t i = 0; i < search->length; i++) {
+        if ((entry->name[i] == '\0') || (isoUpper(entry->name[i]) != isoUpper(search->name[i]))) {
+            return true;
+        }
+    }
+
+    if (entry->name[search->length] != '\0') {
+        return true;
+    }
+
+    *search->result = *entry;
+    search->found = true;
+    return false;
+}
+
+
+bool isoFindEntry(const char *path, iso_entry_t *entry) {
+    if (!iso_mounted || !path || !entry) {
+        return false;
+    }
+
+    *entry = iso_root;
+
+    while (*path) {
+        // Skip the separators, then take the next component
+        while (*path == '/') {
+            path++;
+        }
+
+        if (*path == '\0') {
+            break;
+        }
+
+        const char *end = path;
+        while (*end && (*end != '/')) {
+            end++;
+        }
+
+        if (!entry->directory) {
+            return false;
+        }
+
+        iso_entry_t parent = *entry;
+        iso_search_t search = { path, (uint32_t) (end - path), entry, false };
+
+        if (!isoWalkDirectory(&parent, isoMatchEntry, &search) || !search.found) {
+            return false;
+        }
+
+        path = end;
+    }
+
+    return true;
+}
+
+
+uint32_t isoReadFile(const iso_entry_t *entry, uint32_t offset, void *buffer, uint32_t length) {
+    if (!iso_mounted || !entry || !buffer || entry->directory || (offset >= entry->size)) {
+        return 0;
+    }
+
+    length = MIN(length, entry->size - offset);
+
+    uint8_t *output = (uint8_t *) buffer;
+    uint32_t lba = entry->extent + (offset / ISO_SECTOR_SIZE);
+    uint32_t skip = offset % ISO_SECTOR_SIZE;
+    uint32_t done = 0;
+
+    // The unaligned head goes through the sector buffer
+    if (skip) {
+        const uint8_t *sector = isoReadSector(lba);
+        if (!sector) {
+            return 0;
+        }
+
+        done = MIN(ISO_SECTOR_SIZE - skip, length);
+        memoryCopy(output, sector + skip, done);
+        lba++;
+    }
+
+    // The whole sectors are read straight into the caller buffer, with a single command
+    uint32_t whole = (length - done) / ISO_SECTOR_SIZE;
+    if (whole) {
+        if (!atapiRead(iso_bus, iso_drive, lba, whole, output + done)) {
+            return done;
+        }
+
+        done += whole * ISO_SECTOR_SIZE;
+        lba += whole;
+    }
+
+    // And the tail through the sector buffer again
+    if (done < length) {
+        const uint8_t *sector = isoReadSector(lba);
+        if (!sector) {
+            return done;
+        }
+
+        memoryCopy(output + done, sector, length - done);
+        done = length;
+    }
+
+    return done;
+}
+
+
+void *isoLoadFile(const char *path, uint32_t *size) {
+    iso_entry_t entry;
+    if (!isoFindEntry(path, &entry) || entry.directory || !entry.size) {
+        fprintf(serial, "FAIL: Can't find %s on the disc\n", path);
+        return NULL;
+    }
+
+    uint8_t *data = (uint8_t *) memoryAllocateBlock(entry.size);
+    if (!data) {
+        fprintf(serial, "FAIL: No memory to load %s (%d bytes)\n", path, entry.size);
+        return NULL;
+    }
+
+    if (isoReadFile(&entry, 0, data, entry.size) != entry.size) {
+        fprintf(serial, "FAIL: Can't read %s\n", path);
+        memoryFreeBlock(data);
+        return NULL;
+    }
+
+    if (size) *size = entry.size;
+    return data;
+}
+
+
+static bool isoPrintEntry(const iso_entry_t *entry, void *context) {
+    if (entry->directory) {
+        printl("\033[93;40m\t[/] \033[0m", "/%s\r\n", entry->name);
+    } else {
+        printl("\033[33;40m\t *  \033[0m", "%s {%d bytes}\r\n", entry->name, entry->size);
+    }
+    return true;
+}
+
+
+bool isoListDirectory(const char *path) {
+    iso_entry_t directory;
+
+    if (!isoFindEntry(path, &directory) || !directory.directory) {
+        return false;
+    }
+
+    printl(INFO, "Contents of <%s> on volume '%s'\r\n", path, iso_volume);
+    return isoWalkDirectory(&directory, isoPrintEntry, NULL);
+}
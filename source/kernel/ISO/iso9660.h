@@ -0,0 +1,75 @@
+#ifndef _KERNEL_ISO9660_H
+#define _KERNEL_ISO9660_H 1
+
+#include "../../common/common.h"
+
+/** Logical sector size of the volume, the same as the CD-ROM sector */
+#define ISO_SECTOR_SIZE     2048
+
+/** The volume descriptors start after the 32 KB system area */
+#define ISO_VOLUME_START    16
+
+/** Longest name we keep, Rock Ridge names included */
+#define ISO_NAME_LEN        64
+
+#define ISO_DESCRIPTOR_PRIMARY      0x01
+#define ISO_DESCRIPTOR_TERMINATOR   0xFF
+
+#define ISO_FLAG_HIDDEN     0x01
+#define ISO_FLAG_DIRECTORY  0x02
+
+/** A file or directory of the mounted volume */
+typedef struct {
+    uint32_t extent;    // First sector of the data
+    uint32_t size;      // Bytes
+    bool directory;
+    char name[ISO_NAME_LEN];
+} iso_entry_t;
+
+/**
+ * Look for an ATAPI drive holding an ISO9660 disc and mount it.
+ *
+ * @return True if a volume was mounted
+ */
+bool initializeISO(void);
+
+/**
+ * Find a file or directory by its absolute path, names are case insensitive
+ * and can be the Rock Ridge ones or the plain ISO9660 ones (without ";1").
+ *
+ * @param path      Path like "/assets/640_candle.bin"
+ * @param entry     Where the found entry is stored
+ * @return          True if the path exists
+ */
+bool isoFindEntry(const char *path, iso_entry_t *entry);
+
+/**
+ * Read part of a file, straight from the drive for the whole sectors.
+ *
+ * @param entry     File found with isoFindEntry()
+ * @param offset    First byte to read
+ * @param buffer    Destination, at least 'length' bytes
+ * @param length    Number of bytes to read
+ * @return          Number of bytes read, less than 'length' at the end of the file or on errors
+ */
+uint32_t isoReadFile(const iso_entry_t *entry, uint32_t offset, void *buffer, uint32_t length);
+
+/**
+ * Read a whole file into a new heap block, for the assets that used to be linked in.
+ *
+ * @param path      Absolute path of the file
+ * @param size      Where the file size is stored, can be NULL
+ * @return          The file contents (free them with memoryFreeBlock()), or NULL if the
+ *                  file doesn't exist or can't be read
+ */
+void *isoLoadFile(const char *path, uint32_t *size);
+
+/**
+ * Print the contents of a directory.
+ *
+ * @param path      Absolute path of the directory
+ * @return          False if the directory doesn't exist
+ */
+bool isoListDirectory(const char *path);
+
+#endif /* _KERNEL_ISO9660_H */
@@ -8,27 +8,7 @@
 /* The butterfly ascii logo */
 extern char butterfly_logo[];
 
-/// Wallpapers 480px
-
-extern uint8_t bigeye_480[BMP_SIZE(480, 480)];
-extern uint8_t myfall_480[BMP_SIZE(480, 480)];
-extern uint8_t myfood_480[BMP_SIZE(480, 480)];
-extern uint8_t mylamb_480[BMP_SIZE(480, 480)];
-extern uint8_t mylife_480[BMP_SIZE(480, 480)];
-extern uint8_t mymind_480[BMP_SIZE(480, 480)];
-extern uint8_t theman_480[BMP_SIZE(480, 480)];
-
-/// Wallpapers 640px
-
-extern uint8_t candle_640[BMP_SIZE(640, 480)];
-extern uint8_t choice_640[BMP_SIZE(640, 480)];
-extern uint8_t clouds_640[BMP_SIZE(640, 480)];
-extern uint8_t myhill_640[BMP_SIZE(640, 480)];
-extern uint8_t mypain_640[BMP_SIZE(640, 480)];
-extern uint8_t mypath_640[BMP_SIZE(640, 480)];
-extern uint8_t myroad_640[BMP_SIZE(640, 480)];
-extern uint8_t mywork_640[BMP_SIZE(640, 480)];
-extern uint8_t wchess_640[BMP_SIZE(640, 480)];
+/* The wallpapers are in the /assets directory of the boot disc, see isoLoadFile() */
 
 
 /* Mouse pointer bitmap */
@@ -50,6 +50,16 @@ void butterfly(multiboot_info_t* multiboot_header, uint32_t boot_magic) {
     initializeMemory(&kernel_tail);
     initializePaging();
 
+    // Find the PCI devices, then the BGA framebuffer and the ATA drives (which may use the IDE controller DMA)
+    initializePCI();
+    initializeBGA();
+    initializeATA();
+    initializeBlockCache();
+    initializePartitions();
+
+    // The disc we booted from, for the assets that aren't linked in the kernel
+    initializeISO();
+
     /* ........ */
 
     setScreen(NULL);
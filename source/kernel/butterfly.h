@@ -7,6 +7,7 @@
 
 #include "BFS/filesystem.h"
 #include "BGL/demo.h"
+#include "ISO/iso9660.h"
 
 #include "CPU//GDT/GDT.h"
 #include "CPU//ISR/ISR.h"
@@ -17,8 +18,13 @@
 #include "CPU/HAL.h"
 
 #include "drivers/ATA/ata.h"
+#include "drivers/BLK/cache.h"
+#include "drivers/BLK/partition.h"
+#include "drivers/BLK/queue.h"
 #include "drivers/COM/serial.h"
+#include "drivers/PCI/pci.h"
 #include "drivers/TTY/console.h"
+#include "drivers/VGA/bochs.h"
 #include "drivers/VGA/video.h"
 #include "drivers/graphics.h"
 #include "drivers/keyboard.h"
@@ -31,6 +37,7 @@
 
 #include "modules/arithmetic.h"
 #include "modules/calendar.h"
+#include "modules/diskbench.h"
 #include "modules/terminal.h"
 
 #include "binaries.h"
@@ -1,15 +1,209 @@
 #include "ata.h"
 
+#include "../PCI/pci.h"
+
+#include "../../CPU/CPU.h"
 #include "../../CPU/HAL.h"
+#include "../../CPU/ISR/ISR.h"
+#include "../../CPU/PIT/timer.h"
+#include "../../memory/heap.h"
 #include "../../modules/terminal.h"
 
+/*
+ * ATA PIO driver.
+ *
+ * Transfers use READ/WRITE MULTIPLE when the drive supports it, so the drive only raises
+ * a data request every 'multiple' sectors, and the 48-bit EXT commands once the request
+ * goes past the 28-bit limit (128 GiB). Each command moves up to 256 sectors.
+ *
+ * Completion is signaled by IRQ14/IRQ15: while the drive works, the CPU sleeps with hlt
+ * and the PIT keeps track of the timeout, so a dead drive can't hang the kernel.
+ *
+ * When the IDE controller can do bus-master DMA (the PIIX on QEMU does), the drive moves
+ * the data straight to memory following a PRD table, and the CPU just sleeps meanwhile.
+ *
+ * Packet devices (the CD-ROM we boot from) get SCSI commands through ATA_CMD_PACKET, and
+ * answer with 2048-byte sectors in chunks of up to ATAPI_BYTE_LIMIT bytes, one per IRQ.
+ *
+ * @see https://wiki.osdev.org/ATA_PIO_Mode
+ * @see https://wiki.osdev.org/ATA/ATAPI_using_DMA
+ * @see https://wiki.osdev.org/ATAPI
+ */
+
+/** How long we wait for a drive before giving up */
+#define ATA_TIMEOUT_MS 5000
+
+#define ATA_PRIMARY_CONTROL     0x3F6
+#define ATA_SECUNDARY_CONTROL   0x376
+
+/** Most bytes a packet device moves per data request (even, and below 64 KB) */
+#define ATAPI_BYTE_LIMIT 0xF800
+
+/** Found drives, indexed by [bus][drive] */
+static ata_device_t ata_devices[2][2];
+
+/* Set by the IRQ handler, along with the status read to acknowledge it */
+static volatile bool ata_irq_pending[2];
+static volatile uint8_t ata_irq_status[2];
+
+/** Physical Region Descriptor, one memory region of a DMA transfer */
+typedef struct {
+    uint32_t address;
+    uint16_t count;     // Bytes, 0 means 64 KB
+    uint16_t flags;
+} PACKED ata_prd_t;
+
+#define ATA_PRD_ENTRIES 256 // Per bus, half a page
+
+/* Bus-master registers and PRD table of each bus, 0/NULL without DMA */
+static uint16_t ata_bm_base[2];
+static ata_prd_t *ata_prd[2];
+
+static bool ata_dma_enabled = true;
+static bool ata_raw_writes = false;
+
+#define ATA_MODE_PIO 0
+#define ATA_MODE_DMA 1
+
+/* Transfer statistics, per mode */
+static struct {
+    uint32_t sectors;
+    uint64_t cycles;    // Total time spent in transfers
+    uint64_t idle;      // Part of it the CPU spent halted
+} ata_stats[2];
+
+/* Cycles spent halted while waiting for interrupts */
+static uint64_t ata_idle_cycles = 0;
+
+
+static inline uint16_t ataGetBase(uint8_t bus) {
+    return (bus == ATA_PRIMARY) ? ATA_PRIMARY_IO : ATA_SECUNDARY_IO;
+}
+
+
+/**
+ * Select a drive and give it the 400ns it needs to put its status on the bus. Reading
+ * the alternate status register four times does it, and it doesn't clear interrupts.
+ * This is the only place where the drive really needs a delay.
+ */
+static void ataSelectDrive(uint8_t bus, uint8_t value) {
+    uint16_t control = (bus == ATA_PRIMARY) ? ATA_PRIMARY_CONTROL : ATA_SECUNDARY_CONTROL;
+
+    writeByteToPort(ataGetBase(bus) + ATA_REG_HDDEVSEL, value);
+    for (uint8_t i = 0; i < 4; i++) {
+        readByteFromPort(control);
+    }
+}
+
+
+static inline uint32_t ataGetDeadline(void) {
+    return timerGetTicks() + ((ATA_TIMEOUT_MS * PIT_TICKS_PER_SECOND) / 1000) + 1;
+}
+
+
+static void ataCallback(registers_t *regs) {
+    uint8_t bus = (regs->int_no == IRQ14) ? ATA_PRIMARY : ATA_SECONDARY;
+
+    // Reading the status register acknowledges the interrupt on the drive side
+    ata_irq_status[bus] = readByteFromPort(ataGetBase(bus) + ATA_REG_STATUS);
+    ata_irq_pending[bus] = true;
+}
+
+
+/** Forget any old interrupt, must be done before issuing a command */
+static inline void ataArmInterrupt(uint8_t bus) {
+    ata_irq_pending[bus] = false;
+}
+
+
+/**
+ * Sleep until the drive raises its interrupt, the PIT wakes us up every tick
+ * to check the deadline. Returns the drive status, or 0xFF on timeout.
+ */
+static uint8_t ataWaitInterrupt(uint8_t bus) {
+    uint32_t deadline = ataGetDeadline();
+
+    ASM VOLATILE ("cli");
+    while (!ata_irq_pending[bus]) {
+        if (timerGetTicks() > deadline) {
+            ASM VOLATILE ("sti");
+            fprintf(serial, "FAIL: ATA interrupt timeout on bus %d\n", bus);
+            return 0xFF;
+        }
+
+        // 'sti' takes effect after the next instruction, so the IRQ can't sneak in before 'hlt'
+        uint64_t start = processorGetCycles();
+        ASM VOLATILE ("sti\n\thlt\n\tcli");
+        ata_idle_cycles += processorGetCycles() - start;
+    }
+
+    ata_irq_pending[bus] = false;
+    ASM VOLATILE ("sti");
+
+    return ata_irq_status[bus];
+}
+
+
+/** Check the status reported by the drive, logging the error if there is one */
+static bool ataCheckStatus(uint16_t io, uint8_t status) {
+    if (status == 0xFF) {
+        return false; // Timeout, already reported
+    }
+
+    if (status & (ATA_SR_ERR | ATA_SR_DF)) {
+        fprintf(serial, "FAIL: ATA command failed (status %#X, error %#X)\n", status, readByteFromPort(io + ATA_REG_ERROR));
+        return false;
+    }
+
+    return true;
+}
+
+
+/** Wait until the drive is no longer busy, returns the last status or 0xFF on timeout */
+static uint8_t ataWaitReady(uint16_t io) {
+    uint32_t deadline = ataGetDeadline();
+
+    while (timerGetTicks() <= deadline) {
+        uint8_t status = readByteFromPort(io + ATA_REG_STATUS);
+        if (!(status & ATA_SR_BSY)) {
+            return status;
+        }
+    }
+    return 0xFF;
+}
+
+
+/** Poll for a data request (used where the drive raises no interrupt), false on errors or timeout */
+static bool ataWaitData(uint16_t io) {
+    uint32_t deadline = ataGetDeadline();
+
+    while (timerGetTicks() <= deadline) {
+        uint8_t status = readByteFromPort(io + ATA_REG_STATUS);
+
+        if (status & ATA_SR_BSY) {
+            continue;
+        }
+
+        if (status & (ATA_SR_ERR | ATA_SR_DF)) {
+            fprintf(serial, "FAIL: ATA command failed (status %#X, error %#X)\n", status, readByteFromPort(io + ATA_REG_ERROR));
+            return false;
+        }
+
+        if (status & ATA_SR_DRQ) {
+            return true;
+        }
+    }
+
+    fprintf(serial, "FAIL: ATA data request timeout!\n");
+    return false;
+}
+
 
 bool ataDeviceDetect(uint8_t bus, uint8_t drive) {
     uint8_t status;
 
-    uint16_t io = (bus == ATA_PRIMARY) ? ATA_PRIMARY_IO : ATA_SECUNDARY_IO;
-    writeByteToPort(io + ATA_REG_HDDEVSEL, 0xA0 | (drive << 4));
-    OPERATION_WAIT
+    uint16_t io = ataGetBase(bus);
+    ataSelectDrive(bus, 0xA0 | (drive << 4));
 
     status = readByteFromPort(io + ATA_REG_STATUS);
     if (status == 0xFF) {
@@ -21,117 +215,770 @@ bool ataDeviceDetect(uint8_t bus, uint8_t drive) {
 
 
 bool ataDeviceIdentify(uint8_t bus, uint8_t drive, uint16_t *buffer) {
-    uint16_t io = (bus == ATA_PRIMARY) ? ATA_PRIMARY_IO : ATA_SECUNDARY_IO;
+    uint16_t io = ataGetBase(bus);
+    ataSelectDrive(bus, 0xA0 | (drive << 4));
 
-    writeByteToPort(io + ATA_REG_HDDEVSEL, 0xA0 | (drive << 4));
-    OPERATION_WAIT
+    // The count and address registers must be zero for IDENTIFY
+    writeByteToPort(io + ATA_REG_SEC_CNT, 0);
+    writeByteToPort(io + ATA_REG_LBA_LOW, 0);
+    writeByteToPort(io + ATA_REG_LBA_MID, 0);
+    writeByteToPort(io + ATA_REG_LBA_UPR, 0);
 
-    writeByteToPort(io + ATA_REG_STATUS, ATA_CMD_IDENTIFY);
+    writeByteToPort(io + ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
     OPERATION_WAIT
 
     if (readByteFromPort(io + ATA_REG_STATUS) == 0) {
         return false;
     }
 
-    for (uint16_t i = 0; i < 256; i++) {
-        buffer[i] = readWordFromPort(io);
+    if (ataWaitReady(io) == 0xFF) {
+        return false;
+    }
+
+    // ATAPI and SATA devices abort IDENTIFY and leave their signature here
+    if (readByteFromPort(io + ATA_REG_LBA_MID) || readByteFromPort(io + ATA_REG_LBA_UPR)) {
+        return false;
     }
 
+    if (!ataWaitData(io)) {
+        return false;
+    }
+
+    readWordsFromPort(io, buffer, 256);
+
     return true;
 }
 
 
-void ataSectorRead(uint8_t bus, uint8_t drive, uint32_t lba, uint8_t *buffer) {
-    if (!buffer) {
-        return;
+bool atapiDeviceIdentify(uint8_t bus, uint8_t drive, uint16_t *buffer) {
+    uint16_t io = ataGetBase(bus);
+    ataSelectDrive(bus, 0xA0 | (drive << 4));
+
+    // Only packet devices leave this signature after aborting IDENTIFY
+    if ((readByteFromPort(io + ATA_REG_LBA_MID) != ATAPI_SIGNATURE_MID) || (readByteFromPort(io + ATA_REG_LBA_UPR) != ATAPI_SIGNATURE_UPR)) {
+        return false;
+    }
+
+    writeByteToPort(io + ATA_REG_COMMAND, ATA_CMD_IDENTIFY_PACKET);
+
+    if (!ataWaitData(io)) {
+        return false;
+    }
+
+    readWordsFromPort(io, buffer, 256);
+
+    return true;
+}
+
+
+/**
+ * Send a packet command and read its 'length' bytes of data (if any). The drive asks
+ * for the packet without an interrupt, then raises one per chunk of data and a last
+ * one without DRQ once the command is complete.
+ */
+static bool atapiSendPacket(uint8_t bus, uint8_t drive, const uint8_t *packet, uint8_t *buffer, uint32_t length) {
+    uint16_t io = ataGetBase(bus);
+
+    ataWaitReady(io);
+    ataSelectDrive(bus, 0xA0 | (drive << 4));
+
+    // PIO data phase, and the byte count limit of each data request
+    writeByteToPort(io + ATA_REG_FEATURES, 0x00);
+    writeByteToPort(io + ATA_REG_LBA_MID, (uint8_t) (ATAPI_BYTE_LIMIT & 0xFF));
+    writeByteToPort(io + ATA_REG_LBA_UPR, (uint8_t) (ATAPI_BYTE_LIMIT >> 8));
+
+    ataArmInterrupt(bus);
+    writeByteToPort(io + ATA_REG_COMMAND, ATA_CMD_PACKET);
+
+    if (!ataWaitData(io)) {
+        return false;
+    }
+
+    writeWordsToPort(io, packet, ATAPI_PACKET_SIZE / 2);
+
+    uint32_t done = 0;
+
+    while (true) {
+        uint8_t status = ataWaitInterrupt(bus);
+        if (!ataCheckStatus(io, status)) {
+            return false;
+        }
+
+        if (!(status & ATA_SR_DRQ)) {
+            break;
+        }
+
+        // The drive tells how many bytes this chunk has
+        uint32_t bytes = readByteFromPort(io + ATA_REG_LBA_MID) | (readByteFromPort(io + ATA_REG_LBA_UPR) << 8);
+        uint32_t count = MIN(bytes, length - done);
+
+        readWordsFromPort(io, buffer + done, count / 2);
+        done += count;
+
+        // Anything we didn't ask for still has to leave the data register
+        for (uint32_t i = count; i < bytes; i += 2) {
+            readWordFromPort(io);
+        }
+    }
+
+    if (done != length) {
+        fprintf(serial, "FAIL: ATAPI command %#X moved %d of %d bytes\n", packet[0], done, length);
+        return false;
+    }
+
+    return true;
+}
+
+
+/**
+ * Send a packet command, retrying it once. A drive reports a "unit attention" condition
+ * (reset, disc changed) by failing the next command, and REQUEST SENSE clears it.
+ */
+static bool atapiCommand(uint8_t bus, uint8_t drive, const uint8_t *packet, uint8_t *buffer, uint32_t length) {
+    if (atapiSendPacket(bus, drive, packet, buffer, length)) {
+        return true;
+    }
+
+    uint8_t sense[18];
+    uint8_t request[ATAPI_PACKET_SIZE] = { ATAPI_CMD_REQUEST_SENSE, 0, 0, 0, sizeof(sense) };
+
+    if (atapiSendPacket(bus, drive, request, sense, sizeof(sense))) {
+        fprintf(serial, "[ATA] %d:%d sense key %#X, ASC %#X, retrying\n", bus, drive, sense[2] & 0x0F, sense[12]);
+    }
+
+    return atapiSendPacket(bus, drive, packet, buffer, length);
+}
+
+
+/** Number of 2048-byte sectors on the disc, 0 if there is no disc */
+static uint32_t atapiReadCapacity(uint8_t bus, uint8_t drive) {
+    uint8_t packet[ATAPI_PACKET_SIZE] = { ATAPI_CMD_READ_CAPACITY };
+    uint8_t capacity[8];
+
+    if (!atapiCommand(bus, drive, packet, capacity, sizeof(capacity))) {
+        return 0;
+    }
+
+    // Big endian, the last LBA and the block size
+    uint32_t last = ((uint32_t) capacity[0] << 24) | (capacity[1] << 16) | (capacity[2] << 8) | capacity[3];
+    uint32_t size = ((uint32_t) capacity[4] << 24) | (capacity[5] << 16) | (capacity[6] << 8) | capacity[7];
+
+    if (size != ATAPI_SECTOR_SIZE) {
+        fprintf(serial, "FAIL: ATAPI drive %d:%d has %d byte sectors\n", bus, drive, size);
+        return 0;
+    }
+
+    return last + 1;
+}
+
+
+void initializeATA(void) {
+    uint16_t identify[256];
+
+    registerInterruptHandler(IRQ14, ataCallback);
+    registerInterruptHandler(IRQ15, ataCallback);
+
+    // Clear nIEN, so the drives raise their interrupts
+    writeByteToPort(ATA_PRIMARY_CONTROL, 0x00);
+    writeByteToPort(ATA_SECUNDARY_CONTROL, 0x00);
+
+    // The bus-master registers of an IDE controller live in BAR4 (8 ports per bus)
+    const pci_device_t *controller = pciFindClass(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE);
+    if (controller && controller->bar_io[4] && controller->bar[4]) {
+        // Page aligned, so the tables can't cross a 64 KB boundary
+        ata_prd_t *tables = (ata_prd_t *) memoryAllocatePages(1);
+
+        if (tables) {
+            pciEnableCommand(controller, PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+
+            for (uint8_t bus = ATA_PRIMARY; bus <= ATA_SECONDARY; bus++) {
+                ata_bm_base[bus] = (uint16_t) (controller->bar[4] + (bus * 8));
+                ata_prd[bus] = tables + (bus * ATA_PRD_ENTRIES);
+            }
+
+            fprintf(serial, "[ATA] Bus-master IDE at %#X\n", controller->bar[4]);
+        }
     }
 
-    uint16_t io = (bus == ATA_PRIMARY) ? ATA_PRIMARY_IO : ATA_SECUNDARY_IO;
-    writeByteToPort(io + ATA_REG_HDDEVSEL, 0xE0 | (drive << 4) | ((lba >> 24) & 0x0F));
+    for (uint8_t bus = ATA_PRIMARY; bus <= ATA_SECONDARY; bus++) {
+        for (uint8_t drive = ATA_MASTER; drive <= ATA_SLAVE; drive++) {
+            ata_device_t *device = &ata_devices[bus][drive];
+            device->present = false;
 
-    writeByteToPort(io + 1, 0x00);
-    writeByteToPort(io + ATA_REG_SEC_CNT, 1); // 1 sector
-    writeByteToPort(io + ATA_REG_LBA_LOW, (uint8_t)(lba));       // Sector number or LBA Low, most likely LBA Low
-    writeByteToPort(io + ATA_REG_LBA_MID, (uint8_t)(lba >> 8));  // Cyl Low number or LBA Mid
-    writeByteToPort(io + ATA_REG_LBA_UPR, (uint8_t)(lba >> 16)); // Cyl High number or LBA High
+            if (!ataDeviceDetect(bus, drive)) {
+                continue;
+            }
+
+            if (ataDeviceIdentify(bus, drive, identify)) {
+                device->atapi = false;
+            } else if (atapiDeviceIdentify(bus, drive, identify)) {
+                device->atapi = true;
+            } else {
+                continue;
+            }
+
+            device->present = true;
+
+            // The model string is stored with the bytes of each word swapped
+            for (uint8_t i = 0; i < 20; i++) {
+                device->model[i * 2] = (char) (identify[27 + i] >> 8);
+                device->model[i * 2 + 1] = (char) (identify[27 + i] & 0xFF);
+            }
+            device->model[40] = '\0';
+            for (int8_t i = 39; (i >= 0) && (device->model[i] == ' '); i--) {
+                device->model[i] = '\0';
+            }
+
+            if (device->atapi) {
+                device->lba48 = false;
+                device->dma = false;
+                device->multiple = 0;
+                device->sectors = atapiReadCapacity(bus, drive);
+
+                fprintf(serial, "[ATA] %d:%d %s, ATAPI, %d sectors of %d bytes\n",
+                    bus, drive, device->model, (uint32_t) device->sectors, ATAPI_SECTOR_SIZE
+                );
+                continue;
+            }
+
+            device->lba48 = (identify[83] & (1 << 10)) != 0;
+            device->dma = ((identify[49] & (1 << 8)) != 0) && (ata_bm_base[bus] != 0);
+
+            if (device->lba48) {
+                device->sectors = ((uint64_t) identify[103] << 48) | ((uint64_t) identify[102] << 32)
+                                | ((uint64_t) identify[101] << 16) | identify[100];
+            } else {
+                device->sectors = ((uint32_t) identify[61] << 16) | identify[60];
+            }
+
+            // Enable the largest DRQ block the drive can do
+            device->multiple = 0;
+            uint8_t multiple = identify[47] & 0xFF;
+
+            if (multiple) {
+                uint16_t io = ataGetBase(bus);
+
+                ataSelectDrive(bus, 0xA0 | (drive << 4));
+                writeByteToPort(io + ATA_REG_SEC_CNT, multiple);
+
+                ataArmInterrupt(bus);
+                writeByteToPort(io + ATA_REG_COMMAND, ATA_CMD_SET_MULTIPLE);
+
+                if (ataCheckStatus(io, ataWaitInterrupt(bus))) {
+                    device->multiple = multiple;
+                }
+            }
+
+            fprintf(serial, "[ATA] %d:%d %s, %d sectors%s%s, %d sectors per block\n",
+                bus, drive, device->model, (uint32_t) device->sectors,
+                device->lba48 ? " (LBA48)" : "", device->dma ? " (DMA)" : "", device->multiple
+            );
+        }
+    }
+}
+
+
+const ata_device_t *ataGetDevice(uint8_t bus, uint8_t drive) {
+    if ((bus > ATA_SECONDARY) || (drive > ATA_SLAVE) || !ata_devices[bus][drive].present) {
+        return NULL;
+    }
+    return &ata_devices[bus][drive];
+}
+
+
+/** Program the task file for a transfer of 'count' (1 to 256) sectors */
+static void ataSetupTransfer(uint8_t bus, uint8_t drive, uint64_t lba, uint16_t count, bool lba48) {
+    uint16_t io = ataGetBase(bus);
+
+    if (lba48) {
+        ataSelectDrive(bus, 0x40 | (drive << 4));
+
+        // The "previous" content of each register holds the high bytes
+        writeByteToPort(io + ATA_REG_SEC_CNT, (uint8_t) (count >> 8));
+        writeByteToPort(io + ATA_REG_LBA_LOW, (uint8_t) (lba >> 24));
+        writeByteToPort(io + ATA_REG_LBA_MID, (uint8_t) (lba >> 32));
+        writeByteToPort(io + ATA_REG_LBA_UPR, (uint8_t) (lba >> 40));
+    } else {
+        ataSelectDrive(bus, 0xE0 | (drive << 4) | ((lba >> 24) & 0x0F));
+    }
+
+    writeByteToPort(io + ATA_REG_FEATURES, 0x00);
+    writeByteToPort(io + ATA_REG_SEC_CNT, (uint8_t) count);      // 256 wraps to 0, which means 256
+    writeByteToPort(io + ATA_REG_LBA_LOW, (uint8_t) (lba));       // Sector number or LBA Low, most likely LBA Low
+    writeByteToPort(io + ATA_REG_LBA_MID, (uint8_t) (lba >> 8));  // Cyl Low number or LBA Mid
+    writeByteToPort(io + ATA_REG_LBA_UPR, (uint8_t) (lba >> 16)); // Cyl High number or LBA High
+}
+
+
+/** Check the request against the drive, and tell if it needs the EXT commands */
+static const ata_device_t *ataCheckRequest(uint8_t bus, uint8_t drive, uint64_t lba, uint32_t count, bool *lba48) {
+    const ata_device_t *device = ataGetDevice(bus, drive);
+
+    if (!device) {
+        fprintf(serial, "FAIL: There is no ATA drive at %d:%d\n", bus, drive);
+        return NULL;
+    }
+
+    if (device->atapi) {
+        fprintf(serial, "FAIL: ATA drive %d:%d is a packet device\n", bus, drive);
+        return NULL;
+    }
+
+    if ((lba >= device->sectors) || (count > (device->sectors - lba))) {
+        fprintf(serial, "FAIL: ATA request past the end of the drive (LBA %d, %d sectors)\n", (uint32_t) lba, count);
+        return NULL;
+    }
+
+    *lba48 = (lba + count) > ATA_LBA28_LIMIT;
+    if (*lba48 && !device->lba48) {
+        fprintf(serial, "FAIL: ATA drive %d:%d has no LBA48 support\n", bus, drive);
+        return NULL;
+    }
+
+    return device;
+}
+
+
+/** Walks the sectors of a segment vector */
+typedef struct {
+    const ata_segment_t *segment;
+    uint32_t offset;    // Sectors already consumed from the current segment
+} ata_cursor_t;
+
+
+/** Get the next 'count' sectors that are contiguous in memory (at most 'count') */
+static uint8_t *ataCursorTake(ata_cursor_t *cursor, uint32_t *count) {
+    while (cursor->offset >= cursor->segment->sectors) {
+        cursor->segment++;
+        cursor->offset = 0;
+    }
+
+    uint8_t *pointer = cursor->segment->buffer + (cursor->offset * ATA_SECTOR_SIZE);
+
+    *count = MIN(*count, cursor->segment->sectors - cursor->offset);
+    cursor->offset += *count;
+
+    return pointer;
+}
+
+
+/** Fill the PRD table of a bus, splitting the regions at the 64 KB boundaries */
+static bool ataBuildTable(uint8_t bus, ata_cursor_t *cursor, uint32_t sectors) {
+    ata_prd_t *table = ata_prd[bus];
+    uint16_t entry = 0;
+
+    while (sectors) {
+        uint32_t count = sectors;
+        uint32_t address = (uint32_t) ataCursorTake(cursor, &count); // Identity mapped, virtual is physical
+        uint32_t bytes = count * ATA_SECTOR_SIZE;
+
+        sectors -= count;
+
+        while (bytes) {
+            if (entry >= ATA_PRD_ENTRIES) {
+                return false;
+            }
+
+            uint32_t length = MIN(ATA_PRD_BOUNDARY - (address & (ATA_PRD_BOUNDARY - 1)), bytes);
+
+            table[entry].address = address;
+            table[entry].count = (uint16_t) length; // 64 KB wraps to 0, which is what the controller wants
+            table[entry].flags = 0;
+
+            address += length;
+            bytes -= length;
+            entry++;
+        }
+    }
+
+    table[entry - 1].flags = ATA_PRD_EOT;
+    return true;
+}
+
+
+/** Can this transfer go through DMA? (the controller needs word aligned regions) */
+static bool ataCanUseDMA(const ata_device_t *device, const ata_segment_t *segments, uint8_t count) {
+    if (!ata_dma_enabled || !device->dma) {
+        return false;
+    }
+
+    for (uint8_t i = 0; i < count; i++) {
+        if ((uint32_t) segments[i].buffer & 0x03) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/** Run a single DMA command of up to ATA_MAX_SECTORS sectors */
+static bool ataTransferDMA(uint8_t bus, uint8_t drive, uint64_t lba, uint16_t sectors, ata_cursor_t *cursor, bool write, bool lba48) {
+    uint16_t io = ataGetBase(bus);
+    uint16_t bm = ata_bm_base[bus];
+
+    if (!ataBuildTable(bus, cursor, sectors)) {
+        fprintf(serial, "FAIL: ATA transfer too fragmented for the PRD table\n");
+        return false;
+    }
+
+    uint8_t direction = write ? 0 : ATA_BM_READ;
+    uint8_t command;
+
+    if (write) {
+        command = lba48 ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_WRITE_DMA;
+    } else {
+        command = lba48 ? ATA_CMD_READ_DMA_EXT : ATA_CMD_READ_DMA;
+    }
+
+    // Stop the engine, point it to the table and clear the old error and interrupt bits
+    writeByteToPort(bm + ATA_BM_COMMAND, 0);
+    writeLongToPort(bm + ATA_BM_PRDT, (uint32_t) ata_prd[bus]);
+    writeByteToPort(bm + ATA_BM_STATUS, readByteFromPort(bm + ATA_BM_STATUS) | ATA_BM_ERROR | ATA_BM_IRQ);
+    writeByteToPort(bm + ATA_BM_COMMAND, direction);
+
+    ataWaitReady(io);
+    ataSetupTransfer(bus, drive, lba, sectors, lba48);
+
+    ataArmInterrupt(bus);
+    writeByteToPort(io + ATA_REG_COMMAND, command);
+    writeByteToPort(bm + ATA_BM_COMMAND, direction | ATA_BM_START);
+
+    uint8_t status = ataWaitInterrupt(bus);
+
+    writeByteToPort(bm + ATA_BM_COMMAND, 0);
+    uint8_t bm_status = readByteFromPort(bm + ATA_BM_STATUS);
+    writeByteToPort(bm + ATA_BM_STATUS, bm_status | ATA_BM_ERROR | ATA_BM_IRQ);
+
+    if (!ataCheckStatus(io, status)) {
+        return false;
+    }
+
+    if (bm_status & ATA_BM_ERROR) {
+        fprintf(serial, "FAIL: ATA DMA transfer error (bus-master status %#X)\n", bm_status);
+        return false;
+    }
+
+    return true;
+}
+
+
+/** Move 'sectors' sectors of a DRQ block between the data register and the segments */
+static void ataTransferBlock(uint16_t io, ata_cursor_t *cursor, uint32_t sectors, bool write) {
+    while (sectors) {
+        uint32_t count = sectors;
+        uint8_t *buffer = ataCursorTake(cursor, &count);
+
+        // The data register is little endian like us, so it goes straight to the buffer
+        if (write) {
+            writeWordsToPort(io, buffer, count * (ATA_SECTOR_SIZE / 2));
+        } else {
+            readWordsFromPort(io, buffer, count * (ATA_SECTOR_SIZE / 2));
+        }
+
+        sectors -= count;
+    }
+}
+
+
+/** Run a single PIO read command of up to ATA_MAX_SECTORS sectors */
+static bool ataReadPIO(uint8_t bus, uint8_t drive, const ata_device_t *device, uint64_t lba, uint16_t sectors, ata_cursor_t *cursor, bool lba48) {
+    uint16_t io = ataGetBase(bus);
+    uint8_t command;
+
+    if (device->multiple) {
+        command = lba48 ? ATA_CMD_READ_MULTIPLE_EXT : ATA_CMD_READ_MULTIPLE;
+    } else {
+        command = lba48 ? ATA_CMD_READ_PIO_EXT : ATA_CMD_READ_PIO;
+    }
+
+    ataWaitReady(io);
+    ataSetupTransfer(bus, drive, lba, sectors, lba48);
 
     // We tell to the device to read
-    writeByteToPort(io + ATA_REG_COMMAND, ATA_CMD_READ_PIO);
+    ataArmInterrupt(bus);
+    writeByteToPort(io + ATA_REG_COMMAND, command);
+
+    // One interrupt per block, once its data is ready (the last one can be shorter)
+    uint16_t block = device->multiple ? device->multiple : 1;
+    for (uint16_t done = 0; done < sectors; done += block) {
+        uint8_t status = ataWaitInterrupt(bus);
+        if (!ataCheckStatus(io, status)) {
+            return false;
+        }
 
-    while (!(readByteFromPort(io + ATA_REG_STATUS) & 0x08)) NOTHING
+        if (!(status & ATA_SR_DRQ)) {
+            fprintf(serial, "FAIL: ATA read interrupt without data\n");
+            return false;
+        }
 
-    for (uint16_t i = 0; i < 256; i++) {
-        uint16_t data = readWordFromPort(io);
-        buffer[i * 2] = data & 0xFF;
-        buffer[i * 2 + 1] = (data >> 8) & 0xFF;
+        ataTransferBlock(io, cursor, MIN(block, (uint16_t) (sectors - done)), false);
     }
+
+    return true;
 }
 
 
-void ataSectorWrite(uint8_t bus, uint8_t drive, uint32_t lba, uint8_t *buffer) {
-    if (!buffer) {
-        return;
+/** Run a single PIO write command of up to ATA_MAX_SECTORS sectors */
+static bool ataWritePIO(uint8_t bus, uint8_t drive, const ata_device_t *device, uint64_t lba, uint16_t sectors, ata_cursor_t *cursor, bool lba48) {
+    uint16_t io = ataGetBase(bus);
+    uint8_t command;
+
+    if (device->multiple) {
+        command = lba48 ? ATA_CMD_WRITE_MULTIPLE_EXT : ATA_CMD_WRITE_MULTIPLE;
+    } else {
+        command = lba48 ? ATA_CMD_WRITE_PIO_EXT : ATA_CMD_WRITE_PIO;
     }
 
-    if (lba < 0x20 || lba >= 0x1000) {
+    ataWaitReady(io);
+    ataSetupTransfer(bus, drive, lba, sectors, lba48);
+
+    // We tell to the device to write
+    ataArmInterrupt(bus);
+    writeByteToPort(io + ATA_REG_COMMAND, command);
+
+    // There is no interrupt for the first block, the drive just asks for it
+    if (!ataWaitData(io)) {
+        return false;
+    }
+
+    // After each block, the interrupt asks for the next one or tells we are done
+    uint16_t block = device->multiple ? device->multiple : 1;
+    for (uint16_t done = 0; done < sectors; done += block) {
+        ataTransferBlock(io, cursor, MIN(block, (uint16_t) (sectors - done)), true);
+
+        if (!ataCheckStatus(io, ataWaitInterrupt(bus))) {
+            fprintf(serial, "FAIL: ATA write failed at LBA %d\n", (uint32_t) (lba + done));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/** Account a finished transfer in the statistics of its mode */
+static void ataUpdateStats(uint8_t mode, uint32_t sectors, uint64_t start, uint64_t idle) {
+    ata_stats[mode].sectors += sectors;
+    ata_stats[mode].cycles += processorGetCycles() - start;
+    ata_stats[mode].idle += ata_idle_cycles - idle;
+}
+
+
+bool ataTransferVector(uint8_t bus, uint8_t drive, uint64_t lba, const ata_segment_t *segments, uint8_t count, bool write) {
+    bool lba48;
+
+    if (!segments || !count) {
+        return false;
+    }
+
+    uint32_t total = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        if (!segments[i].buffer) {
+            return false;
+        }
+        total += segments[i].sectors;
+    }
+
+    if (!total) {
+        return false;
+    }
+
+    // The first sectors hold the boot code and the partition tables
+    if (write && (lba < ATA_RESERVED_SECTORS) && !ata_raw_writes) {
         fprintf(serial, "FAIL: Attempting to write to a reserved/system sector.\n");
-        return;
+        return false;
     }
 
-    uint16_t io = (bus == ATA_PRIMARY) ? ATA_PRIMARY_IO : ATA_SECUNDARY_IO;
-    writeByteToPort(io + ATA_REG_HDDEVSEL, 0xE0 | (drive << 4) | ((lba >> 24) & 0x0F));
+    const ata_device_t *device = ataCheckRequest(bus, drive, lba, total, &lba48);
+    if (!device) {
+        return false;
+    }
 
-    writeByteToPort(io + 1, 0x00);
-    writeByteToPort(io + ATA_REG_SEC_CNT, 1);
-    writeByteToPort(io + ATA_REG_LBA_LOW, (uint8_t)(lba));
-    writeByteToPort(io + ATA_REG_LBA_MID, (uint8_t)(lba >> 8));
-    writeByteToPort(io + ATA_REG_LBA_UPR, (uint8_t)(lba >> 16));
+    bool dma = ataCanUseDMA(device, segments, count);
+    uint64_t start = processorGetCycles();
+    uint64_t idle = ata_idle_cycles;
 
-    // We tell to the device to write
-    writeByteToPort(io + ATA_REG_COMMAND, ATA_CMD_WRITE_PIO);
+    ata_cursor_t cursor = { segments, 0 };
+    uint32_t remaining = total;
 
-    uint32_t timeout = 10000;
-    while (!(readByteFromPort(io + ATA_REG_STATUS) & 0x08)) {
-        if (--timeout == 0) {
-            fprintf(serial, "DEBUG: ATA write timeout!\n");
-            return;
+    while (remaining) {
+        uint16_t sectors = (uint16_t) MIN(remaining, (uint32_t) ATA_MAX_SECTORS);
+        bool result;
+
+        if (dma) {
+            result = ataTransferDMA(bus, drive, lba, sectors, &cursor, write, lba48);
+        } else if (write) {
+            result = ataWritePIO(bus, drive, device, lba, sectors, &cursor, lba48);
+        } else {
+            result = ataReadPIO(bus, drive, device, lba, sectors, &cursor, lba48);
         }
+
+        if (!result) {
+            return false;
+        }
+
+        lba += sectors;
+        remaining -= sectors;
+    }
+
+    ataUpdateStats(dma ? ATA_MODE_DMA : ATA_MODE_PIO, total, start, idle);
+    return true;
+}
+
+
+bool ataFlush(uint8_t bus, uint8_t drive) {
+    const ata_device_t *device = ataGetDevice(bus, drive);
+
+    if (!device || device->atapi) {
+        return false;
+    }
+
+    uint16_t io = ataGetBase(bus);
+
+    ataSelectDrive(bus, 0xA0 | (drive << 4));
+    ataArmInterrupt(bus);
+    writeByteToPort(io + ATA_REG_COMMAND, device->lba48 ? ATA_CMD_CACHE_FLUSH_EXT : ATA_CMD_CACHE_FLUSH);
+
+    return ataCheckStatus(io, ataWaitInterrupt(bus));
+}
+
+
+bool ataRead(uint8_t bus, uint8_t drive, uint64_t lba, uint32_t count, uint8_t *buffer) {
+    ata_segment_t segment = { buffer, count };
+    return ataTransferVector(bus, drive, lba, &segment, 1, false);
+}
+
+
+bool ataWrite(uint8_t bus, uint8_t drive, uint64_t lba, uint32_t count, const uint8_t *buffer) {
+    // The drive only reads from the buffer on writes, so the cast is fine
+    ata_segment_t segment = { (uint8_t *) buffer, count };
+    return ataTransferVector(bus, drive, lba, &segment, 1, true);
+}
+
+
+bool atapiRead(uint8_t bus, uint8_t drive, uint32_t lba, uint32_t count, uint8_t *buffer) {
+    const ata_device_t *device = ataGetDevice(bus, drive);
+
+    if (!device || !device->atapi) {
+        fprintf(serial, "FAIL: There is no ATAPI drive at %d:%d\n", bus, drive);
+        return false;
     }
 
-    uint8_t status = readByteFromPort(io + ATA_REG_STATUS);
-    if (status & 0x01) {
-        fprintf(serial, "FAIL: ATA write failed (status error)\n");
-        return;
+    if (!buffer || !count) {
+        return false;
     }
 
-    for (uint16_t i = 0; i < 256; i++) {
-        uint16_t data = (buffer[i * 2 + 1] << 8) | buffer[i * 2];
-        writeWordToPort(io, data);
+    // The disc may have been inserted after boot
+    if (!device->sectors) {
+        ata_devices[bus][drive].sectors = atapiReadCapacity(bus, drive);
     }
 
-    timeout = 10000;
-    while (readByteFromPort(io + ATA_REG_STATUS) & 0x80) {
-        if (--timeout == 0) {
-            status = readByteFromPort(io + ATA_REG_STATUS);
+    if ((lba >= device->sectors) || (count > (device->sectors - lba))) {
+        fprintf(serial, "FAIL: ATAPI request past the end of the disc (LBA %d, %d sectors)\n", lba, count);
+        return false;
+    }
 
-            if (status & 0x01) {
-                fprintf(serial, "FAIL: ATA write failed (status error)\n");
-            } else if (status & 0x02) {
-                fprintf(serial, "FAIL: ATA write failed (drive is busy)\n");
-            } else if (status & 0x20) {
-                fprintf(serial, "FAIL: ATA write failed (write fault)\n");
-            } else if (status & 0x40) {
-                fprintf(serial, "FAIL: ATA write failed (seek error)\n");
-            } else {
-                fprintf(serial, "FAIL: ATA write timeout after writing data\n");
+    uint8_t packet[ATAPI_PACKET_SIZE] = { 0 };
+
+    packet[2] = (uint8_t) (lba >> 24);
+    packet[3] = (uint8_t) (lba >> 16);
+    packet[4] = (uint8_t) (lba >> 8);
+    packet[5] = (uint8_t) (lba);
+
+    // Older drives only know READ(10), so READ(12) is only used when we need it
+    if (count <= 0xFFFF) {
+        packet[0] = ATAPI_CMD_READ_10;
+        packet[7] = (uint8_t) (count >> 8);
+        packet[8] = (uint8_t) (count);
+    } else {
+        packet[0] = ATAPI_CMD_READ_12;
+        packet[6] = (uint8_t) (count >> 24);
+        packet[7] = (uint8_t) (count >> 16);
+        packet[8] = (uint8_t) (count >> 8);
+        packet[9] = (uint8_t) (count);
+    }
+
+    uint64_t start = processorGetCycles();
+    uint64_t idle = ata_idle_cycles;
+
+    if (!atapiCommand(bus, drive, packet, buffer, count * ATAPI_SECTOR_SIZE)) {
+        fprintf(serial, "FAIL: ATAPI read failed at LBA %d\n", lba);
+        return false;
+    }
+
+    ataUpdateStats(ATA_MODE_PIO, count * (ATAPI_SECTOR_SIZE / ATA_SECTOR_SIZE), start, idle);
+    return true;
+}
+
+
+bool ataEnableDMA(bool enabled) {
+    bool previous = ata_dma_enabled;
+    ata_dma_enabled = enabled;
+    return previous;
+}
+
+
+bool ataEnableRawWrites(bool enabled) {
+    bool previous = ata_raw_writes;
+    ata_raw_writes = enabled;
+    return previous;
+}
+
+
+void ataGetStatus(void) {
+    static const char *modes[2] = { "PIO", "DMA" };
+    uint32_t frequency = processorGetFrequency();
+
+    printl(INFO, "ATA Status:\n");
+
+    for (uint8_t bus = ATA_PRIMARY; bus <= ATA_SECONDARY; bus++) {
+        for (uint8_t drive = ATA_MASTER; drive <= ATA_SLAVE; drive++) {
+            const ata_device_t *device = ataGetDevice(bus, drive);
+            if (!device) {
+                continue;
+            }
+
+            if (device->atapi) {
+                printf(" * %d:%d %s, ATAPI, %d MB\n", bus, drive, device->model, (uint32_t) (device->sectors >> 9));
+                continue;
             }
 
-            return;
+            printf(" * %d:%d %s, %d MB%s%s, %d sectors per block\n",
+                bus, drive, device->model, (uint32_t) (device->sectors >> 11),
+                device->lba48 ? ", LBA48" : "", device->dma ? ", DMA" : "", device->multiple
+            );
         }
     }
 
-    status = readByteFromPort(io + ATA_REG_STATUS);
-    if (status & 0x01) {
-        fprintf(serial, "FAIL: ATA write failed (post-write error)\n");
+    printf("\n");
+
+    for (uint8_t mode = ATA_MODE_PIO; mode <= ATA_MODE_DMA; mode++) {
+        if (!ata_stats[mode].cycles) {
+            printf(" * %s: no transfers yet\n", modes[mode]);
+            continue;
+        }
+
+        double cycles = (double) (int64_t) ata_stats[mode].cycles;
+        double busy = (double) (int64_t) (ata_stats[mode].cycles - ata_stats[mode].idle);
+
+        // KB/s = (sectors / 2) / (cycles / (kHz * 1000))
+        double speed = ((double) ata_stats[mode].sectors / 2.0) * frequency * 1000.0 / cycles;
+
+        printf(" * %s: %d sectors, %d KB/s, CPU busy %d%%\n",
+            modes[mode], ata_stats[mode].sectors, (uint32_t) speed, (uint32_t) ((busy * 100.0) / cycles)
+        );
     }
+
+    printf(" * DMA is %s\n\n", ata_dma_enabled ? "enabled" : "disabled");
+}
+
+
+void ataSectorRead(uint8_t bus, uint8_t drive, uint32_t lba, uint8_t *buffer) {
+    ataRead(bus, drive, lba, 1, buffer);
+}
+
+
+void ataSectorWrite(uint8_t bus, uint8_t drive, uint32_t lba, uint8_t *buffer) {
+    ataWrite(bus, drive, lba, 1, buffer);
 }
@@ -12,6 +12,8 @@
 #define ATA_PRIMARY_IO    0x1F0
 #define ATA_SECUNDARY_IO  0x170
 
+#define ATA_REG_ERROR     0x01
+#define ATA_REG_FEATURES  0x01
 #define ATA_REG_SEC_CNT   0x02
 #define ATA_REG_LBA_LOW   0x03
 #define ATA_REG_LBA_MID   0x04
@@ -29,13 +31,178 @@
 #define ATA_CMD_CACHE_FLUSH       0xE7
 #define ATA_CMD_CACHE_FLUSH_EXT   0xEA
 #define ATA_CMD_PACKET            0xA0
+#define ATA_CMD_READ_MULTIPLE     0xC4
+#define ATA_CMD_READ_MULTIPLE_EXT 0x29
+#define ATA_CMD_WRITE_MULTIPLE    0xC5
+#define ATA_CMD_WRITE_MULTIPLE_EXT 0x39
+#define ATA_CMD_SET_MULTIPLE      0xC6
 
 #define ATA_REG_STATUS    0x07
 #define ATA_REG_COMMAND   0x07
 #define ATA_CMD_IDENTIFY  0xEC
+#define ATA_CMD_IDENTIFY_PACKET   0xA1
+
+/* SCSI commands sent inside an ATAPI packet */
+#define ATAPI_CMD_REQUEST_SENSE   0x03
+#define ATAPI_CMD_READ_CAPACITY   0x25
+#define ATAPI_CMD_READ_10         0x28
+#define ATAPI_CMD_READ_12         0xA8
+
+/** Signature left in LBA_MID/LBA_UPR by a packet device that aborted IDENTIFY */
+#define ATAPI_SIGNATURE_MID       0x14
+#define ATAPI_SIGNATURE_UPR       0xEB
+
+#define ATAPI_PACKET_SIZE 12
+#define ATAPI_SECTOR_SIZE 2048
+
+#define ATA_SR_ERR        0x01 // Error
+#define ATA_SR_DRQ        0x08 // Data request ready
+#define ATA_SR_DF         0x20 // Drive write fault
+#define ATA_SR_DRDY       0x40 // Drive ready
+#define ATA_SR_BSY        0x80 // Busy
+
+#define ATA_SECTOR_SIZE   512
+
+/** Most sectors moved by a single command (a SEC_CNT of 0 means 256 on 28-bit commands) */
+#define ATA_MAX_SECTORS   256
+
+/** Writes below this sector are refused, it holds the boot code and the partition tables */
+#define ATA_RESERVED_SECTORS 0x20
+
+/** Highest sector reachable with 28-bit commands */
+#define ATA_LBA28_LIMIT   0x10000000
+
+/* Bus-master IDE registers, relative to the channel base (BAR4, +8 for the secondary) */
+#define ATA_BM_COMMAND    0x00
+#define ATA_BM_STATUS     0x02
+#define ATA_BM_PRDT       0x04
+
+#define ATA_BM_START      0x01 // Start the transfer
+#define ATA_BM_READ       0x08 // Direction, the controller writes to memory
+#define ATA_BM_ERROR      0x02 // Transfer error (write 1 to clear)
+#define ATA_BM_IRQ        0x04 // Interrupt raised (write 1 to clear)
+
+#define ATA_PRD_EOT       0x8000  // Last entry of the table
+#define ATA_PRD_BOUNDARY  0x10000 // A region can't cross a 64 KB boundary
+
+typedef struct {
+    bool present;
+    bool atapi;         // Packet device (CD-ROM), sectors are ATAPI_SECTOR_SIZE bytes
+    bool lba48;         // Supports the 48-bit EXT commands
+    bool dma;           // Supports DMA and sits behind a bus-master controller
+    uint8_t multiple;   // Sectors per DRQ block for READ/WRITE MULTIPLE, 0 if unsupported
+    uint64_t sectors;   // Addressable sectors, 0 for an ATAPI drive without a disc
+    char model[41];
+} ata_device_t;
+
+/** A piece of memory taking part in a transfer, a whole number of sectors */
+typedef struct {
+    uint8_t *buffer;
+    uint32_t sectors;
+} ata_segment_t;
+
+/**
+ * Detect and identify the drives on both ATA buses, and enable the
+ * multiple sector mode on the ones that support it.
+ */
+void initializeATA(void);
+
+/**
+ * Get the information of a drive found by initializeATA().
+ *
+ * @return The device, or NULL if there is no ATA drive there
+ */
+const ata_device_t *ataGetDevice(uint8_t bus, uint8_t drive);
+
+/**
+ * Allow or forbid the DMA path (it's used by default when available).
+ *
+ * @param enabled   False to force PIO transfers, for comparisons
+ * @return          The previous setting, to restore it later
+ */
+bool ataEnableDMA(bool enabled);
+
+/**
+ * Allow or forbid writes below ATA_RESERVED_SECTORS (forbidden by default), for the
+ * rare tools that really have to rewrite the boot code or the partition tables.
+ *
+ * @param enabled   True to let the writes through
+ * @return          The previous setting, to restore it later
+ */
+bool ataEnableRawWrites(bool enabled);
+
+/**
+ * Print the found drives, and the throughput and CPU usage of PIO and DMA transfers.
+ */
+void ataGetStatus(void);
 
 bool ataDeviceDetect(uint8_t bus, uint8_t drive);
 bool ataDeviceIdentify(uint8_t bus, uint8_t drive, uint16_t *buffer);
+bool atapiDeviceIdentify(uint8_t bus, uint8_t drive, uint16_t *buffer);
+
+/**
+ * Read consecutive sectors from a drive, large requests are split in
+ * commands of up to ATA_MAX_SECTORS sectors.
+ *
+ * @param bus       ATA_PRIMARY or ATA_SECONDARY
+ * @param drive     ATA_MASTER or ATA_SLAVE
+ * @param lba       First sector to read
+ * @param count     Number of sectors to read
+ * @param buffer    Destination, at least count * ATA_SECTOR_SIZE bytes
+ * @return          True if all the sectors were read
+ */
+bool ataRead(uint8_t bus, uint8_t drive, uint64_t lba, uint32_t count, uint8_t *buffer);
+
+/**
+ * Write consecutive sectors to a drive, large requests are split in
+ * commands of up to ATA_MAX_SECTORS sectors.
+ *
+ * @param bus       ATA_PRIMARY or ATA_SECONDARY
+ * @param drive     ATA_MASTER or ATA_SLAVE
+ * @param lba       First sector to write
+ * @param count     Number of sectors to write
+ * @param buffer    Source, at least count * ATA_SECTOR_SIZE bytes
+ * @return          True if all the sectors were written
+ */
+bool ataWrite(uint8_t bus, uint8_t drive, uint64_t lba, uint32_t count, const uint8_t *buffer);
+
+/**
+ * Transfer consecutive sectors from/to a list of memory segments, so requests for
+ * adjacent sectors with different buffers still go out as a single command.
+ *
+ * @param bus       ATA_PRIMARY or ATA_SECONDARY
+ * @param drive     ATA_MASTER or ATA_SLAVE
+ * @param lba       First sector of the transfer
+ * @param segments  Memory segments, in disk order
+ * @param count     Number of segments
+ * @param write     True to write the segments to the disk
+ * @return          True if all the sectors were transferred
+ */
+bool ataTransferVector(uint8_t bus, uint8_t drive, uint64_t lba, const ata_segment_t *segments, uint8_t count, bool write);
+
+/**
+ * Make the drive write its cache to the media (FLUSH CACHE), the writes alone can
+ * stay in there. Called when the data must survive a power off.
+ *
+ * @param bus       ATA_PRIMARY or ATA_SECONDARY
+ * @param drive     ATA_MASTER or ATA_SLAVE
+ * @return          True if the drive finished the flush without errors
+ */
+bool ataFlush(uint8_t bus, uint8_t drive);
+
+/**
+ * Read consecutive 2048-byte sectors from an ATAPI drive (the CD-ROM), with a
+ * single READ(10) packet, or READ(12) when the count doesn't fit in 16 bits.
+ *
+ * @param bus       ATA_PRIMARY or ATA_SECONDARY
+ * @param drive     ATA_MASTER or ATA_SLAVE
+ * @param lba       First sector to read
+ * @param count     Number of sectors to read
+ * @param buffer    Destination, at least count * ATAPI_SECTOR_SIZE bytes
+ * @return          True if all the sectors were read
+ */
+bool atapiRead(uint8_t bus, uint8_t drive, uint32_t lba, uint32_t count, uint8_t *buffer);
+
 void ataSectorRead(uint8_t bus, uint8_t drive, uint32_t lba, uint8_t *buffer);
 void ataSectorWrite(uint8_t bus, uint8_t drive, uint32_t lba, uint8_t *buffer);
 
@@ -0,0 +1,634 @@
+#include "cache.h"
+#include "queue.h"
+#include "partition.h"
+
+#include "../ATA/ata.h"
+
+#include "../../memory/heap.h"
+#include "../../memory/memory.h"
+#include "../../modules/terminal.h"
+
+/*
+ * Block buffer cache.
+ *
+ * Sits between the filesystems and the disk drivers: every block lives in a buffer indexed
+ * by a (device, lba) hash table and linked in a LRU list. Writes only touch the buffers and
+ * mark them dirty, the disk gets them when the buffer is evicted or on blkFlush(), grouped
+ * in runs of consecutive blocks so they go out with a single command (blkFlush() leaves
+ * that to the request queue, which also sorts them).
+ *
+ * Streams get readahead: while the reads keep being sequential, the next blocks are queued
+ * as plugged requests, and go out with the read itself (a miss joins them in the queue) as
+ * a few large commands. The dispatch is synchronous, so this doesn't overlap anything with
+ * the caller, it only turns many small reads into a few large sequential ones.
+ */
+
+static blk_buffer_t blk_buffers[BLK_CACHE_BLOCKS];
+static blk_buffer_t *blk_hash[BLK_HASH_SIZE];
+
+/* LRU list, the head is the most recently used buffer */
+static blk_buffer_t *lru_head = NULL;
+static blk_buffer_t *lru_tail = NULL;
+
+/* Gathers dirty runs for the write back */
+static uint8_t *blk_bounce = NULL;
+
+/* One flush or readahead request per buffer, same index */
+static blk_request_t blk_requests[BLK_CACHE_BLOCKS];
+static uint32_t flush_failures = 0;
+
+static struct {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+    uint32_t writebacks;    // Blocks written back to the disk
+    uint32_t lost;          // Dirty blocks evicted after their write back failed
+    uint32_t commands;      // Disk commands issued
+    uint32_t prefetched;    // Blocks queued by readahead
+    uint32_t useful;        // Prefetched blocks that were read later
+} blk_stats;
+
+
+static inline uint32_t blkHash(uint8_t device, uint64_t lba) {
+    // Consecutive blocks land in consecutive buckets
+    return ((uint32_t) lba + (device * 0x9E3779B1)) & (BLK_HASH_SIZE - 1);
+}
+
+
+static void blkUnlink(blk_buffer_t *buffer) {
+    if (buffer->lru_prev) {
+        buffer->lru_prev->lru_next = buffer->lru_next;
+    } else {
+        lru_head = buffer->lru_next;
+    }
+
+    if (buffer->lru_next) {
+        buffer->lru_next->lru_prev = buffer->lru_prev;
+    } else {
+        lru_tail = buffer->lru_prev;
+    }
+
+    buffer->lru_prev = NULL;
+    buffer->lru_next = NULL;
+}
+
+
+static void blkPushFront(blk_buffer_t *buffer) {
+    buffer->lru_prev = NULL;
+    buffer->lru_next = lru_head;
+
+    if (lru_head) {
+        lru_head->lru_prev = buffer;
+    }
+    lru_head = buffer;
+
+    if (!lru_tail) {
+        lru_tail = buffer;
+    }
+}
+
+
+static void blkPushBack(blk_buffer_t *buffer) {
+    buffer->lru_next = NULL;
+    buffer->lru_prev = lru_tail;
+
+    if (lru_tail) {
+        lru_tail->lru_next = buffer;
+    }
+    lru_tail = buffer;
+
+    if (!lru_head) {
+        lru_head = buffer;
+    }
+}
+
+
+/** Mark a buffer as the most recently used */
+static inline void blkTouch(blk_buffer_t *buffer) {
+    if (lru_head != buffer) {
+        blkUnlink(buffer);
+        blkPushFront(buffer);
+    }
+}
+
+
+static blk_buffer_t *blkLookup(uint8_t device, uint64_t lba) {
+    blk_buffer_t *buffer = blk_hash[blkHash(device, lba)];
+
+    while (buffer) {
+        if ((buffer->lba == lba) && (buffer->device == device)) {
+            return buffer;
+        }
+        buffer = buffer->hash_next;
+    }
+
+    return NULL;
+}
+
+
+/** Like blkLookup(), but waits for the queued readahead of the block (if any) */
+static blk_buffer_t *blkFind(uint8_t device, uint64_t lba) {
+    blk_buffer_t *buffer = blkLookup(device, lba);
+
+    if (buffer && (buffer->flags & BLK_LOADING)) {
+        blkUnplug(device);
+
+        // The readahead could have failed and dropped the buffer
+        buffer = blkLookup(device, lba);
+    }
+
+    if (buffer && (buffer->flags & BLK_PREFETCHED)) {
+        buffer->flags &= ~BLK_PREFETCHED;
+        blk_stats.useful++;
+    }
+
+    return buffer;
+}
+
+
+static void blkHashRemove(blk_buffer_t *buffer) {
+    blk_buffer_t **current = &blk_hash[blkHash(buffer->device, buffer->lba)];
+
+    while (*current) {
+        if (*current == buffer) {
+            *current = buffer->hash_next;
+            break;
+        }
+        current = &(*current)->hash_next;
+    }
+
+    buffer->hash_next = NULL;
+}
+
+
+static bool blkDiskRead(uint8_t device, uint64_t lba, uint32_t count, uint8_t *buffer) {
+    blk_stats.commands++;
+    return ataRead(device >> 1, device & 1, lba, count, buffer);
+}
+
+
+static bool blkDiskWrite(uint8_t device, uint64_t lba, uint32_t count, const uint8_t *buffer) {
+    blk_stats.commands++;
+    return ataWrite(device >> 1, device & 1, lba, count, buffer);
+}
+
+
+/** A read miss that went through the queue, 'context' is where the result goes */
+static void blkReadDone(blk_request_t *request, bool success) {
+    *(bool *) request->context = success;
+}
+
+
+/** Write a dirty buffer, together with the dirty blocks that follow it, they stay dirty on errors */
+static bool blkWriteBack(blk_buffer_t *buffer) {
+    blk_buffer_t *run[BLK_MAX_RUN];
+    uint32_t count = 0;
+
+    blk_buffer_t *current = buffer;
+    while (current && (current->flags & BLK_DIRTY) && (count < BLK_MAX_RUN)) {
+        memoryCopy(blk_bounce + (count * BLK_BLOCK_SIZE), current->data, BLK_BLOCK_SIZE);
+        run[count++] = current;
+        current = blkLookup(buffer->device, buffer->lba + count);
+    }
+
+    if (!blkDiskWrite(buffer->device, buffer->lba, count, blk_bounce)) {
+        fprintf(serial, "[BLK] Write back of %d blocks at LBA %d failed\n", count, (uint32_t) buffer->lba);
+        return false;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        run[i]->flags &= ~BLK_DIRTY;
+    }
+
+    blk_stats.writebacks += count;
+    return true;
+}
+
+
+/** Take the least recently used buffer that isn't pinned, writing it back if needed */
+static blk_buffer_t *blkEvict(void) {
+    blk_buffer_t *buffer = lru_tail;
+
+    while (buffer && buffer->users) {
+        buffer = buffer->lru_prev;
+    }
+
+    if (!buffer) {
+        return NULL; // Everything is pinned
+    }
+
+    // The buffer is needed, so a block that can't be written is dropped (the rest of the run stays dirty)
+    if ((buffer->flags & BLK_DIRTY) && !blkWriteBack(buffer)) {
+        fprintf(serial, "[BLK] Evicted LBA %d of device %d without writing it, data lost!\n", (uint32_t) buffer->lba, buffer->device);
+        blk_stats.lost++;
+    }
+
+    if (buffer->flags & BLK_VALID) {
+        blkHashRemove(buffer);
+        blk_stats.evictions++;
+    }
+
+    buffer->flags = 0;
+    return buffer;
+}
+
+
+/** Give a buffer to a block (not read yet), as the most recently used */
+static blk_buffer_t *blkAllocate(uint8_t device, uint64_t lba) {
+    blk_buffer_t *buffer = blkEvict();
+    if (!buffer) {
+        return NULL;
+    }
+
+    buffer->device = device;
+    buffer->lba = lba;
+    buffer->flags = 0;
+
+    uint32_t bucket = blkHash(device, lba);
+    buffer->hash_next = blk_hash[bucket];
+    blk_hash[bucket] = buffer;
+
+    blkTouch(buffer);
+    return buffer;
+}
+
+
+/** Return a buffer that couldn't be filled to the free end of the list */
+static void blkDiscard(blk_buffer_t *buffer) {
+    blkHashRemove(buffer);
+    buffer->flags = 0;
+
+    blkUnlink(buffer);
+    blkPushBack(buffer);
+}
+
+
+void initializeBlockCache(void) {
+    uint8_t *data = (uint8_t *) memoryAllocateBlock(BLK_CACHE_BLOCKS * BLK_BLOCK_SIZE);
+    blk_bounce = (uint8_t *) memoryAllocateBlock(BLK_MAX_RUN * BLK_BLOCK_SIZE);
+
+    if (!data || !blk_bounce) {
+        fprintf(serial, "[BLK] Unable to allocate the block cache!\n");
+        return;
+    }
+
+    for (uint32_t i = 0; i < BLK_HASH_SIZE; i++) {
+        blk_hash[i] = NULL;
+    }
+
+    lru_head = NULL;
+    lru_tail = NULL;
+
+    for (uint32_t i = 0; i < BLK_CACHE_BLOCKS; i++) {
+        blk_buffer_t *buffer = &blk_buffers[i];
+
+        buffer->hash_next = NULL;
+        buffer->flags = 0;
+        buffer->users = 0;
+        buffer->data = data + (i * BLK_BLOCK_SIZE);
+
+        blkPushBack(buffer);
+    }
+
+    fprintf(serial, "[BLK] Block cache of %d blocks at %#X\n", BLK_CACHE_BLOCKS, (uint32_t) data);
+}
+
+
+blk_buffer_t *blkGetBuffer(uint8_t device, uint64_t lba) {
+    if (!blkMapDevice(&device, &lba, 1)) {
+        return NULL;
+    }
+
+    blk_buffer_t *buffer = blkFind(device, lba);
+
+    if (buffer) {
+        blk_stats.hits++;
+    } else {
+        blk_stats.misses++;
+
+        buffer = blkAllocate(device, lba);
+        if (!buffer) {
+            fprintf(serial, "[BLK] All the cache buffers are pinned!\n");
+            return NULL;
+        }
+
+        if (!blkDiskRead(device, lba, 1, buffer->data)) {
+            blkDiscard(buffer);
+            return NULL;
+        }
+
+        buffer->flags = BLK_VALID;
+    }
+
+    blkTouch(buffer);
+    buffer->users++;
+
+    return buffer;
+}
+
+
+void blkReleaseBuffer(blk_buffer_t *buffer) {
+    if (buffer && buffer->users) {
+        buffer->users--;
+    }
+}
+
+
+void blkMarkDirty(blk_buffer_t *buffer) {
+    if (buffer) {
+        buffer->flags |= BLK_DIRTY;
+    }
+}
+
+
+bool blkRead(uint8_t device, uint64_t lba, uint32_t count, uint8_t *buffer) {
+    if (!blkMapDevice(&device, &lba, count)) {
+        return false;
+    }
+
+    uint32_t i = 0;
+
+    while (i < count) {
+        blk_buffer_t *cached = blkFind(device, lba + i);
+
+        if (cached) {
+            blk_stats.hits++;
+            blkTouch(cached);
+
+            memoryCopy(buffer + (i * BLK_BLOCK_SIZE), cached->data, BLK_BLOCK_SIZE);
+            i++;
+            continue;
+        }
+
+        // Gather the run of missing blocks, and read it straight into the caller buffer
+        uint32_t run = 1;
+        while (((i + run) < count) && (run < BLK_MAX_RUN) && !blkLookup(device, lba + i + run)) {
+            run++;
+        }
+
+        blk_stats.misses += run;
+
+        uint8_t *target = buffer + (i * BLK_BLOCK_SIZE);
+        bool success;
+
+        // With readahead waiting in the queue, the miss goes there too and both merge in one command
+        if (blkPending(device)) {
+            blk_request_t request = { NULL, lba + i, run, target, device, false, blkReadDone, &success };
+            blkSubmit(&request);
+            blkUnplug(device);
+        } else {
+            success = blkDiskRead(device, lba + i, run, target);
+        }
+
+        if (!success) {
+            return false;
+        }
+
+        for (uint32_t j = 0; j < run; j++) {
+            blk_buffer_t *fresh = blkAllocate(device, lba + i + j);
+            if (!fresh) {
+                break; // Everything is pinned, the caller still has its data
+            }
+
+            memoryCopy(fresh->data, target + (j * BLK_BLOCK_SIZE), BLK_BLOCK_SIZE);
+            fresh->flags = BLK_VALID;
+        }
+
+        i += run;
+    }
+
+    return true;
+}
+
+
+bool blkWrite(uint8_t device, uint64_t lba, uint32_t count, const uint8_t *buffer) {
+    if (!blkMapDevice(&device, &lba, count)) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        const uint8_t *source = buffer + (i * BLK_BLOCK_SIZE);
+        blk_buffer_t *cached = blkFind(device, lba + i);
+
+        if (cached) {
+            blk_stats.hits++;
+            blkTouch(cached);
+        } else {
+            // The whole block is overwritten, so there is no need to read it first
+            cached = blkAllocate(device, lba + i);
+
+            if (!cached) {
+                // No room, write it through
+                if (!blkDiskWrite(device, lba + i, 1, source)) {
+                    return false;
+                }
+                continue;
+            }
+        }
+
+        memoryCopy(cached->data, source, BLK_BLOCK_SIZE);
+        cached->flags = BLK_VALID | BLK_DIRTY;
+    }
+
+    return true;
+}
+
+
+/** A readahead request finished, the buffer becomes a normal cached block */
+static void blkPrefetchDone(blk_request_t *request, bool success) {
+    blk_buffer_t *buffer = (blk_buffer_t *) request->context;
+    buffer->users--;
+
+    if (success) {
+        buffer->flags = BLK_VALID | BLK_PREFETCHED;
+    } else {
+        blkDiscard(buffer);
+    }
+}
+
+
+/** Queue the blocks of [start, end) that aren't cached yet, without dispatching them */
+static void blkPrefetch(uint8_t device, uint64_t start, uint64_t end) {
+    const ata_device_t *disk = ataGetDevice(device >> 1, device & 1);
+    if (!disk || disk->atapi) {
+        return;
+    }
+
+    end = MIN(end, disk->sectors);
+
+    for (uint64_t lba = start; lba < end; lba++) {
+        if (blkLookup(device, lba)) {
+            continue;
+        }
+
+        blk_buffer_t *buffer = blkAllocate(device, lba);
+        if (!buffer) {
+            return; // No room left, the window is too large for the pinned buffers
+        }
+
+        blk_request_t *request = &blk_requests[buffer - blk_buffers];
+
+        request->lba = lba;
+        request->count = 1;
+        request->buffer = buffer->data;
+        request->device = device;
+        request->write = false;
+        request->callback = blkPrefetchDone;
+        request->context = buffer;
+
+        buffer->flags = BLK_LOADING;
+        buffer->users++;
+
+        blk_stats.prefetched++;
+        blkSubmit(request);
+    }
+}
+
+
+void blkStreamInit(blk_stream_t *stream, uint8_t device) {
+    stream->next = (uint64_t) -1; // No block, so the first read is never taken as sequential
+    stream->ahead = 0;
+    stream->window = 0;
+    stream->start = 0;
+    stream->sectors = 0;
+
+    // Partitions read from their disk, shifted by their start
+    const blk_partition_t *partition = blkGetPartition(device);
+    const ata_device_t *disk = partition ? NULL : ataGetDevice(device >> 1, device & 1);
+
+    if (partition) {
+        stream->device = partition->disk;
+        stream->start = partition->start;
+        stream->sectors = partition->sectors;
+    } else if ((device < BLK_QUEUE_DEVICES) && disk && !disk->atapi) {
+        stream->device = device;
+        stream->sectors = disk->sectors;
+    } else {
+        stream->device = device;
+    }
+}
+
+
+bool blkStreamRead(blk_stream_t *stream, uint64_t lba, uint32_t count, uint8_t *buffer) {
+    if ((lba >= stream->sectors) || (count > (stream->sectors - lba))) {
+        fprintf(serial, "FAIL: Stream read past the end of device %#X (LBA %d, %d sectors)\n", stream->device, (uint32_t) lba, count);
+        return false;
+    }
+
+    if (lba == stream->next) {
+        // Sequential, grow the window
+        stream->window = stream->window ? MIN(stream->window * 2, (uint32_t) BLK_READAHEAD_MAX) : BLK_READAHEAD_MIN;
+    } else {
+        // Random, prefetching would only waste the cache
+        stream->window = 0;
+        stream->ahead = lba;
+    }
+
+    stream->next = lba + count;
+
+    // Queue the window before reading, so a miss of the read merges with it in one dispatch
+    if (stream->window) {
+        uint64_t start = MAX(stream->ahead, lba);
+        uint64_t end = MIN(stream->next + stream->window, stream->sectors);
+
+        if (start < end) {
+            blkPrefetch(stream->device, stream->start + start, stream->start + end);
+            stream->ahead = end;
+        }
+    }
+
+    bool success = blkRead(stream->device, stream->start + lba, count, buffer);
+
+    // Reads that were all hits leave the window queued, and its buffers pinned until it goes
+    blkUnplug(stream->device);
+
+    return success;
+}
+
+
+/** A flushed buffer reached the disk and is clean, or failed to and stays dirty, unpinned in both cases */
+static void blkFlushDone(blk_request_t *request, bool success) {
+    blk_buffer_t *buffer = (blk_buffer_t *) request->context;
+
+    if (success) {
+        buffer->flags &= ~BLK_DIRTY;
+        blk_stats.writebacks++;
+    } else {
+        fprintf(serial, "[BLK] Flush of LBA %d failed, kept dirty\n", (uint32_t) buffer->lba);
+        flush_failures++;
+    }
+
+    buffer->users--;
+}
+
+
+bool blkFlush(uint8_t device) {
+    flush_failures = 0;
+
+    const blk_partition_t *partition = blkGetPartition(device);
+    if (partition) {
+        device = partition->disk;
+    }
+
+    // Every dirty buffer becomes a request, the queue sorts them and merges the adjacent ones
+    for (uint32_t i = 0; i < BLK_CACHE_BLOCKS; i++) {
+        blk_buffer_t *buffer = &blk_buffers[i];
+
+        if (!(buffer->flags & BLK_DIRTY) || ((device != BLK_ALL_DEVICES) && (buffer->device != device))) {
+            continue;
+        }
+
+        blk_request_t *request = &blk_requests[i];
+
+        request->lba = buffer->lba;
+        request->count = 1;
+        request->buffer = buffer->data;
+        request->device = buffer->device;
+        request->write = true;
+        request->callback = blkFlushDone;
+        request->context = buffer;
+
+        buffer->users++; // Nobody can evict it while it's queued
+
+        blkSubmit(request);
+    }
+
+    blkUnplug(device);
+
+    // And out of the drive write caches, or a power off could still lose them
+    for (uint8_t i = 0; i < BLK_QUEUE_DEVICES; i++) {
+        const ata_device_t *disk = ataGetDevice(i >> 1, i & 1);
+
+        if (((device != BLK_ALL_DEVICES) && (i != device)) || !disk || disk->atapi) {
+            continue;
+        }
+
+        if (!ataFlush(i >> 1, i & 1)) {
+            fprintf(serial, "[BLK] Cache flush of drive %d:%d failed\n", i >> 1, i & 1);
+            flush_failures++;
+        }
+    }
+
+    return flush_failures == 0;
+}
+
+
+void blkGetStatus(void) {
+    uint32_t valid = 0, dirty = 0, pinned = 0;
+
+    for (uint32_t i = 0; i < BLK_CACHE_BLOCKS; i++) {
+        if (blk_buffers[i].flags & BLK_VALID) valid++;
+        if (blk_buffers[i].flags & BLK_DIRTY) dirty++;
+        if (blk_buffers[i].users) pinned++;
+    }
+
+    uint32_t lookups = blk_stats.hits + blk_stats.misses;
+
+    printl(INFO, "Block Cache Status:\n");
+
+    printf(" * Buffers: %d used, %d dirty, %d pinned (of %d)\n", valid, dirty, pinned, BLK_CACHE_BLOCKS);
+    printf(" * Hits: %d, Misses: %d (%d%% hit ratio)\n", blk_stats.hits, blk_stats.misses, lookups ? (blk_stats.hits * 100) / lookups : 0);
+    printf(" * Evictions: %d, Write backs: %d blocks, %d lost\n", blk_stats.evictions, blk_stats.writebacks, blk_stats.lost);
+    printf(" * Disk commands: %d\n", blk_stats.commands);
+    printf(" * Readahead: %d blocks, %d used\n\n", blk_stats.prefetched, blk_stats.useful);
+}
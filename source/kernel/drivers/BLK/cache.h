@@ -0,0 +1,121 @@
+#ifndef _KERNEL_BLOCK_CACHE_H
+#define _KERNEL_BLOCK_CACHE_H 1
+
+#include "../../../common/common.h"
+
+/** Cached unit, one disk sector */
+#define BLK_BLOCK_SIZE      512
+
+/** Number of cached blocks (128 KB) */
+#define BLK_CACHE_BLOCKS    256
+
+/** Buckets of the (device, lba) hash table */
+#define BLK_HASH_SIZE       64
+
+/** Largest run of blocks moved with a single disk command */
+#define BLK_MAX_RUN         64
+
+/** Block device number of an ATA drive */
+#define BLK_DEVICE(bus, drive) ((uint8_t) (((bus) << 1) | (drive)))
+
+/** Any device, for blkFlush() */
+#define BLK_ALL_DEVICES     0xFF
+
+/** Readahead window limits, in blocks */
+#define BLK_READAHEAD_MIN   8
+#define BLK_READAHEAD_MAX   128
+
+#define BLK_VALID           0x01 // The data was read from (or written for) the disk
+#define BLK_DIRTY           0x02 // The data must be written back
+#define BLK_LOADING         0x04 // A readahead request for it is queued
+#define BLK_PREFETCHED      0x08 // Brought by readahead and not used yet
+
+typedef struct blk_buffer {
+    struct blk_buffer *hash_next;
+    struct blk_buffer *lru_prev;    // Towards the most recently used
+    struct blk_buffer *lru_next;    // Towards the least recently used
+
+    uint64_t lba;
+    uint8_t device;
+    uint8_t flags;
+    uint16_t users;                 // Pinned buffers are never evicted
+
+    uint8_t *data;
+} blk_buffer_t;
+
+/**
+ * Sequential access state of a reader (a file, a stream...), owned by the caller.
+ */
+typedef struct {
+    uint64_t next;      // Block a sequential read would start at
+    uint64_t ahead;     // Everything before this block was already prefetched
+    uint32_t window;    // Readahead size in blocks, 0 while the access looks random
+    uint8_t device;     // The disk, for partitions too
+    uint64_t start;     // First block of the partition on the disk, 0 for a whole disk
+    uint64_t sectors;   // Blocks the stream can read
+} blk_stream_t;
+
+/**
+ * Allocate the cache buffers, must be called after the heap and the ATA drives.
+ */
+void initializeBlockCache(void);
+
+/**
+ * Get a pinned buffer with the content of a block, reading it on a miss.
+ *
+ * @param device    Block device (see BLK_DEVICE)
+ * @param lba       Block number
+ * @return          The buffer, or NULL on I/O errors (release it with blkReleaseBuffer)
+ */
+blk_buffer_t *blkGetBuffer(uint8_t device, uint64_t lba);
+
+/** Unpin a buffer returned by blkGetBuffer() */
+void blkReleaseBuffer(blk_buffer_t *buffer);
+
+/** Tell the cache the buffer data was modified, it will be written back later */
+void blkMarkDirty(blk_buffer_t *buffer);
+
+/**
+ * Read blocks through the cache, missing runs are read with one command each.
+ *
+ * @return True if all the blocks were read
+ */
+bool blkRead(uint8_t device, uint64_t lba, uint32_t count, uint8_t *buffer);
+
+/**
+ * Start tracking a new stream on a device, a disk or a partition (whose LBAs are then
+ * relative to its start). The stream reads nothing if there is no such device.
+ */
+void blkStreamInit(blk_stream_t *stream, uint8_t device);
+
+/**
+ * Read blocks for a stream. Sequential reads queue a readahead window of the following
+ * blocks into the cache, which doubles on each sequential read up to BLK_READAHEAD_MAX,
+ * and a random read turns it off until the access is sequential again.
+ *
+ * @return True if all the blocks were read
+ */
+bool blkStreamRead(blk_stream_t *stream, uint64_t lba, uint32_t count, uint8_t *buffer);
+
+/**
+ * Write blocks into the cache, the disk is updated on eviction or blkFlush().
+ *
+ * @return True if all the blocks were stored
+ */
+bool blkWrite(uint8_t device, uint64_t lba, uint32_t count, const uint8_t *buffer);
+
+/**
+ * Write back the dirty blocks of a device (or of all, with BLK_ALL_DEVICES), then
+ * flush the drive write caches, so everything is on the media. A partition flushes
+ * its whole disk. Blocks that fail to be written stay dirty, for a later flush.
+ *
+ * @return True if everything was written
+ */
+bool blkFlush(uint8_t device);
+
+/**
+ * Print the hit/miss counters and the buffers usage.
+ */
+void blkGetStatus(void);
+
+#endif /* _KERNEL_BLOCK_CACHE_H */
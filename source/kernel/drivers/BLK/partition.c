@@ -0,0 +1,374 @@
+#include "partition.h"
+#include "cache.h"
+#include "queue.h"
+
+#include "../ATA/ata.h"
+
+#include "../../memory/memory.h"
+#include "../../modules/terminal.h"
+
+/*
+ * Partition tables.
+ *
+ * Every partition found on the ATA disks gets its own device number, and the reads and
+ * writes made through it are relative to the partition start and checked against its end,
+ * so whoever owns a partition can't touch the rest of the disk.
+ *
+ * MBR disks can have four primary partitions, and an extended one holding a chain of EBRs
+ * with a logical partition each. A protective MBR (a single 0xEE entry) means the real
+ * table is the GPT, with its header on LBA 1 and the entries right after.
+ *
+ * @see https://wiki.osdev.org/MBR_(x86)
+ * @see https://wiki.osdev.org/GPT
+ */
+
+/* Offsets inside the MBR (and the EBRs) */
+#define MBR_TABLE           446
+#define MBR_ENTRY_SIZE      16
+#define MBR_SIGNATURE       510
+
+/* Offsets inside a MBR partition entry */
+#define MBR_ENTRY_TYPE      4
+#define MBR_ENTRY_START     8
+#define MBR_ENTRY_SECTORS   12
+
+/* Offsets inside the GPT header */
+#define GPT_HEADER_LBA      1
+#define GPT_ENTRIES_LBA     72
+#define GPT_ENTRIES_COUNT   80
+#define GPT_ENTRY_SIZE      84
+
+/** Entries of a standard GPT, the partition numbers have to fit in a byte */
+#define GPT_MAX_ENTRIES     128
+
+/* Offsets inside a GPT partition entry */
+#define GPT_ENTRY_TYPE      0
+#define GPT_ENTRY_FIRST     32
+#define GPT_ENTRY_LAST      40
+#define GPT_ENTRY_NAME      56
+
+static blk_partition_t blk_partitions[BLK_MAX_PARTITIONS];
+
+
+static inline uint32_t blkReadLong(const uint8_t *pointer) {
+    return pointer[0] | (pointer[1] << 8) | (pointer[2] << 16) | ((uint32_t) pointer[3] << 24);
+}
+
+static inline uint64_t blkReadQuad(const uint8_t *pointer) {
+    return ((uint64_t) blkReadLong(pointer + 4) << 32) | blkReadLong(pointer);
+}
+
+
+/** Sectors of a whole disk, 0 if it isn't an ATA disk */
+static uint64_t blkDiskSectors(uint8_t disk) {
+    const ata_device_t *device = ataGetDevice(disk >> 1, disk & 1);
+    return (device && !device->atapi) ? device->sectors : 0;
+}
+
+
+/** Add a partition to the table, after checking it fits on its disk */
+static void blkAddPartition(uint8_t disk, uint8_t number, uint8_t scheme, uint8_t type, uint64_t start, uint64_t sectors, const char *name) {
+    uint64_t size = blkDiskSectors(disk);
+
+    if (!sectors) {
+        return;
+    }
+
+    if ((start == 0) || (start >= size) || (sectors > (size - start))) {
+        fprintf(serial, "FAIL: Partition %d of disk %d goes past the end of the disk, ignored\n", number, disk);
+        return;
+    }
+
+    for (uint8_t i = 0; i < BLK_MAX_PARTITIONS; i++) {
+        blk_partition_t *partition = &blk_partitions[i];
+        if (partition->present) {
+            continue;
+        }
+
+        partition->present = true;
+        partition->disk = disk;
+        partition->number = number;
+        partition->scheme = scheme;
+        partition->type = type;
+        partition->start = start;
+        partition->sectors = sectors;
+        strncpy(partition->name, name ? name : "", BLK_GPT_NAME_LEN);
+        partition->name[BLK_GPT_NAME_LEN] = '\0';
+
+        fprintf(serial, "[BLK] Partition %d of disk %d, LBA %d, %d sectors (device %#X)\n",
+            number, disk, (uint32_t) start, (uint32_t) sectors, BLK_PARTITION_BASE + i
+        );
+        return;
+    }
+
+    fprintf(serial, "FAIL: Too many partitions, %d of disk %d ignored\n", number, disk);
+}
+
+
+static inline bool blkIsExtended(uint8_t type) {
+    return (type == BLK_MBR_EXTENDED) || (type == BLK_MBR_EXTENDED_LBA);
+}
+
+
+/**
+ * Follow the EBR chain of an extended partition. Each EBR has the logical partition
+ * (relative to the EBR itself) and the link to the next EBR (relative to the extended one).
+ */
+static void blkParseExtended(uint8_t disk, uint32_t base) {
+    uint8_t sector[BLK_BLOCK_SIZE];
+    uint32_t ebr = base;
+
+    for (uint8_t number = BLK_LOGICAL_FIRST; number < (BLK_LOGICAL_FIRST + BLK_MAX_PARTITIONS); number++) {
+        if (!blkRead(disk, ebr, 1, sector) || (sector[MBR_SIGNATURE] | (sector[MBR_SIGNATURE + 1] << 8)) != BLK_MBR_SIGNATURE) {
+            fprintf(serial, "FAIL: Broken EBR chain at LBA %d of disk %d\n", ebr, disk);
+            return;
+        }
+
+        const uint8_t *logical = sector + MBR_TABLE;
+        const uint8_t *next = logical + MBR_ENTRY_SIZE;
+
+        if (logical[MBR_ENTRY_TYPE]) {
+            blkAddPartition(disk, number, BLK_SCHEME_MBR, logical[MBR_ENTRY_TYPE],
+                (uint64_t) ebr + blkReadLong(logical + MBR_ENTRY_START), blkReadLong(logical + MBR_ENTRY_SECTORS), NULL
+            );
+        }
+
+        uint32_t link = blkReadLong(next + MBR_ENTRY_START);
+        if (!blkIsExtended(next[MBR_ENTRY_TYPE]) || !link) {
+            return;
+        }
+
+        ebr = base + link;
+    }
+}
+
+
+static void blkParseMBR(uint8_t disk, const uint8_t *mbr) {
+    for (uint8_t i = 0; i < 4; i++) {
+        const uint8_t *entry = mbr + MBR_TABLE + (i * MBR_ENTRY_SIZE);
+
+        uint8_t type = entry[MBR_ENTRY_TYPE];
+        uint32_t start = blkReadLong(entry + MBR_ENTRY_START);
+        uint32_t sectors = blkReadLong(entry + MBR_ENTRY_SECTORS);
+
+        if (!type || !sectors) {
+            continue;
+        }
+
+        if (blkIsExtended(type)) {
+            blkParseExtended(disk, start);
+        } else {
+            blkAddPartition(disk, i + 1, BLK_SCHEME_MBR, type, start, sectors, NULL);
+        }
+    }
+}
+
+
+/** Parse the GPT, the CRCs aren't checked but every field is bounds checked */
+static bool blkParseGPT(uint8_t disk) {
+    uint8_t sector[BLK_BLOCK_SIZE];
+
+    if (!blkRead(disk, GPT_HEADER_LBA, 1, sector) || (memoryCompare(sector, "EFI PART", 8) != 0)) {
+        fprintf(serial, "FAIL: Disk %d has a protective MBR but no GPT header\n", disk);
+        return false;
+    }
+
+    uint64_t table = blkReadQuad(sector + GPT_ENTRIES_LBA);
+    uint32_t count = blkReadLong(sector + GPT_ENTRIES_COUNT);
+    uint32_t size = blkReadLong(sector + GPT_ENTRY_SIZE);
+
+    // The entry size is 128 << n, so the entries never cross a sector
+    if ((size < 128) || (size > BLK_BLOCK_SIZE) || (size & (size - 1)) || (table >= blkDiskSectors(disk))) {
+        fprintf(serial, "FAIL: Invalid GPT header on disk %d\n", disk);
+        return false;
+    }
+
+    uint32_t per_sector = BLK_BLOCK_SIZE / size;
+    count = MIN(count, (uint32_t) GPT_MAX_ENTRIES);
+
+    for (uint32_t index = 0; index < count; index++) {
+        if ((index % per_sector) == 0) {
+            if (!blkRead(disk, table + (index / per_sector), 1, sector)) {
+                return false;
+            }
+        }
+
+        const uint8_t *entry = sector + ((index % per_sector) * size);
+
+        // An unused entry has a zero type GUID
+        bool used = false;
+        for (uint8_t i = 0; i < 16; i++) {
+            used |= (entry[GPT_ENTRY_TYPE + i] != 0);
+        }
+
+        if (!used) {
+            continue;
+        }
+
+        uint64_t first = blkReadQuad(entry + GPT_ENTRY_FIRST);
+        uint64_t last = blkReadQuad(entry + GPT_ENTRY_LAST);
+
+        // The name is UTF-16LE, we only keep the ASCII part
+        char name[BLK_GPT_NAME_LEN + 1];
+        uint8_t length = 0;
+
+        for (uint8_t i = 0; i < BLK_GPT_NAME_LEN; i++) {
+            uint16_t character = entry[GPT_ENTRY_NAME + (i * 2)] | (entry[GPT_ENTRY_NAME + (i * 2) + 1] << 8);
+            if (!character) {
+                break;
+            }
+            name[length++] = ((character >= 0x20) && (character < 0x7F)) ? (char) character : '?';
+        }
+        name[length] = '\0';
+
+        // Numbered by their slot in the table, like everybody else does
+        if (last >= first) {
+            blkAddPartition(disk, (uint8_t) (index + 1), BLK_SCHEME_GPT, 0, first, (last - first) + 1, name);
+        }
+    }
+
+    return true;
+}
+
+
+void initializePartitions(void) {
+    uint8_t sector[BLK_BLOCK_SIZE];
+
+    for (uint8_t i = 0; i < BLK_MAX_PARTITIONS; i++) {
+        blk_partitions[i].present = false;
+    }
+
+    for (uint8_t bus = ATA_PRIMARY; bus <= ATA_SECONDARY; bus++) {
+        for (uint8_t drive = ATA_MASTER; drive <= ATA_SLAVE; drive++) {
+            uint8_t disk = BLK_DEVICE(bus, drive);
+
+            if (!blkDiskSectors(disk) || !blkRead(disk, 0, 1, sector)) {
+                continue;
+            }
+
+            if ((sector[MBR_SIGNATURE] | (sector[MBR_SIGNATURE + 1] << 8)) != BLK_MBR_SIGNATURE) {
+                fprintf(serial, "[BLK] Disk %d has no partition table\n", disk);
+                continue;
+            }
+
+            bool protective = false;
+            for (uint8_t i = 0; i < 4; i++) {
+                protective |= (sector[MBR_TABLE + (i * MBR_ENTRY_SIZE) + MBR_ENTRY_TYPE] == BLK_MBR_PROTECTIVE);
+            }
+
+            if (protective) {
+                blkParseGPT(disk);
+            } else {
+                blkParseMBR(disk, sector);
+            }
+        }
+    }
+}
+
+
+const blk_partition_t *blkGetPartition(uint8_t device) {
+    if ((device < BLK_PARTITION_BASE) || (device >= (BLK_PARTITION_BASE + BLK_MAX_PARTITIONS))) {
+        return NULL;
+    }
+
+    const blk_partition_t *partition = &blk_partitions[device - BLK_PARTITION_BASE];
+    return partition->present ? partition : NULL;
+}
+
+
+uint8_t blkFindPartition(uint8_t disk, uint8_t number) {
+    for (uint8_t i = 0; i < BLK_MAX_PARTITIONS; i++) {
+        const blk_partition_t *partition = &blk_partitions[i];
+
+        if (partition->present && (partition->disk == disk) && (partition->number == number)) {
+            return BLK_PARTITION_BASE + i;
+        }
+    }
+    return 0;
+}
+
+
+/** Check a request against the partition bounds */
+static const blk_partition_t *blkCheckPartition(uint8_t device, uint64_t lba, uint32_t count) {
+    const blk_partition_t *partition = blkGetPartition(device);
+
+    if (!partition) {
+        fprintf(serial, "FAIL: There is no partition device %#X\n", device);
+        return NULL;
+    }
+
+    if ((lba >= partition->sectors) || (count > (partition->sectors - lba))) {
+        fprintf(serial, "FAIL: Request past the end of partition %#X (LBA %d, %d sectors)\n", device, (uint32_t) lba, count);
+        return NULL;
+    }
+
+    return partition;
+}
+
+
+bool blkMapDevice(uint8_t *device, uint64_t *lba, uint32_t count) {
+    // The whole disks are addressed as they are
+    if (*device < BLK_PARTITION_BASE) {
+        return *device < BLK_QUEUE_DEVICES;
+    }
+
+    const blk_partition_t *partition = blkCheckPartition(*device, *lba, count);
+    if (!partition) {
+        return false;
+    }
+
+    *device = partition->disk;
+    *lba += partition->start;
+    return true;
+}
+
+
+bool blkPartitionRead(uint8_t device, uint64_t lba, uint32_t count, uint8_t *buffer) {
+    if (!blkCheckPartition(device, lba, count)) {
+        return false;
+    }
+
+    return blkRead(device, lba, count, buffer);
+}
+
+
+bool blkPartitionWrite(uint8_t device, uint64_t lba, uint32_t count, const uint8_t *buffer) {
+    if (!blkCheckPartition(device, lba, count)) {
+        return false;
+    }
+
+    return blkWrite(device, lba, count, buffer);
+}
+
+
+void blkPartitionGetStatus(void) {
+    bool found = false;
+
+    printl(INFO, "Partitions:\n");
+
+    for (uint8_t i = 0; i < BLK_MAX_PARTITIONS; i++) {
+        const blk_partition_t *partition = &blk_partitions[i];
+        if (!partition->present) {
+            continue;
+        }
+
+        printf(" * %d: disk %d:%d #%d, LBA %d, %d MB, ",
+            BLK_PARTITION_BASE + i, partition->disk >> 1, partition->disk & 1, partition->number,
+            (uint32_t) partition->start, (uint32_t) (partition->sectors >> 11)
+        );
+
+        if (partition->scheme == BLK_SCHEME_GPT) {
+            printf("GPT '%s'\n", partition->name);
+        } else {
+            printf("MBR type %#X\n", partition->type);
+        }
+
+        found = true;
+    }
+
+    if (!found) {
+        printf(" * No partitions found\n");
+    }
+
+    printf("\n");
+}
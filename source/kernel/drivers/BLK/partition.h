@@ -0,0 +1,95 @@
+#ifndef _KERNEL_BLOCK_PARTITION_H
+#define _KERNEL_BLOCK_PARTITION_H 1
+
+#include "../../../common/common.h"
+
+/** Most partitions we keep track of, over all the disks */
+#define BLK_MAX_PARTITIONS  16
+
+/** Partition device numbers start here, so they can't be taken for a disk (see BLK_DEVICE) */
+#define BLK_PARTITION_BASE  0x10
+
+/** Logical partitions inside an extended one are numbered from here (like on Linux) */
+#define BLK_LOGICAL_FIRST   5
+
+#define BLK_MBR_SIGNATURE   0xAA55
+#define BLK_MBR_PROTECTIVE  0xEE // The disk has a GPT
+#define BLK_MBR_EXTENDED    0x05
+#define BLK_MBR_EXTENDED_LBA 0x0F
+
+#define BLK_GPT_NAME_LEN    36
+
+/** Partitioning schemes */
+#define BLK_SCHEME_MBR      0x01
+#define BLK_SCHEME_GPT      0x02
+
+typedef struct {
+    bool present;
+    uint8_t disk;       // Block device of the whole disk (see BLK_DEVICE)
+    uint8_t number;     // Partition number on its disk, from 1
+    uint8_t scheme;     // BLK_SCHEME_MBR or BLK_SCHEME_GPT
+    uint8_t type;       // MBR type, 0 on GPT partitions
+    uint64_t start;     // First sector on the disk
+    uint64_t sectors;
+    char name[BLK_GPT_NAME_LEN + 1]; // GPT partition name, ASCII only
+} blk_partition_t;
+
+/**
+ * Read the partition tables of the ATA disks, must be called after the block cache.
+ */
+void initializePartitions(void);
+
+/**
+ * Get a partition found by initializePartitions().
+ *
+ * @param device    Partition device (BLK_PARTITION_BASE + index)
+ * @return          The partition, or NULL if there is none with that number
+ */
+const blk_partition_t *blkGetPartition(uint8_t device);
+
+/**
+ * Find the partition device of a disk partition.
+ *
+ * @param disk      Block device of the disk (see BLK_DEVICE)
+ * @param number    Partition number on the disk, from 1
+ * @return          The partition device, or 0 if there is no such partition
+ */
+uint8_t blkFindPartition(uint8_t disk, uint8_t number);
+
+/**
+ * Turn a partition device and an LBA relative to the partition into the disk device
+ * and the disk LBA, checking that the request stays inside the partition. Whole disk
+ * devices are left as they are. The block cache and the request queue call this, so
+ * a partition can be used as a device anywhere.
+ *
+ * @param device    Block device, replaced by its disk
+ * @param lba       Block number, replaced by the one on the disk
+ * @param count     Blocks of the request
+ * @return          False if there is no such device or the request goes past its end
+ */
+bool blkMapDevice(uint8_t *device, uint64_t *lba, uint32_t count);
+
+/**
+ * Read blocks of a partition through the block cache, the LBA is relative to
+ * the partition start and the request can't go past its end. Unlike blkRead(),
+ * a whole disk device is refused.
+ *
+ * @return True if all the blocks were read
+ */
+bool blkPartitionRead(uint8_t device, uint64_t lba, uint32_t count, uint8_t *buffer);
+
+/**
+ * Write blocks of a partition through the block cache, the LBA is relative to
+ * the partition start and the request can't go past its end. Unlike blkWrite(),
+ * a whole disk device is refused.
+ *
+ * @return True if all the blocks were stored
+ */
+bool blkPartitionWrite(uint8_t device, uint64_t lba, uint32_t count, const uint8_t *buffer);
+
+/**
+ * Print the partitions of every disk.
+ */
+void blkPartitionGetStatus(void);
+
+#endif /* _KERNEL_BLOCK_PARTITION_H */
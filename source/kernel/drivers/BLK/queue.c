@@ -0,0 +1,222 @@
+#include "queue.h"
+#include "cache.h"
+#include "partition.h"
+
+#include "../ATA/ata.h"
+
+#include "../../modules/terminal.h"
+
+/*
+ * Block request queue.
+ *
+ * Requests are kept sorted by LBA while the queue is plugged. On dispatch the queue is
+ * served like an elevator that only goes up (C-LOOK): from the position where the last
+ * command ended to the highest LBA, then back to the lowest one. Runs of adjacent requests
+ * in the same direction are merged into a single ATA command with a segment vector.
+ * Requests that can't be reordered with the queued ones wait behind a barrier.
+ *
+ * There are no tasks to switch to, so the dispatch itself is synchronous (the CPU sleeps
+ * during each transfer), but submitters don't wait for their own request, and many small
+ * requests turn into a few large sequential transfers.
+ */
+
+typedef struct {
+    blk_request_t *head;    // Sorted by LBA
+    blk_request_t *held;    // Behind a barrier, in submission order, see blkQueueRequest()
+    uint32_t depth;
+    uint64_t position;      // Where the last command ended
+    bool dispatching;
+} blk_queue_t;
+
+static blk_queue_t blk_queues[BLK_QUEUE_DEVICES];
+
+static struct {
+    uint32_t submitted;
+    uint32_t commands;
+    uint32_t sectors;
+    uint32_t failed;
+} queue_stats;
+
+
+/** Two requests touch the same sectors */
+static inline bool blkOverlaps(const blk_request_t *a, const blk_request_t *b) {
+    return (a->lba < (b->lba + b->count)) && (b->lba < (a->lba + a->count));
+}
+
+
+/** A request touches the same sectors as one in the list, and one of both writes */
+static bool blkConflicts(const blk_request_t *list, const blk_request_t *request) {
+    for (const blk_request_t *queued = list; queued; queued = queued->next) {
+        if (blkOverlaps(queued, request) && (queued->write || request->write)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/**
+ * Sort a request into the queue. Sorting could reorder a write with another request on
+ * the same sectors (only two reads can be freely reordered), so a conflicting request is
+ * held behind a barrier instead: it's sorted in only once all the requests queued before
+ * it are done.
+ */
+static void blkQueueRequest(blk_queue_t *queue, blk_request_t *request) {
+    if (blkConflicts(queue->head, request) || blkConflicts(queue->held, request)) {
+        blk_request_t **link = &queue->held;
+        while (*link) {
+            link = &(*link)->next;
+        }
+
+        request->next = NULL;
+        *link = request;
+        return;
+    }
+
+    // Insert after the requests with the same LBA, to keep their order
+    blk_request_t **link = &queue->head;
+    while (*link && ((*link)->lba <= request->lba)) {
+        link = &(*link)->next;
+    }
+
+    request->next = *link;
+    *link = request;
+
+    queue->depth++;
+}
+
+
+void blkSubmit(blk_request_t *request) {
+    // A partition request goes to its disk, the bounds are checked on the way
+    if (!request || !request->count || !blkMapDevice(&request->device, &request->lba, request->count)) {
+        if (request && request->callback) {
+            request->callback(request, false);
+        }
+        return;
+    }
+
+    blk_queue_t *queue = &blk_queues[request->device];
+    queue_stats.submitted++;
+
+    blkQueueRequest(queue, request);
+
+    // A barrier is passed by dispatching what's before it, from a callback this returns
+    // at once and the running dispatch gets there
+    if (queue->held || (queue->depth >= BLK_QUEUE_DEPTH)) {
+        blkUnplug(request->device);
+    }
+}
+
+
+static void blkDispatch(uint8_t device) {
+    blk_queue_t *queue = &blk_queues[device];
+
+    // A callback can submit (and unplug) again, the loop below will pick it up
+    if (queue->dispatching) {
+        return;
+    }
+    queue->dispatching = true;
+
+    while (queue->head || queue->held) {
+        // Everything before the barrier is done, the held requests are sorted in again
+        // (in order, so one conflicting with an earlier held one waits for it again)
+        if (!queue->head) {
+            blk_request_t *held = queue->held;
+            queue->held = NULL;
+
+            while (held) {
+                blk_request_t *next = held->next;
+                blkQueueRequest(queue, held);
+                held = next;
+            }
+            continue;
+        }
+
+        // Next request going up from the current position, or wrap to the lowest one
+        blk_request_t **link = &queue->head;
+        while (*link && ((*link)->lba < queue->position)) {
+            link = &(*link)->next;
+        }
+
+        if (!*link) {
+            link = &queue->head;
+        }
+
+        blk_request_t *first = *link;
+        blk_request_t *batch[BLK_MAX_SEGMENTS];
+        ata_segment_t segments[BLK_MAX_SEGMENTS];
+
+        uint8_t count = 0;
+        uint32_t sectors = 0;
+        uint64_t end = first->lba;
+
+        // Merge the following requests while they continue the previous one
+        blk_request_t *current = first;
+        while (current && (count < BLK_MAX_SEGMENTS) && (current->write == first->write) && (current->lba == end)) {
+            if (count && ((sectors + current->count) > ATA_MAX_SECTORS)) {
+                break; // One command per batch
+            }
+
+            batch[count] = current;
+            segments[count].buffer = current->buffer;
+            segments[count].sectors = current->count;
+
+            sectors += current->count;
+            end += current->count;
+            count++;
+
+            current = current->next;
+        }
+
+        // Take the batch out of the queue before running any callback
+        *link = current;
+        queue->depth -= count;
+        queue->position = end;
+
+        bool success = ataTransferVector(device >> 1, device & 1, first->lba, segments, count, first->write);
+
+        queue_stats.commands++;
+        queue_stats.sectors += sectors;
+        if (!success) {
+            queue_stats.failed++;
+        }
+
+        for (uint8_t i = 0; i < count; i++) {
+            if (batch[i]->callback) {
+                batch[i]->callback(batch[i], success);
+            }
+        }
+    }
+
+    queue->dispatching = false;
+}
+
+
+void blkUnplug(uint8_t device) {
+    if (device == BLK_ALL_DEVICES) {
+        for (uint8_t i = 0; i < BLK_QUEUE_DEVICES; i++) {
+            blkDispatch(i);
+        }
+    } else if (device < BLK_QUEUE_DEVICES) {
+        blkDispatch(device);
+    }
+}
+
+
+bool blkPending(uint8_t device) {
+    return (device < BLK_QUEUE_DEVICES) && (blk_queues[device].head || blk_queues[device].held);
+}
+
+
+void blkQueueGetStatus(void) {
+    printl(INFO, "Block Queue Status:\n");
+
+    printf(" * Requests: %d submitted, %d failed commands\n", queue_stats.submitted, queue_stats.failed);
+    printf(" * Commands: %d (%d sectors)\n", queue_stats.commands, queue_stats.sectors);
+
+    if (queue_stats.commands) {
+        printf(" * Merging: %f requests per command\n\n", (double) queue_stats.submitted / queue_stats.commands);
+    } else {
+        printf("\n");
+    }
+}
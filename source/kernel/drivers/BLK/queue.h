@@ -0,0 +1,61 @@
+#ifndef _KERNEL_BLOCK_QUEUE_H
+#define _KERNEL_BLOCK_QUEUE_H 1
+
+#include "../../../common/common.h"
+
+/** Devices with a queue, matches BLK_DEVICE() */
+#define BLK_QUEUE_DEVICES   4
+
+/** Queued requests that force the queue to be dispatched */
+#define BLK_QUEUE_DEPTH     64
+
+/** Most requests merged into a single command */
+#define BLK_MAX_SEGMENTS    64
+
+typedef struct blk_request blk_request_t;
+
+/** Called once the request is done, the request memory can be reused from here */
+typedef void (*blk_callback_t)(blk_request_t *request, bool success);
+
+struct blk_request {
+    struct blk_request *next;   // Used by the queue
+
+    uint64_t lba;
+    uint32_t count;             // Sectors
+    uint8_t *buffer;
+
+    uint8_t device;             // See BLK_DEVICE()
+    bool write;
+
+    blk_callback_t callback;
+    void *context;              // Free for the submitter
+};
+
+/**
+ * Queue a request, it stays there (plugged) until the queue is full or blkUnplug() is
+ * called, so that nearby requests can be sorted and merged before going to the disk.
+ *
+ * @note The request and its buffer must stay alive until the callback runs. A request
+ *       for a partition has its device and LBA replaced by the disk ones. A request on
+ *       the same sectors as a queued one, where either is a write, waits until all the
+ *       queued ones are done, and the queue is dispatched at once.
+ *
+ * @param request The request to queue
+ */
+void blkSubmit(blk_request_t *request);
+
+/**
+ * Dispatch the queued requests of a device (or of all, with BLK_ALL_DEVICES) in
+ * C-LOOK order, merging adjacent requests, and run their callbacks.
+ */
+void blkUnplug(uint8_t device);
+
+/** Tell if a device has requests waiting in its queue */
+bool blkPending(uint8_t device);
+
+/**
+ * Print the request, merge and dispatch counters.
+ */
+void blkQueueGetStatus(void);
+
+#endif /* _KERNEL_BLOCK_QUEUE_H */
@@ -0,0 +1,177 @@
+#include "pci.h"
+
+#include "../../CPU/HAL.h"
+#include "../../modules/terminal.h"
+
+/*
+ * PCI configuration space access, using the mechanism #1 (0xCF8 address, 0xCFC data).
+ * We brute-force scan all the buses once, that is fast enough and works on anything.
+ *
+ * @see https://wiki.osdev.org/PCI
+ */
+
+static pci_device_t pci_devices[PCI_MAX_DEVICES];
+static uint8_t pci_count = 0;
+
+
+uint32_t pciReadConfig(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset) {
+    uint32_t address = (1U << 31) | (bus << 16) | (device << 11) | (function << 8) | (offset & 0xFC);
+
+    writeLongToPort(PCI_CONFIG_ADDRESS, address);
+    return readLongFromPort(PCI_CONFIG_DATA);
+}
+
+
+void pciWriteConfig(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset, uint32_t value) {
+    uint32_t address = (1U << 31) | (bus << 16) | (device << 11) | (function << 8) | (offset & 0xFC);
+
+    writeLongToPort(PCI_CONFIG_ADDRESS, address);
+    writeLongToPort(PCI_CONFIG_DATA, value);
+}
+
+
+/** Size the BARs by writing all ones and reading back the mask */
+static void pciDecodeBars(pci_device_t *device) {
+    for (uint8_t i = 0; i < 6; i++) {
+        uint8_t offset = PCI_REG_BAR0 + (i * 4);
+        uint32_t value = pciReadConfig(device->bus, device->device, device->function, offset);
+
+        pciWriteConfig(device->bus, device->device, device->function, offset, 0xFFFFFFFF);
+        uint32_t mask = pciReadConfig(device->bus, device->device, device->function, offset);
+        pciWriteConfig(device->bus, device->device, device->function, offset, value);
+
+        device->bar_io[i] = (value & 0x01) != 0;
+
+        if (device->bar_io[i]) {
+            device->bar[i] = value & 0xFFFFFFFC;
+            mask &= 0xFFFC; // I/O space is only 16 bits wide
+        } else {
+            device->bar[i] = value & 0xFFFFFFF0;
+            mask &= 0xFFFFFFF0;
+        }
+
+        device->bar_size[i] = mask ? (~mask + 1) : 0;
+        if (device->bar_io[i]) {
+            device->bar_size[i] &= 0xFFFF;
+        }
+
+        // A 64-bit memory BAR takes the next slot too, we can only use the low half
+        if (!device->bar_io[i] && ((value & 0x06) == 0x04) && (i < 5)) {
+            i++;
+            device->bar[i] = 0;
+            device->bar_size[i] = 0;
+            device->bar_io[i] = false;
+        }
+    }
+}
+
+
+static void pciCheckFunction(uint8_t bus, uint8_t slot, uint8_t function) {
+    uint32_t ids = pciReadConfig(bus, slot, function, PCI_REG_VENDOR);
+    if ((ids & 0xFFFF) == 0xFFFF) {
+        return; // Nothing here
+    }
+
+    if (pci_count >= PCI_MAX_DEVICES) {
+        fprintf(serial, "[PCI] Too many devices, ignoring %d:%d.%d\n", bus, slot, function);
+        return;
+    }
+
+    pci_device_t *device = &pci_devices[pci_count++];
+    uint32_t class = pciReadConfig(bus, slot, function, PCI_REG_CLASS);
+
+    device->bus = bus;
+    device->device = slot;
+    device->function = function;
+
+    device->vendor = ids & 0xFFFF;
+    device->id = ids >> 16;
+
+    device->class = class >> 24;
+    device->subclass = (class >> 16) & 0xFF;
+    device->interface = (class >> 8) & 0xFF;
+
+    device->irq = pciReadConfig(bus, slot, function, PCI_REG_INTERRUPT) & 0xFF;
+
+    pciDecodeBars(device);
+
+    fprintf(serial, "[PCI] %d:%d.%d %04X:%04X class %02X.%02X.%02X\n",
+        bus, slot, function, device->vendor, device->id,
+        device->class, device->subclass, device->interface
+    );
+}
+
+
+void initializePCI(void) {
+    pci_count = 0;
+
+    for (uint16_t bus = 0; bus < 256; bus++) {
+        for (uint8_t slot = 0; slot < 32; slot++) {
+            uint32_t ids = pciReadConfig(bus, slot, 0, PCI_REG_VENDOR);
+            if ((ids & 0xFFFF) == 0xFFFF) {
+                continue;
+            }
+
+            pciCheckFunction(bus, slot, 0);
+
+            // Only multi-function devices have the other 7 functions
+            uint8_t header = (pciReadConfig(bus, slot, 0, PCI_REG_HEADER) >> 16) & 0xFF;
+            if (header & 0x80) {
+                for (uint8_t function = 1; function < 8; function++) {
+                    pciCheckFunction(bus, slot, function);
+                }
+            }
+        }
+    }
+}
+
+
+const pci_device_t *pciFindDevice(uint16_t vendor, uint16_t id) {
+    for (uint8_t i = 0; i < pci_count; i++) {
+        if ((pci_devices[i].vendor == vendor) && (pci_devices[i].id == id)) {
+            return &pci_devices[i];
+        }
+    }
+    return NULL;
+}
+
+
+const pci_device_t *pciFindClass(uint8_t class, uint8_t subclass) {
+    for (uint8_t i = 0; i < pci_count; i++) {
+        if ((pci_devices[i].class == class) && (pci_devices[i].subclass == subclass)) {
+            return &pci_devices[i];
+        }
+    }
+    return NULL;
+}
+
+
+void pciEnableCommand(const pci_device_t *device, uint16_t flags) {
+    uint32_t command = pciReadConfig(device->bus, device->device, device->function, PCI_REG_COMMAND);
+
+    // The upper half is the status register, writing ones there would clear its bits
+    command = (command & 0xFFFF) | flags;
+    pciWriteConfig(device->bus, device->device, device->function, PCI_REG_COMMAND, command);
+}
+
+
+void pciGetStatus(void) {
+    printl(INFO, "PCI Devices:\n");
+
+    for (uint8_t i = 0; i < pci_count; i++) {
+        const pci_device_t *device = &pci_devices[i];
+
+        printf(" * %d:%d.%d  %04X:%04X  class %02X.%02X  IRQ %d\n",
+            device->bus, device->device, device->function,
+            device->vendor, device->id, device->class, device->subclass, device->irq
+        );
+
+        for (uint8_t j = 0; j < 6; j++) {
+            if (device->bar_size[j]) {
+                printf("     BAR%d: %s %#X (%d bytes)\n", j, device->bar_io[j] ? "I/O" : "MEM", device->bar[j], device->bar_size[j]);
+            }
+        }
+    }
+
+    printf("\n");
+}
@@ -0,0 +1,78 @@
+#ifndef _KERNEL_PCI_DRIVER_H
+#define _KERNEL_PCI_DRIVER_H 1
+
+#include "../../../common/common.h"
+
+#define PCI_CONFIG_ADDRESS  0xCF8
+#define PCI_CONFIG_DATA     0xCFC
+
+#define PCI_REG_VENDOR      0x00
+#define PCI_REG_COMMAND     0x04
+#define PCI_REG_CLASS       0x08
+#define PCI_REG_HEADER      0x0C
+#define PCI_REG_BAR0        0x10
+#define PCI_REG_INTERRUPT   0x3C
+
+#define PCI_COMMAND_IO      0x0001 // Respond to I/O space accesses
+#define PCI_COMMAND_MEMORY  0x0002 // Respond to memory space accesses
+#define PCI_COMMAND_MASTER  0x0004 // Enable bus mastering (DMA)
+
+#define PCI_CLASS_STORAGE   0x01
+#define PCI_CLASS_DISPLAY   0x03
+#define PCI_CLASS_BRIDGE    0x06
+
+#define PCI_SUBCLASS_IDE    0x01
+
+#define PCI_MAX_DEVICES     32
+
+typedef struct {
+    uint8_t bus;
+    uint8_t device;
+    uint8_t function;
+    uint8_t irq;
+
+    uint16_t vendor;
+    uint16_t id;
+
+    uint8_t class;
+    uint8_t subclass;
+    uint8_t interface;
+
+    uint32_t bar[6];        // Decoded base addresses (without the type bits)
+    uint32_t bar_size[6];   // Size of each region, 0 if unused
+    bool bar_io[6];         // True for I/O space regions
+} pci_device_t;
+
+/**
+ * Scan every bus, device and function, and decode the BARs of the found devices.
+ */
+void initializePCI(void);
+
+uint32_t pciReadConfig(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset);
+void pciWriteConfig(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset, uint32_t value);
+
+/**
+ * Find a device by its vendor and device IDs.
+ *
+ * @return The first matching device, or NULL
+ */
+const pci_device_t *pciFindDevice(uint16_t vendor, uint16_t id);
+
+/**
+ * Find a device by its class and subclass codes.
+ *
+ * @return The first matching device, or NULL
+ */
+const pci_device_t *pciFindClass(uint8_t class, uint8_t subclass);
+
+/**
+ * Set bits in the command register of a device (e.g. PCI_COMMAND_MASTER).
+ */
+void pciEnableCommand(const pci_device_t *device, uint16_t flags);
+
+/**
+ * Print the found devices and their regions.
+ */
+void pciGetStatus(void);
+
+#endif /* _KERNEL_PCI_DRIVER_H */
@@ -7,8 +7,20 @@
 
 /* TODO: OPTIMIZE THE SIZE FOR THIS FILE! */
 
+/*
+ * The console scrolls in hardware: the screen start address moves one line down the
+ * 32 KB text window, and only when it reaches the end the screen is copied back to
+ * the top of the window. Every offset below is relative to the first visible cell.
+ */
+static uint16_t console_base = 0;
+
 /* Private functions */
 
+/* Get the video memory of the first visible character cell */
+static inline uint8_t *getScreenMemory(void) {
+    return (uint8_t *) TEXTMODE_BUFFER + console_base;
+}
+
 /* Get the offset of a character cell in video memory based on its column and row */
 static inline int getOffset(int col, int row) {
     return 2 * (row * TEXTMODE_WIDTH + col);
@@ -37,16 +49,16 @@ static inline int getCursorOffset(void) {
     writeByteToPort(CATHODERAY_INDEX, 15);
     offset += readByteFromPort(CATHODERAY_DATA);
 
-    /* Return the cursor offset in bytes */
+    /* Return the cursor offset in bytes, from the first visible cell */
     //return offset * 2;
-    return offset + offset;
+    return (offset + offset) - console_base;
 }
 
 
 /* Set the cursor offset in video memory */
 static void setCursorOffset(int offset) {
     /* Convert the offset in bytes to an offset in character cells */
-    offset /= 2;
+    offset = (offset + console_base) / 2;
 
     /* Write the low byte of the cursor offset (15) to the data port */
     writeByteToPort(CATHODERAY_INDEX, 15);
@@ -58,6 +70,30 @@ static void setCursorOffset(int offset) {
 }
 
 
+/* Scroll the screen one line up, returns the offset that was the same cell before */
+static int scrollConsole(int offset) {
+    uint8_t *window = (uint8_t *) TEXTMODE_BUFFER;
+
+    if ((console_base + TEXTMODE_SIZE + (TEXTMODE_WIDTH << 1)) > TEXTMODE_WINDOW) {
+        // No room below, the screen goes back to the top of the window
+        fastFastMemoryCopy(window, window + console_base + (TEXTMODE_WIDTH << 1), TEXTMODE_WIDTH * (TEXTMODE_HEIGHT - 1) * 2);
+        console_base = 0;
+    } else {
+        console_base += TEXTMODE_WIDTH << 1;
+    }
+
+    /* Blank last line */
+    fastFastMemorySet(
+        (char *)(getScreenMemory() + getOffset(0, TEXTMODE_HEIGHT - 1)), 0, (TEXTMODE_WIDTH << 1)
+    );
+
+    // A text mode start address counts characters
+    setDisplayStart(console_base >> 1, false);
+
+    return offset - (TEXTMODE_WIDTH << 1);
+}
+
+
 /* Public functions */
 
 /**
@@ -82,6 +118,10 @@ void setScreen(uint8_t color) {
         color = (BG_BLACK | FG_WHITE);
     }
 
+    // Back to the top of the window
+    console_base = 0;
+    setDisplayStart(0, false);
+
     // Fill the entire screen memory
     fastWideMemorySet(
         (uint16_t *) TEXTMODE_BUFFER, // 0xB8000
@@ -109,7 +149,7 @@ void setScreen(uint8_t color) {
  * @return The new offset of the cursor in video memory.
  */
 int ttyPutChar(char character, int col, int row, uint8_t color) {
-    uint8_t *SCREEN_MEMORY = (uint8_t *) TEXTMODE_BUFFER;
+    uint8_t *SCREEN_MEMORY = getScreenMemory();
 
     if (!color) {
         color = (BG_BLACK | FG_LTGRAY);
@@ -168,18 +208,7 @@ int ttyPutChar(char character, int col, int row, uint8_t color) {
 
     /* Check if the offset is over screen size and scroll */
     if (offset >= TEXTMODE_SIZE) {
-        fastFastMemoryCopy(
-            SCREEN_MEMORY + getOffset(0, 0),
-            SCREEN_MEMORY + getOffset(0, 1),
-            TEXTMODE_WIDTH * (TEXTMODE_HEIGHT - 1) * 2
-        );
-
-        /* Blank last line */
-        fastFastMemorySet(
-            (char *)(SCREEN_MEMORY + getOffset(0, TEXTMODE_HEIGHT - 1)), 0, (TEXTMODE_WIDTH << 1)
-        );
-
-        offset -= (TEXTMODE_WIDTH << 1);
+        offset = scrollConsole(offset);
     }
 
     setCursorOffset(offset);
@@ -341,7 +370,7 @@ void ttyPrintStr(const char *string) {
  * @param string The string to print.
  */
 void ttyPrintLog(const char *string) {
-    uint8_t *SCREEN_MEMORY = (uint8_t *) TEXTMODE_BUFFER;
+    uint8_t *SCREEN_MEMORY = getScreenMemory();
     uint8_t color = (BG_BLACK | FG_LTGRAY);
 
     int offset = getCursorOffset();
@@ -386,17 +415,8 @@ void ttyPrintLog(const char *string) {
 
         if (offset >= TEXTMODE_SIZE) {
             // Scroll screen if needed
-            fastFastMemoryCopy(
-                SCREEN_MEMORY + getOffset(0, 0),
-                SCREEN_MEMORY + getOffset(0, 1),
-                TEXTMODE_WIDTH * (TEXTMODE_HEIGHT - 1) * 2
-            );
-
-            fastFastMemorySet(
-                (char *)(SCREEN_MEMORY + getOffset(0, TEXTMODE_HEIGHT - 1)), 0, (TEXTMODE_WIDTH << 1)
-            );
-
-            offset -= (TEXTMODE_WIDTH << 1);
+            offset = scrollConsole(offset);
+            SCREEN_MEMORY = getScreenMemory();
         }
     }
 
@@ -421,6 +441,7 @@ void moveCursor(uint16_t col, uint16_t row) {
     uint16_t pos = readByteFromPort(0x3D5);
     writeByteToPort(0x3D4, 0x0E);
     pos |= ((uint16_t) readByteFromPort(0x3D5)) << 8;
+    pos -= console_base >> 1;
 
     uint16_t cy = (pos / TEXTMODE_WIDTH) + row;
     uint16_t cx = (pos % TEXTMODE_WIDTH) + col;
@@ -429,7 +450,7 @@ void moveCursor(uint16_t col, uint16_t row) {
         return;
     }
 
-    uint16_t newpos = cy * TEXTMODE_WIDTH + cx;
+    uint16_t newpos = cy * TEXTMODE_WIDTH + cx + (console_base >> 1);
     writeByteToPort(0x3D4, 0x0F);
     writeByteToPort(0x3D5, (uint8_t) (newpos & 0xFF));
     writeByteToPort(0x3D4, 0x0E);
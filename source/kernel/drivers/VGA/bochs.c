@@ -0,0 +1,275 @@
+#include "bochs.h"
+#include "video.h"
+
+#include "../PCI/pci.h"
+#include "../../CPU/HAL.h"
+#include "../../memory/memory.h"
+#include "../../memory/paging.h"
+#include "../../modules/terminal.h"
+
+/*
+ * Bochs graphics adapter, what QEMU's standard VGA (-vga std) and Bochs expose next to
+ * the VGA registers. The mode is set with a few index/data port writes and the pixels
+ * live in a linear framebuffer at the PCI BAR0, so drawing is plain memory copies and
+ * fills, without the VGA planes and their registers.
+ *
+ * Our bitmaps are packed 4bpp (the VGA colors), they are expanded to 8 or 32 bpp on
+ * the way to the framebuffer with a table per byte (two pixels).
+ *
+ * @see https://wiki.osdev.org/Bochs_VBE_Extensions
+ */
+
+/** The framebuffer is mapped in 4 MB chunks, enough for the biggest mode */
+#define BGA_CHUNK_SIZE  0x400000U
+#define BGA_MAP_LIMIT   (2 * BGA_CHUNK_SIZE)
+
+static bga_device_t bga_device;
+
+/* The 16 VGA colors, as the imgbin.py palette */
+static const uint32_t bga_palette[16] = {
+    0x000000, 0x0000AA, 0x00AA00, 0x00AAAA, 0xAA0000, 0xAA00AA, 0xAA5500, 0xAAAAAA,
+    0x555555, 0x5555FF, 0x55FF55, 0x55FFFF, 0xFF5555, 0xFF55FF, 0xFFFF55, 0xFFFFFF
+};
+
+/* A packed byte (two pixels) as two 8bpp pixels, the high nibble goes first */
+static uint16_t bga_pairs[256];
+
+
+static inline void bgaWriteRegister(uint16_t index, uint16_t value) {
+    writeWordToPort(BGA_INDEX_PORT, index);
+    writeWordToPort(BGA_DATA_PORT, value);
+}
+
+
+static inline uint16_t bgaReadRegister(uint16_t index) {
+    writeWordToPort(BGA_INDEX_PORT, index);
+    return readWordFromPort(BGA_DATA_PORT);
+}
+
+
+/** Like fastWideMemorySet, with 32 bit values */
+static inline void bgaLongSet(uint32_t *dest, uint32_t value, uint32_t count) {
+    int d0, d1;
+    ASM VOLATILE (
+        "rep\n\t"
+        "stosl"
+        : "=&c"(d0), "=&D"(d1)
+        : "a"(value), "1"(dest), "0"(count)
+        : "memory"
+    );
+}
+
+
+bool initializeBGA(void) {
+    bga_device.present = false;
+    bga_device.enabled = false;
+
+    uint16_t version = bgaReadRegister(BGA_REG_ID);
+    if ((version < BGA_ID_MINIMUM) || (version > BGA_ID_MAXIMUM)) {
+        fprintf(serial, "[BGA] No Bochs graphics adapter (ID %#X)\n", version);
+        return false;
+    }
+
+    const pci_device_t *device = pciFindDevice(BGA_PCI_VENDOR, BGA_PCI_DEVICE);
+    if (!device || device->bar_io[0] || !device->bar_size[0]) {
+        fprintf(serial, "FAIL: The Bochs graphics adapter has no linear framebuffer\n");
+        return false;
+    }
+
+    pciEnableCommand(device, PCI_COMMAND_MEMORY);
+
+    bga_device.version = version;
+    bga_device.framebuffer = (uint8_t *) device->bar[0];
+    bga_device.memory = device->bar_size[0];
+
+    // The framebuffer is above the identity mapped 16 MB, map it where it is
+    uint32_t start = device->bar[0] & ~(BGA_CHUNK_SIZE - 1);
+    uint32_t end = device->bar[0] + MIN(bga_device.memory, BGA_MAP_LIMIT);
+
+    for (uint32_t chunk = start; chunk < end; chunk += BGA_CHUNK_SIZE) {
+        memoryPagingMap(chunk, chunk);
+    }
+
+    for (uint16_t i = 0; i < 256; i++) {
+        bga_pairs[i] = (i >> 4) | ((i & 0x0F) << 8);
+    }
+
+    bga_device.present = true;
+    fprintf(serial, "[BGA] Version %#X, %d KB framebuffer at %#X\n", version, bga_device.memory / 1024, device->bar[0]);
+    return true;
+}
+
+
+bool bgaSetMode(uint16_t width, uint16_t height, uint8_t bpp) {
+    if (!bga_device.present) {
+        return false;
+    }
+
+    if (!width || !height || (width > BGA_MAX_WIDTH) || (height > BGA_MAX_HEIGHT) || ((bpp != 8) && (bpp != 32))) {
+        fprintf(serial, "FAIL: Unsupported BGA mode %dx%dx%d\n", width, height, bpp);
+        return false;
+    }
+
+    uint32_t pitch = (uint32_t) width * (bpp / 8);
+    if ((pitch * height) > MIN(bga_device.memory, BGA_MAP_LIMIT)) {
+        fprintf(serial, "FAIL: The BGA mode %dx%dx%d doesn't fit in the framebuffer\n", width, height, bpp);
+        return false;
+    }
+
+    // The registers only can be changed with the adapter disabled
+    bgaWriteRegister(BGA_REG_ENABLE, BGA_DISABLED);
+    bgaWriteRegister(BGA_REG_XRES, width);
+    bgaWriteRegister(BGA_REG_YRES, height);
+    bgaWriteRegister(BGA_REG_BPP, bpp);
+    bgaWriteRegister(BGA_REG_ENABLE, BGA_ENABLED | BGA_LINEAR);
+
+    if ((bgaReadRegister(BGA_REG_XRES) != width) || (bgaReadRegister(BGA_REG_YRES) != height) || (bgaReadRegister(BGA_REG_BPP) != bpp)) {
+        fprintf(serial, "FAIL: The adapter didn't take the BGA mode %dx%dx%d\n", width, height, bpp);
+        bgaDisable();
+        return false;
+    }
+
+    // The 8bpp modes use the VGA DAC, with 6 bit components
+    if (bpp == 8) {
+        writeByteToPort(DIGANALOG_WRITE_INDEX, 0);
+        for (uint8_t i = 0; i < 16; i++) {
+            writeByteToPort(DIGANALOG_DATA, (bga_palette[i] >> 18) & 0x3F);
+            writeByteToPort(DIGANALOG_DATA, (bga_palette[i] >> 10) & 0x3F);
+            writeByteToPort(DIGANALOG_DATA, (bga_palette[i] >> 2) & 0x3F);
+        }
+    }
+
+    bga_device.enabled = true;
+    bga_device.width = width;
+    bga_device.height = height;
+    bga_device.bpp = bpp;
+    bga_device.pitch = pitch;
+
+    fprintf(serial, "[BGA] Mode set to %dx%dx%d\n", width, height, bpp);
+    return true;
+}
+
+
+void bgaDisable(void) {
+    if (bga_device.present) {
+        bgaWriteRegister(BGA_REG_ENABLE, BGA_DISABLED);
+        bga_device.enabled = false;
+    }
+}
+
+
+const bga_device_t *bgaGetDevice(void) {
+    return bga_device.present ? &bga_device : NULL;
+}
+
+
+void bgaFillRect(uint8_t color, int16_t x, int16_t y, uint16_t w, uint16_t h) {
+    if (!bga_device.enabled) {
+        return;
+    }
+
+    int32_t left = MAX(x, 0);
+    int32_t top = MAX(y, 0);
+    int32_t right = MIN((int32_t) x + w, (int32_t) bga_device.width);
+    int32_t bottom = MIN((int32_t) y + h, (int32_t) bga_device.height);
+
+    if ((left >= right) || (top >= bottom)) {
+        return;
+    }
+
+    uint32_t count = right - left;
+    uint8_t *line = bga_device.framebuffer + (top * bga_device.pitch);
+
+    for (int32_t row = top; row < bottom; row++, line += bga_device.pitch) {
+        if (bga_device.bpp == 8) {
+            fastFastMemorySet(line + left, color & 0x0F, count);
+        } else {
+            bgaLongSet((uint32_t *) line + left, bga_palette[color & 0x0F], count);
+        }
+    }
+}
+
+
+void bgaDrawBitmap(const uint8_t *pixels, uint16_t pitch, uint16_t column, int16_t x, int16_t y, uint16_t w, uint16_t h) {
+    if (!bga_device.enabled || !pixels) {
+        return;
+    }
+
+    int32_t left = MAX(x, 0);
+    int32_t top = MAX(y, 0);
+    int32_t right = MIN((int32_t) x + w, (int32_t) bga_device.width);
+    int32_t bottom = MIN((int32_t) y + h, (int32_t) bga_device.height);
+
+    if ((left >= right) || (top >= bottom)) {
+        return;
+    }
+
+    // The first bitmap column and row after the clipping
+    uint32_t first = column + (left - x);
+    const uint8_t *source = pixels + ((top - y) * pitch);
+    uint8_t *line = bga_device.framebuffer + (top * bga_device.pitch);
+
+    for (int32_t row = top; row < bottom; row++, source += pitch, line += bga_device.pitch) {
+        uint32_t position = first;
+        int32_t target = left;
+
+        // An odd first column takes the low nibble alone, then whole bytes
+        if (position & 1) {
+            uint8_t color = source[position >> 1] & 0x0F;
+            if (bga_device.bpp == 8) {
+                line[target] = color;
+            } else {
+                ((uint32_t *) line)[target] = bga_palette[color];
+            }
+            position++;
+            target++;
+        }
+
+        const uint8_t *bytes = source + (position >> 1);
+        uint32_t pairs = (right - target) >> 1;
+
+        if (bga_device.bpp == 8) {
+            uint8_t *output = line + target;
+            for (uint32_t i = 0; i < pairs; i++, output += 2) {
+                *(uint16_t *) output = bga_pairs[bytes[i]];
+            }
+        } else {
+            uint32_t *output = (uint32_t *) line + target;
+            for (uint32_t i = 0; i < pairs; i++, output += 2) {
+                output[0] = bga_palette[bytes[i] >> 4];
+                output[1] = bga_palette[bytes[i] & 0x0F];
+            }
+        }
+
+        // And the high nibble of the last byte when an odd count is left
+        target += pairs * 2;
+        if (target < right) {
+            uint8_t color = bytes[pairs] >> 4;
+            if (bga_device.bpp == 8) {
+                line[target] = color;
+            } else {
+                ((uint32_t *) line)[target] = bga_palette[color];
+            }
+        }
+    }
+}
+
+
+void bgaGetStatus(void) {
+    if (!bga_device.present) {
+        printl(FAIL, "There is no Bochs graphics adapter\n\r");
+        return;
+    }
+
+    printl(INFO, "Bochs graphics adapter:\n");
+    printf(" * %-12s %#X\n", "Version", bga_device.version);
+    printf(" * %-12s %#X (%d KB)\n", "Framebuffer", (uint32_t) bga_device.framebuffer, bga_device.memory / 1024);
+
+    if (bga_device.enabled) {
+        printf(" * %-12s %dx%dx%d, %d bytes per row\n", "Mode", bga_device.width, bga_device.height, bga_device.bpp, bga_device.pitch);
+    } else {
+        printf(" * %-12s %s\n", "Mode", "Disabled");
+    }
+
+    printf("\n");
+}
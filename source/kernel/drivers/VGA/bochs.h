@@ -0,0 +1,100 @@
+#ifndef DRIVER_BOCHS_H_
+#define DRIVER_BOCHS_H_ 1
+
+#include "../../../common/common.h"
+
+/* Bochs graphics adapter (BGA), the VBE extensions of Bochs and QEMU */
+#define BGA_INDEX_PORT          0x01CE
+#define BGA_DATA_PORT           0x01CF
+
+#define BGA_REG_ID              0x00
+#define BGA_REG_XRES            0x01
+#define BGA_REG_YRES            0x02
+#define BGA_REG_BPP             0x03
+#define BGA_REG_ENABLE          0x04
+#define BGA_REG_BANK            0x05
+#define BGA_REG_VIRT_WIDTH      0x06
+#define BGA_REG_VIRT_HEIGHT     0x07
+#define BGA_REG_X_OFFSET        0x08
+#define BGA_REG_Y_OFFSET        0x09
+
+/** Interface versions, we need the linear framebuffer (0xB0C2 and later) */
+#define BGA_ID_MINIMUM          0xB0C2
+#define BGA_ID_MAXIMUM          0xB0C5
+
+/* Enable register flags */
+#define BGA_DISABLED            0x00
+#define BGA_ENABLED             0x01
+#define BGA_LINEAR              0x40 // Use the linear framebuffer instead of the 64 KB banks
+#define BGA_NO_CLEAR            0x80 // Keep the video memory content on mode changes
+
+#define BGA_MAX_WIDTH           1600
+#define BGA_MAX_HEIGHT          1200
+
+/** The QEMU standard VGA and the Bochs VBE adapter, the framebuffer is in BAR0 */
+#define BGA_PCI_VENDOR          0x1234
+#define BGA_PCI_DEVICE          0x1111
+
+typedef struct {
+    bool present;
+    bool enabled;
+    uint16_t version;       // BGA_REG_ID value
+    uint16_t width;
+    uint16_t height;
+    uint8_t bpp;            // 8 or 32
+    uint32_t pitch;         // Bytes per row
+    uint8_t *framebuffer;   // Linear framebuffer, identity mapped
+    uint32_t memory;        // Size of the framebuffer BAR
+} bga_device_t;
+
+/**
+ * Find the adapter and map its linear framebuffer, must be called after the PCI scan.
+ *
+ * @return True if there is an usable adapter
+ */
+bool initializeBGA(void);
+
+/**
+ * Switch to a linear framebuffer mode. In 8 bpp modes the first 16 palette entries are
+ * the VGA colors, in 32 bpp modes the same colors are expanded to XRGB.
+ *
+ * @param width     Up to BGA_MAX_WIDTH
+ * @param height    Up to BGA_MAX_HEIGHT
+ * @param bpp       8 or 32
+ * @return          True if the adapter took the mode
+ */
+bool bgaSetMode(uint16_t width, uint16_t height, uint8_t bpp);
+
+/**
+ * Leave the BGA mode, the VGA registers must be programmed again afterwards.
+ */
+void bgaDisable(void);
+
+/**
+ * Get the adapter state, NULL if there is none.
+ */
+const bga_device_t *bgaGetDevice(void);
+
+/**
+ * Fill a rectangle of the framebuffer with a color, clipped to the screen.
+ *
+ * @param color     One of the PX_* colors (only the low nibble is used)
+ */
+void bgaFillRect(uint8_t color, int16_t x, int16_t y, uint16_t w, uint16_t h);
+
+/**
+ * Draw a packed 4bpp bitmap (two pixels per byte, like the BGL surfaces) on the
+ * framebuffer, clipped to the screen.
+ *
+ * @param pixels    Bitmap data
+ * @param pitch     Bytes per bitmap row
+ * @param column    First bitmap column to draw
+ */
+void bgaDrawBitmap(const uint8_t *pixels, uint16_t pitch, uint16_t column, int16_t x, int16_t y, uint16_t w, uint16_t h);
+
+/**
+ * Print the adapter information.
+ */
+void bgaGetStatus(void);
+
+#endif /* DRIVER_BOCHS_H_ */
@@ -215,6 +215,28 @@ void initializeVGA(uint8_t *registers) {
 }
 
 
+void waitRetrace(void) {
+    // If we are already in one, it's too late to use it
+    while (readByteFromPort(INPUT_STATE_READ) & INPUT_STATE_RETRACE);
+    while (!(readByteFromPort(INPUT_STATE_READ) & INPUT_STATE_RETRACE));
+}
+
+
+void setDisplayStart(uint16_t address, bool sync) {
+    if (sync) {
+        // Both halves must be written while the pixels are drawn, not between the latch
+        while (readByteFromPort(INPUT_STATE_READ) & INPUT_STATE_BLANKING);
+    }
+
+    writeRegister(CATHODERAY_INDEX, REG_CATHODERAY_START_HIGH, UPPER_BYTE(address));
+    writeRegister(CATHODERAY_INDEX, REG_CATHODERAY_START_LOW, LOWER_BYTE(address));
+
+    if (sync) {
+        while (!(readByteFromPort(INPUT_STATE_READ) & INPUT_STATE_RETRACE));
+    }
+}
+
+
 enum video_type getVideoType(void) {
     return (enum video_type) (getBDA() & 0x30);
 }
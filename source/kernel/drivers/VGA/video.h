@@ -15,6 +15,14 @@
 #define GRAPHMODE_HEIGHT  (uint16_t) 480
 #define GRAPHMODE_SIZE    (uint32_t) (GRAPHMODE_WIDTH * GRAPHMODE_HEIGHT)
 
+/* The paged mode is small enough to keep a few screens in each 64 KB plane */
+#define PAGEDMODE_WIDTH   (uint16_t) 320
+#define PAGEDMODE_HEIGHT  (uint16_t) 240
+#define PAGEDMODE_PAGE    (uint16_t) ((PAGEDMODE_WIDTH >> 3) * PAGEDMODE_HEIGHT) // Bytes per plane
+
+/* The text mode memory window (0xB8000 to 0xBFFFF), the console scrolls inside it */
+#define TEXTMODE_WINDOW   (uint16_t) 0x8000
+
 /* VGA registers */
 
 #define ATTRIBUTE_INDEX             0x3C0
@@ -42,13 +50,22 @@
 #define NUM_GRAPHICS_REGS           9
 #define NUM_ATTRIBUTE_REGS          21
 
+#define REG_CATHODERAY_START_HIGH   0x0C
+#define REG_CATHODERAY_START_LOW    0x0D
+
+#define INPUT_STATE_BLANKING        0x01 // Not showing pixels (horizontal or vertical blanking)
+#define INPUT_STATE_RETRACE         0x08 // Vertical retrace
+
 #define REG_SEQUENCER_MASK          0x02
 #define REG_SEQUENCER_CHARSET       0x03
 #define REG_SEQUENCER_MEMORY        0x04
 
+#define REG_GRAPHICS_SET_RESET      0x00
+#define REG_GRAPHICS_ENABLE_RESET   0x01
 #define REG_GRAPHICS_MAP_READ       0x04
 #define GRAPHICS_GRAPHICS_MODE      0x05
 #define GRAPHICS_MISCELLANEOUS      0x06
+#define REG_GRAPHICS_BIT_MASK       0x08
 
 
 enum video_type {
@@ -85,6 +102,38 @@ uint8_t video_mode[62] = {
 };
 
 
+/**
+ * @brief Planar video mode registers, 320x240, 16 colors
+ *
+ * The 640x480 timings with the dot clock halved and every line shown twice, so a
+ * screen takes 9600 bytes per plane and six of them fit for page flipping.
+ */
+uint8_t paged_mode[62] = {
+    /* Miscellaneous Register */
+    0xE3,
+
+    /* Sequencer Registers */
+    0x03, 0x09, 0x0F, 0x00, 0x06,
+
+    /* CRTC */
+    0x2D, 0x27, 0x28, 0x90, 0x2B, 0x80, 0x0B, 0x3E,
+    0x00, 0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0xEA, 0x8C, 0xDF, 0x14, 0x00, 0xE7, 0x04, 0xE3,
+    0xFF,
+
+    /* Graphics Controller Registers */
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x05, 0x0F,
+    0xFF,
+
+    /* Attribute Controller Registers */
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x14, 0x07,
+    0x38, 0x39, 0x3A, 0x3B, 0x3C, 0x3D, 0x3E, 0x3F,
+    0x01, 0x00, 0x0F, 0x00, 0x00,
+
+    true // Its an pixel-based grapic mode!
+};
+
+
 /** @brief Linear text mode registers, 90x60, 16 colors (8x8 characters)*/
 uint8_t text_mode[62] = {
     /* Miscellaneous Register */
@@ -408,6 +457,22 @@ uint8_t small_font[256 * 8] = {
 
 void initializeVGA(uint8_t *registers);
 
+/**
+ * Wait for the start of the next vertical retrace.
+ */
+void waitRetrace(void);
+
+/**
+ * Set the VGA memory address where the screen starts (in bytes per plane in the
+ * planar modes, in characters in the text mode). Used for page flipping and for
+ * hardware scrolling.
+ *
+ * @param address   The new start address
+ * @param sync      Wait until the address is in use (it is latched at the start of
+ *                  the vertical retrace), so the old page can be drawn again
+ */
+void setDisplayStart(uint16_t address, bool sync);
+
 enum video_type getVideoType(void);
 
 #endif /* DRIVER_VGA_H_ */
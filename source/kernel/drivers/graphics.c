@@ -16,12 +16,124 @@
  * it more than I could. Haha :D
 */
 
-// TODO: Optimize image drawing functions, we can enable all the planes at same time!!
-
-// TODO: Add more functions to handle shapes and figures, such as triangles, hexagons,
+// TODO: Add more functions to handle shapes and figures, such as hexagons,
 // lines with a specific thickness, etc :)
 
 
+/*
+ * Everything is drawn into a shadow framebuffer in system RAM, packed 4bpp like the
+ * bitmaps (two pixels per byte, the left one in the high nibble), and presentScreen()
+ * uploads what changed. Changes are tracked in tiles of 8x8 pixels, one VRAM byte wide,
+ * and the dirty tiles are merged in rectangles which are converted to planar format
+ * once and then copied plane by plane, so there is one plane select per plane per
+ * rectangle instead of a few port writes per pixel.
+ *
+ * Solid fills and screen to screen copies also go to the VGA memory right away for
+ * the tiles they cover in full, with set/reset (one write colors 8 pixels in all the
+ * planes) and write mode 1 (one read and one write move 8 pixels through the latches).
+ */
+
+#define SHADOW_PITCH    (GRAPHMODE_WIDTH >> 1)
+#define SHADOW_SIZE     (SHADOW_PITCH * GRAPHMODE_HEIGHT)
+
+#define TILE_SIZE       8
+#define TILE_COLUMNS    (GRAPHMODE_WIDTH / TILE_SIZE)
+#define TILE_ROWS       (GRAPHMODE_HEIGHT / TILE_SIZE)
+
+static uint8_t *shadow_buffer = NULL;
+static uint8_t *planar_buffer = NULL; // The four planes of the rectangle being presented
+static bool shadow_failed = false;    // No memory for them, so we don't try on every call
+
+static uint8_t dirty_tiles[TILE_ROWS][TILE_COLUMNS];
+
+/* Two packed pixels spread over the planes, the 2 bits of plane N are in byte N */
+static uint32_t planar_table[256];
+
+/* A plane byte spread over four packed bytes, bit 0 of each of the 8 pixels */
+static uint32_t packed_table[256];
+
+
+static inline void writeGraphicsRegister(uint8_t index, uint8_t value) {
+    writeByteToPort(GRAPHICS_INDEX, index);
+    writeByteToPort(GRAPHICS_DATA, value);
+}
+
+
+/** Get the shadow framebuffer, allocated on first use */
+static uint8_t *getShadowBuffer(void) {
+    if (shadow_buffer || shadow_failed) {
+        return shadow_buffer;
+    }
+
+    uint8_t *shadow = (uint8_t *) memoryAllocateBlock(SHADOW_SIZE);
+    planar_buffer = (uint8_t *) memoryAllocateBlock(SHADOW_SIZE);
+
+    // One without the other is useless, give back the one we got
+    if (!shadow || !planar_buffer) {
+        if (shadow) memoryFreeBlock(shadow);
+        if (planar_buffer) memoryFreeBlock(planar_buffer);
+
+        planar_buffer = NULL;
+        shadow_failed = true;
+        return NULL;
+    }
+
+    for (uint16_t value = 0; value < 256; value++) {
+        uint32_t bits = 0;
+
+        for (uint8_t plane = 0; plane < 4; plane++) {
+            uint8_t left = (value >> (4 + plane)) & 1;
+            uint8_t right = (value >> plane) & 1;
+            bits |= (uint32_t) ((left << 1) | right) << (plane * 8);
+        }
+
+        planar_table[value] = bits;
+
+        // Pixel N of the plane byte is bit (7 - N), and its nibble is the high one when N is even
+        bits = 0;
+        for (uint8_t pixel = 0; pixel < 8; pixel++) {
+            if (value & (0x80 >> pixel)) {
+                bits |= 1U << (((pixel >> 1) * 8) + ((pixel & 1) ? 0 : 4));
+            }
+        }
+
+        packed_table[value] = bits;
+    }
+
+    // Black, like the VRAM after initializeVGA()
+    fastFastMemorySet(shadow, 0x00, SHADOW_SIZE);
+    fastFastMemorySet(dirty_tiles, 0, sizeof(dirty_tiles));
+
+    shadow_buffer = shadow;
+    return shadow_buffer;
+}
+
+
+void markScreenDirty(int16_t x, int16_t y, uint16_t w, uint16_t h) {
+    int16_t right = MIN(x + (int16_t) w, (int16_t) GRAPHMODE_WIDTH);
+    int16_t bottom = MIN(y + (int16_t) h, (int16_t) GRAPHMODE_HEIGHT);
+
+    x = MAX(x, 0);
+    y = MAX(y, 0);
+
+    if ((x >= right) || (y >= bottom)) {
+        return;
+    }
+
+    for (int16_t row = y / TILE_SIZE; row <= (bottom - 1) / TILE_SIZE; row++) {
+        fastFastMemorySet(&dirty_tiles[row][x / TILE_SIZE], 1, ((right - 1) / TILE_SIZE) - (x / TILE_SIZE) + 1);
+    }
+}
+
+
+/** The VGA memory is up to date on an area, clear the tiles it covers in full */
+static void markScreenClean(uint16_t x, uint16_t y, uint16_t columns, uint16_t h) {
+    for (uint16_t row = (y + TILE_SIZE - 1) / TILE_SIZE; row < (y + h) / TILE_SIZE; row++) {
+        fastFastMemorySet(&dirty_tiles[row][x / TILE_SIZE], 0, columns);
+    }
+}
+
+
 /**
  * Sets the color of a single pixel on the screen
  *
@@ -32,31 +144,20 @@
 inline void plotPixel(uint8_t color, uint16_t x, uint16_t y) {
     if (x >= GRAPHMODE_WIDTH || y >= GRAPHMODE_HEIGHT) return;
 
-    // Pointer to the start of the screen memory buffer
-    uint8_t *SCREEN_MEMORY = GRAPHMODE_BUFFER;
+    uint8_t *shadow = getShadowBuffer();
+    if (!shadow) return;
 
-    // Calculate the memory offset based on the pixel coordinates
-    // Each byte represents 8 pixels, so we need to adjust for this
-    SCREEN_MEMORY += (y * GRAPHMODE_WIDTH + x) >> 3;
+    // Each byte holds two pixels, the even one in the high nibble
+    uint8_t *pixel = shadow + (y * SHADOW_PITCH) + (x >> 1);
+    color &= 0x0F;
 
-    // Create a mask to isolate the specific bit for the pixel
-    // 0x80 corresponds to the most significant bit of a byte,
-    // shifting it right by (x & 0x7) or (x % 8) positions to align with the pixel position
-    uint8_t mask = (0x80 >> (x & 0x7));
-
-    writeByteToPort(SEQUENCER_INDEX, REG_SEQUENCER_MASK);
-	writeByteToPort(GRAPHICS_INDEX, 0x08);
-	writeByteToPort(GRAPHICS_DATA, mask); // We select only specifics bits
-	writeByteToPort(SEQUENCER_DATA, 0x0F); // Enable all planes for drawing
-
-    // Clear the current pixel bit by masking out the bit
-	*SCREEN_MEMORY &= ~mask;
-
-    // Write the color value to the selected pixel bit
-	writeByteToPort(SEQUENCER_DATA, color);
+    if (x & 1) {
+        *pixel = (*pixel & 0xF0) | color;
+    } else {
+        *pixel = (*pixel & 0x0F) | (color << 4);
+    }
 
-    // Set the pixel bit to the new color by OR-ing the mask
-	*SCREEN_MEMORY |= mask;
+    dirty_tiles[y >> 3][x >> 3] = 1;
 }
 
 
@@ -75,66 +176,190 @@ uint8_t readPixel(uint16_t x, uint16_t y) {
         return 0;
     }
 
-    // Pointer to the start of the screen memory buffer
-    uint8_t *SCREEN_MEMORY = GRAPHMODE_BUFFER;
+    uint8_t *shadow = getShadowBuffer();
+    if (!shadow) return 0;
 
-    // Calculate the memory offset based on the pixel coordinates
-    // Each byte represents 8 pixels, so we need to adjust for this
-    SCREEN_MEMORY += (y * GRAPHMODE_WIDTH + x) >> 3;
+    // The shadow always has what the screen will show, no need to read the planes
+    uint8_t packed = shadow[(y * SHADOW_PITCH) + (x >> 1)];
+    return (x & 1) ? (packed & 0x0F) : (packed >> 4);
+}
 
-    uint8_t color = 0x00;
 
-    // Mask to isolate the bit corresponding to the pixel
-	uint8_t mask = 0x80 >> (x & 0x7);
+/**
+ * Fills the entire screen with a specified color
+ *
+ * @param color The color to fill the screen with
+ */
+void fillScreen(uint8_t color) {
+    fillRect(color, 0, 0, GRAPHMODE_WIDTH, GRAPHMODE_HEIGHT);
+}
 
-	writeByteToPort(GRAPHICS_INDEX, REG_GRAPHICS_MAP_READ);
 
-    // Loop through the four planes
-    for (uint8_t i = 0; i < 4; ++i) {
-        writeByteToPort(GRAPHICS_DATA, i);
+/** Fill a span of a shadow row, the odd pixels at the ends take half a byte */
+static void fillShadowSpan(uint8_t color, uint16_t x, uint16_t y, uint16_t length) {
+    uint8_t *pixel = shadow_buffer + (y * SHADOW_PITCH) + (x >> 1);
 
-        // Check if the bit corresponding to the pixel
-        // is set and update the color value
-        if (*SCREEN_MEMORY & mask) {
-            color |= (1 << i);
-        }
+    if (x & 1) {
+        *pixel = (*pixel & 0xF0) | color;
+        pixel++;
+        length--;
     }
 
-	return color;
+    fastFastMemorySet(pixel, (color << 4) | color, length >> 1);
+
+    if (length & 1) {
+        pixel += length >> 1;
+        *pixel = (*pixel & 0x0F) | (color << 4);
+    }
+}
+
+
+void fillSpan(uint8_t color, int16_t x, int16_t y, uint16_t length) {
+    if (!getShadowBuffer() || (y < 0) || (y >= (int16_t) GRAPHMODE_HEIGHT)) return;
+
+    int16_t right = MIN(x + (int16_t) length, (int16_t) GRAPHMODE_WIDTH);
+    x = MAX(x, 0);
+
+    if (x >= right) return;
+
+    fillShadowSpan(color & 0x0F, x, y, right - x);
+    markScreenDirty(x, y, right - x, 1);
 }
 
 
 /**
- * Fills the entire screen with a specified color
- *
- * @param color The color to fill the screen with
+ * Fill whole tiles in the VGA memory, the shadow must already have them in the color.
+ * With set/reset enabled on all the planes, whatever the CPU writes becomes the color.
  */
-void fillScreen(uint8_t color) {
-    uint32_t SCREEN_SIZE = GRAPHMODE_SIZE >> 3;
+static void fillTiles(uint8_t color, uint16_t first, uint16_t last, uint16_t top, uint16_t end) {
+    writeGraphicsRegister(REG_GRAPHICS_BIT_MASK, 0xFF);
+    writeGraphicsRegister(REG_GRAPHICS_SET_RESET, color);
+    writeGraphicsRegister(REG_GRAPHICS_ENABLE_RESET, 0x0F);
+    writeByteToPort(SEQUENCER_INDEX, REG_SEQUENCER_MASK);
+    writeByteToPort(SEQUENCER_DATA, 0x0F);
+
+    uint8_t *destination = GRAPHMODE_BUFFER + (top * TILE_SIZE * (GRAPHMODE_WIDTH >> 3)) + first;
+    for (uint16_t row = top * TILE_SIZE; row < end * TILE_SIZE; row++) {
+        fastFastMemorySet(destination, 0xFF, last - first);
+        destination += GRAPHMODE_WIDTH >> 3;
+    }
+
+    writeGraphicsRegister(REG_GRAPHICS_ENABLE_RESET, 0x00);
+
+    markScreenClean(first * TILE_SIZE, top * TILE_SIZE, last - first, (end - top) * TILE_SIZE);
+}
+
+
+void fillRect(uint8_t color, int16_t x, int16_t y, uint16_t w, uint16_t h) {
+    if (!getShadowBuffer()) return;
+
+    int16_t right = MIN(x + (int16_t) w, (int16_t) GRAPHMODE_WIDTH);
+    int16_t bottom = MIN(y + (int16_t) h, (int16_t) GRAPHMODE_HEIGHT);
+
+    x = MAX(x, 0);
+    y = MAX(y, 0);
+
+    if ((x >= right) || (y >= bottom)) return;
+
+    color &= 0x0F;
+    for (int16_t row = y; row < bottom; row++) {
+        fillShadowSpan(color, x, row, right - x);
+    }
+
+    markScreenDirty(x, y, right - x, bottom - y);
+
+    // The tiles covered in full are filled in the VGA memory right away
+    uint16_t first = (x + TILE_SIZE - 1) / TILE_SIZE, last = right / TILE_SIZE;
+    uint16_t top = (y + TILE_SIZE - 1) / TILE_SIZE, end = bottom / TILE_SIZE;
+
+    if ((first < last) && (top < end)) {
+        fillTiles(color, first, last, top, end);
+    }
+}
+
+
+void copyRect(uint16_t sx, uint16_t sy, uint16_t dx, uint16_t dy, uint16_t w, uint16_t h) {
+    uint8_t *shadow = getShadowBuffer();
+    if (!shadow || (sx >= GRAPHMODE_WIDTH) || (sy >= GRAPHMODE_HEIGHT) || (dx >= GRAPHMODE_WIDTH) || (dy >= GRAPHMODE_HEIGHT)) return;
+
+    // Both rectangles have to be inside the screen
+    w = MIN(w, (uint16_t) (GRAPHMODE_WIDTH - MAX(sx, dx)));
+    h = MIN(h, (uint16_t) (GRAPHMODE_HEIGHT - MAX(sy, dy)));
+
+    if (!w || !h) return;
 
+    // Going up copies from the top row, going down from the bottom one, so overlaps work
+    int16_t step = (dy > sy) ? -1 : 1;
+    uint16_t first = (dy > sy) ? (h - 1) : 0;
+
+    if ((sx & 7) || (dx & 7) || (w & 7)) {
+        bool backwards = (dy == sy) && (dx > sx);
+
+        for (uint16_t i = 0, row = first; i < h; i++, row += step) {
+            for (uint16_t j = 0; j < w; j++) {
+                uint16_t column = backwards ? (w - 1 - j) : j;
+                plotPixel(readPixel(sx + column, sy + row), dx + column, dy + row);
+            }
+        }
+        return;
+    }
+
+    // The source has to be on the screen before it can go through the latches
+    presentScreen();
+
+    uint16_t columns = w >> 3;
+
+    writeGraphicsRegister(REG_GRAPHICS_BIT_MASK, 0xFF);
+    writeGraphicsRegister(GRAPHICS_GRAPHICS_MODE, 0x01);
     writeByteToPort(SEQUENCER_INDEX, REG_SEQUENCER_MASK);
-	writeByteToPort(GRAPHICS_INDEX, 0x08);
-	writeByteToPort(GRAPHICS_DATA, 0xFF); // We select all the bits
-	writeByteToPort(SEQUENCER_DATA, 0x0F); // Enable all the planes
+    writeByteToPort(SEQUENCER_DATA, 0x0F);
 
-    /*
-    * NOTE: This is really fast, but for some reason, calling memset
-    *       twice makes me think this is still not perfect.
-    */
+    for (uint16_t i = 0, row = first; i < h; i++, row += step) {
+        // Byte by byte, a wider read would only leave its last byte in the latches
+        volatile uint8_t *source = GRAPHMODE_BUFFER + ((sy + row) * (GRAPHMODE_WIDTH >> 3)) + (sx >> 3);
+        volatile uint8_t *destination = GRAPHMODE_BUFFER + ((dy + row) * (GRAPHMODE_WIDTH >> 3)) + (dx >> 3);
 
-    // Clear the screen buffer to prepare for filling
-    fastFastMemorySet(GRAPHMODE_BUFFER, 0x00, SCREEN_SIZE);
+        if (destination > source) {
+            for (int16_t j = columns - 1; j >= 0; j--) {
+                destination[j] = source[j];
+            }
+        } else {
+            for (uint16_t j = 0; j < columns; j++) {
+                destination[j] = source[j];
+            }
+        }
 
-    // Write the color value to all pixels in the buffer
-    writeByteToPort(SEQUENCER_DATA, color);
+        memoryMove(
+            shadow + ((dy + row) * SHADOW_PITCH) + (dx >> 1),
+            shadow + ((sy + row) * SHADOW_PITCH) + (sx >> 1),
+            w >> 1
+        );
+    }
 
-    // Fill the screen buffer with the color
-    fastFastMemorySet(GRAPHMODE_BUFFER, 0xFF, SCREEN_SIZE);
+    writeGraphicsRegister(GRAPHICS_GRAPHICS_MODE, 0x00);
+}
+
+
+void scrollScreen(int16_t lines, uint8_t color) {
+    uint16_t distance = (uint16_t) ABS(lines);
+
+    if (distance >= GRAPHMODE_HEIGHT) {
+        fillScreen(color);
+        return;
+    }
+
+    if (lines > 0) {
+        copyRect(0, distance, 0, 0, GRAPHMODE_WIDTH, GRAPHMODE_HEIGHT - distance);
+        fillRect(color, 0, GRAPHMODE_HEIGHT - distance, GRAPHMODE_WIDTH, distance);
+    } else if (lines < 0) {
+        copyRect(0, 0, 0, distance, GRAPHMODE_WIDTH, GRAPHMODE_HEIGHT - distance);
+        fillRect(color, 0, 0, GRAPHMODE_WIDTH, distance);
+    }
 }
 
 
 /**
- * @brief Draws a bitmap on the screen plane by plane
+ * @brief Draws a bitmap on the screen
  *
  * @param pixels    Pointer to the bitmap pixel data
  * @param x         X coordinate of the top left corner of the bitmap
@@ -142,172 +367,475 @@ void fillScreen(uint8_t color) {
  * @param w         Width of the bitmap in pixels
  * @param h         Height of the bitmap in pixels
  *
- * @deprecated This is slow, we should use the fast double-bufferd version.
- *             Only use this if you dont want allocate memory for an buffer
+ * @deprecated Kept for compatibility, it's the same as drawBitmapFast() now.
  */
 void drawBitmap(uint8_t *pixels, uint16_t x, uint16_t y, uint16_t w, uint16_t h) {
-    // Pointer to the start of the screen memory
-    uint8_t *SCREEN_MEMORY = GRAPHMODE_BUFFER;
+    drawBitmapFast(pixels, x, y, w, h);
+}
 
-    // Calculate the starting offset into the screen memory for the pixel
-    SCREEN_MEMORY += (y * GRAPHMODE_WIDTH + x) >> 3;
 
-    // In a packed 4bpp image, each row uses (w + 1) / 2 bytes.
+/**
+ * @brief Draws a bitmap on the screen (fast version)
+ *
+ * @note The bitmap has the same packed format as the shadow framebuffer, so each
+ *       row is a plain copy when it starts on an even column.
+ *
+ * @param pixels    Pointer to the bitmap pixel data
+ * @param x         X coordinate of the top left corner of the bitmap
+ * @param y         Y coordinate of the top left corner of the bitmap
+ * @param w         Width of the bitmap in pixels
+ * @param h         Height of the bitmap in pixels
+ */
+void drawBitmapFast(uint8_t *pixels, uint16_t x, uint16_t y, uint16_t w, uint16_t h) {
+    uint8_t *shadow = getShadowBuffer();
+    if (!shadow || !pixels || (x >= GRAPHMODE_WIDTH) || (y >= GRAPHMODE_HEIGHT)) return;
+
+    // In a packed 4bpp image, each row uses (w + 1) / 2 bytes
     uint32_t row_bytes = (w + 1) >> 1;
 
-    // Loop over each color plane (from 0 to 3)
-    for (uint8_t plane = 0; plane < 4; plane++) {
-        // Select the current plane
-        writeByteToPort(GRAPHICS_INDEX, REG_GRAPHICS_MAP_READ);
-        writeByteToPort(GRAPHICS_DATA, plane);
+    // Only the part inside the screen is drawn
+    uint16_t width = MIN(w, (uint16_t) (GRAPHMODE_WIDTH - x));
+    uint16_t height = MIN(h, (uint16_t) (GRAPHMODE_HEIGHT - y));
 
-        // Set write plane
-        writeByteToPort(SEQUENCER_INDEX, REG_SEQUENCER_MASK);
-        writeByteToPort(SEQUENCER_DATA, 1 << plane);
+    for (uint16_t row = 0; row < height; row++) {
+        const uint8_t *source = pixels + (row * row_bytes);
+        uint8_t *destination = shadow + ((y + row) * SHADOW_PITCH) + (x >> 1);
+
+        if (!(x & 1)) {
+            fastFastMemoryCopy(destination, source, width >> 1);
+
+            // The last pixel of an odd width only takes half a byte
+            if (width & 1) {
+                destination[width >> 1] = (destination[width >> 1] & 0x0F) | (source[width >> 1] & 0xF0);
+            }
+        } else {
+            // Every pixel moves half a byte to the right
+            for (uint16_t column = 0; column < width; column++) {
+                uint8_t packed = source[column >> 1];
+                uint8_t color = (column & 1) ? (packed & 0x0F) : (packed >> 4);
+                uint8_t *pixel = destination + ((column + 1) >> 1);
 
-        // Loop over each row of the bitmap
-        for (uint32_t row = 0; row < h; row++) {
-            // Compute the offset into the packed bitmap for this row
-            uint32_t row_offset = row * row_bytes;
-            // Calculate pointer to the corresponding screen row
-            uint8_t *screen_row = SCREEN_MEMORY + ((row * GRAPHMODE_WIDTH) >> 3);
-            uint8_t current_byte = 0;
-            uint8_t bit_count = 0;
-
-            // Process each pixel in the row
-            for (uint32_t col = 0; col < w; col++) {
-                // Each byte holds two pixels.
-                uint32_t byte_index = row_offset + (col >> 1);
-                uint8_t packed = pixels[byte_index];
-                uint8_t color;
-
-                if ((col & 1) == 0) {
-                    // For even columns, extract the high nibble.
-                    color = packed >> 4;
+                if (column & 1) {
+                    *pixel = (*pixel & 0x0F) | (color << 4);
                 } else {
-                    // For odd columns, extract the low nibble.
-                    color = packed & 0x0F;
+                    *pixel = (*pixel & 0xF0) | color;
                 }
+            }
+        }
+    }
 
-                // Extract the bit for the current plane from the color
-                uint8_t bit = (color >> plane) & 0x01;
+    markScreenDirty(x, y, width, height);
+}
 
-                // Pack bits into a byte for the planar memory
-                current_byte = (current_byte << 1) | bit;
-                bit_count++;
 
-                // When we have a full byte (8 bits), write it to screen memory.
-                if (bit_count == 8) {
-                    screen_row[col >> 3] = current_byte;
-                    current_byte = 0;
-                    bit_count = 0;
-                }
+void drawPlanarBitmap(const uint8_t *image, uint16_t x, uint16_t y) {
+    const planar_header_t *header = (const planar_header_t *) image;
+    uint8_t *shadow = getShadowBuffer();
+
+    if (!shadow || !image || (memoryCompare(header->magic, PLANAR_MAGIC, 4) != 0)) return;
+    if ((x >= GRAPHMODE_WIDTH) || (y >= GRAPHMODE_HEIGHT)) return;
+
+    uint16_t row_bytes = (header->width + 7) >> 3;
+    uint32_t plane_size = row_bytes * header->height;
+
+    const uint8_t *planes[4] = {
+        image + sizeof(planar_header_t),
+        image + sizeof(planar_header_t) + plane_size,
+        image + sizeof(planar_header_t) + (plane_size * 2),
+        image + sizeof(planar_header_t) + (plane_size * 3)
+    };
+
+    uint16_t width = MIN(header->width, (uint16_t) (GRAPHMODE_WIDTH - x));
+    uint16_t height = MIN(header->height, (uint16_t) (GRAPHMODE_HEIGHT - y));
+
+    // Not on a VGA byte, each pixel goes through the shadow
+    if ((x & 7) || (width & 7)) {
+        for (uint16_t row = 0; row < height; row++) {
+            for (uint16_t column = 0; column < width; column++) {
+                uint32_t offset = (row * row_bytes) + (column >> 3);
+                uint8_t bit = 7 - (column & 7);
+
+                plotPixel(
+                    ((planes[0][offset] >> bit) & 1) | (((planes[1][offset] >> bit) & 1) << 1) |
+                    (((planes[2][offset] >> bit) & 1) << 2) | (((planes[3][offset] >> bit) & 1) << 3),
+                    x + column, y + row
+                );
+            }
+        }
+        return;
+    }
+
+    uint16_t columns = width >> 3;
+
+    writeGraphicsRegister(REG_GRAPHICS_BIT_MASK, 0xFF);
+    writeByteToPort(SEQUENCER_INDEX, REG_SEQUENCER_MASK);
+
+    for (uint8_t plane = 0; plane < 4; plane++) {
+        writeByteToPort(SEQUENCER_DATA, 1 << plane);
+
+        uint8_t *destination = GRAPHMODE_BUFFER + (y * (GRAPHMODE_WIDTH >> 3)) + (x >> 3);
+        const uint8_t *source = planes[plane];
+
+        for (uint16_t row = 0; row < height; row++) {
+            fastFastMemoryCopy(destination, source, columns);
+            destination += GRAPHMODE_WIDTH >> 3;
+            source += row_bytes;
+        }
+    }
+
+    // The shadow has to match the screen, four table lookups for eight pixels
+    for (uint16_t row = 0; row < height; row++) {
+        uint32_t *destination = (uint32_t *) (shadow + ((y + row) * SHADOW_PITCH) + (x >> 1));
+        uint32_t offset = row * row_bytes;
+
+        for (uint16_t i = 0; i < columns; i++, offset++) {
+            destination[i] = packed_table[planes[0][offset]] | (packed_table[planes[1][offset]] << 1)
+                           | (packed_table[planes[2][offset]] << 2) | (packed_table[planes[3][offset]] << 3);
+        }
+    }
+
+    markScreenClean(x, y, columns, height);
+}
+
+
+/** Unpack a PackBits row, returns the bytes used or 0 if the data is corrupted */
+static uint32_t unpackRow(const uint8_t *source, uint32_t available, uint8_t *row, uint16_t length) {
+    uint32_t used = 0;
+    uint16_t done = 0;
+
+    while (done < length) {
+        if (used >= available) {
+            return 0;
+        }
+
+        int8_t control = (int8_t) source[used++];
+
+        if (control >= 0) {
+            uint16_t count = control + 1;
+            if (((done + count) > length) || ((used + count) > available)) {
+                return 0;
             }
 
-            // Write any remaining bits (if the row width is not a multiple of 8)
-            if (bit_count > 0) {
-                current_byte <<= (8 - bit_count);
-                screen_row[w >> 3] = current_byte;
+            memoryCopy(row + done, source + used, count);
+            used += count;
+            done += count;
+
+        } else if (control != -128) {
+            uint16_t count = 1 - control;
+            if (((done + count) > length) || (used >= available)) {
+                return 0;
             }
+
+            fastFastMemorySet(row + done, source[used++], count);
+            done += count;
         }
     }
+
+    return used;
+}
+
+
+void drawCompressedBitmap(const uint8_t *image, uint16_t x, uint16_t y) {
+    const compressed_header_t *header = (const compressed_header_t *) image;
+    uint8_t *shadow = getShadowBuffer();
+
+    if (!shadow || !image || (memoryCompare(header->magic, COMPRESSED_MAGIC, 4) != 0)) return;
+    if ((x >= GRAPHMODE_WIDTH) || (y >= GRAPHMODE_HEIGHT) || (header->width > GRAPHMODE_WIDTH)) return;
+
+    const uint8_t *source = image + sizeof(compressed_header_t);
+    uint32_t available = header->size;
+
+    uint16_t row_bytes = (header->width + 7) >> 3;
+    uint16_t width = MIN(header->width, (uint16_t) (GRAPHMODE_WIDTH - x));
+    uint16_t height = MIN(header->height, (uint16_t) (GRAPHMODE_HEIGHT - y));
+    uint16_t columns = width >> 3;
+
+    bool direct = !(x & 7) && !(width & 7);
+    uint8_t row[GRAPHMODE_WIDTH >> 3];
+
+    if (direct) {
+        writeGraphicsRegister(REG_GRAPHICS_BIT_MASK, 0xFF);
+        writeByteToPort(SEQUENCER_INDEX, REG_SEQUENCER_MASK);
+    }
+
+    for (uint8_t plane = 0; plane < 4; plane++) {
+        uint8_t *destination = GRAPHMODE_BUFFER + (y * (GRAPHMODE_WIDTH >> 3)) + (x >> 3);
+
+        if (direct) {
+            writeByteToPort(SEQUENCER_DATA, 1 << plane);
+        }
+
+        // Every row has to be unpacked to get to the next one, even the ones off screen
+        for (uint16_t line = 0; line < header->height; line++) {
+            uint32_t used = unpackRow(source, available, row, row_bytes);
+
+            if (!used) {
+                markScreenDirty(x, y, width, height);
+                return;
+            }
+
+            source += used;
+            available -= used;
+
+            if (line >= height) {
+                continue;
+            }
+
+            uint8_t *pixels = shadow + ((y + line) * SHADOW_PITCH) + (x >> 1);
+
+            if (direct) {
+                fastFastMemoryCopy(destination, row, columns);
+                destination += GRAPHMODE_WIDTH >> 3;
+
+                // The first plane sets the eight pixels of each byte, the others add their bit
+                uint32_t *packed = (uint32_t *) pixels;
+                for (uint16_t i = 0; i < columns; i++) {
+                    if (plane == 0) {
+                        packed[i] = packed_table[row[i]];
+                    } else {
+                        packed[i] |= packed_table[row[i]] << plane;
+                    }
+                }
+            } else {
+                for (uint16_t column = 0; column < width; column++) {
+                    uint8_t bit = (row[column >> 3] >> (7 - (column & 7))) & 1;
+                    uint8_t *pixel = pixels + (((x & 1) + column) >> 1);
+                    uint8_t shift = ((x + column) & 1) ? plane : (plane + 4);
+                    uint8_t keep = (plane == 0) ? (((x + column) & 1) ? 0xF0 : 0x0F) : 0xFF;
+
+                    *pixel = (*pixel & keep) | (bit << shift);
+                }
+            }
+        }
+    }
+
+    if (direct) {
+        markScreenClean(x, y, columns, height);
+    } else {
+        markScreenDirty(x, y, width, height);
+    }
+}
+
+
+/** Eight pixels (four packed bytes) make one byte of each plane */
+static inline void toPlanar(const uint8_t *source, uint8_t **planes, uint32_t index) {
+    uint32_t bits = (planar_table[source[0]] << 6) | (planar_table[source[1]] << 4)
+                  | (planar_table[source[2]] << 2) | planar_table[source[3]];
+
+    planes[0][index] = (uint8_t) bits;
+    planes[1][index] = (uint8_t) (bits >> 8);
+    planes[2][index] = (uint8_t) (bits >> 16);
+    planes[3][index] = (uint8_t) (bits >> 24);
 }
 
 
 /**
- * @brief Draws a bitmap on the screen (fast version)
- *
- * @note Uses double-buffering to copy the bitmap completely in each plane, it means that also uses memory allocation!
- *
- * @param pixels    Pointer to the bitmap pixel data
- * @param x         X coordinate of the top left corner of the bitmap
- * @param y         Y coordinate of the top left corner of the bitmap
- * @param w         Width of the bitmap in pixels
- * @param h         Height of the bitmap in pixels
+ * Convert a rectangle of tiles to planar format and upload it, plane by plane.
  */
-void drawBitmapFast(uint8_t *pixels, uint16_t x, uint16_t y, uint16_t w, uint16_t h) {
-    // Pointer to the start of the screen memory.
-    uint8_t *SCREEN_MEMORY = GRAPHMODE_BUFFER;
+static void presentRegion(uint16_t column, uint16_t y, uint16_t columns, uint16_t rows) {
+    uint32_t plane_size = columns * rows;
+    uint8_t *planes[4] = {
+        planar_buffer, planar_buffer + plane_size, planar_buffer + (plane_size * 2), planar_buffer + (plane_size * 3)
+    };
+
+    uint32_t index = 0;
+    for (uint16_t row = 0; row < rows; row++) {
+        const uint8_t *source = shadow_buffer + ((y + row) * SHADOW_PITCH) + (column * (TILE_SIZE >> 1));
+
+        for (uint16_t i = 0; i < columns; i++) {
+            toPlanar(source, planes, index++);
+            source += 4;
+        }
+    }
 
-    // Allocate a temporary buffer to store the bitmap in planar format (1 bit per pixel per plane).
-    // The size is (w * h) / 8 bytes.
-    uint8_t *BITMAP_BUFFER = (uint8_t *) memoryAllocateBlock(((w * h) / 8));
+    writeByteToPort(SEQUENCER_INDEX, REG_SEQUENCER_MASK);
 
-    // Calculate the starting offset in screen memory for the drawing position.
-    SCREEN_MEMORY += (y * GRAPHMODE_WIDTH + x) >> 3;
+    for (uint8_t plane = 0; plane < 4; plane++) {
+        writeByteToPort(SEQUENCER_DATA, 1 << plane);
+
+        uint8_t *destination = GRAPHMODE_BUFFER + (y * (GRAPHMODE_WIDTH >> 3)) + column;
+        const uint8_t *source = planes[plane];
+
+        for (uint16_t row = 0; row < rows; row++) {
+            fastFastMemoryCopy(destination, source, columns);
+            destination += GRAPHMODE_WIDTH >> 3;
+            source += columns;
+        }
+    }
+}
+
+
+/* The page on screen in the paged mode, the other one is drawn */
+static uint8_t visible_page = 0;
+
+/* The packed frame each page holds, so only the tiles that changed since go to the VGA */
+static uint8_t *page_frames[2] = {NULL, NULL};
+static bool page_valid[2] = {false, false};
+
+#define PAGED_PITCH         (PAGEDMODE_WIDTH >> 1)
+#define PAGED_TILE_COLUMNS  (PAGEDMODE_WIDTH / TILE_SIZE)
+#define PAGED_TILE_ROWS     (PAGEDMODE_HEIGHT / TILE_SIZE)
 
-    // For the input packed format, each row occupies (w + 1) / 2 bytes (2 pixels per byte).
-    uint32_t row_bytes = (w + 1) >> 1;
 
-    // Loop over each color plane.
+void initializePages(void) {
+    initializeVGA(paged_mode);
+    setDisplayStart(0, false);
+    visible_page = 0;
+
+    // Without the copies every frame is uploaded whole, slower but still right
+    for (uint8_t page = 0; page < 2; page++) {
+        if (!page_frames[page]) {
+            page_frames[page] = (uint8_t *) memoryAllocateBlock(PAGED_PITCH * PAGEDMODE_HEIGHT);
+        }
+
+        // The mode switch leaves anything in the pages
+        page_valid[page] = false;
+    }
+}
+
+
+/** Is a tile of the frame different from the one in the page? */
+static inline bool isTileChanged(const uint8_t *pixels, const uint8_t *frame, uint32_t offset) {
+    for (uint8_t row = 0; row < TILE_SIZE; row++, offset += PAGED_PITCH) {
+        if (*((const uint32_t *) (pixels + offset)) != *((const uint32_t *) (frame + offset))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/**
+ * Convert a run of tiles on a tile row to planar format and upload it to a page, plane by plane.
+ */
+static void presentPageTiles(const uint8_t *pixels, uint8_t page, uint16_t row, uint16_t first, uint16_t columns) {
+    uint32_t plane_size = columns * TILE_SIZE;
+    uint8_t *planes[4] = {
+        planar_buffer, planar_buffer + plane_size, planar_buffer + (plane_size * 2), planar_buffer + (plane_size * 3)
+    };
+
+    uint32_t index = 0;
+    for (uint8_t line = 0; line < TILE_SIZE; line++) {
+        const uint8_t *source = pixels + (((row * TILE_SIZE) + line) * PAGED_PITCH) + (first * (TILE_SIZE >> 1));
+
+        for (uint16_t i = 0; i < columns; i++) {
+            toPlanar(source, planes, index++);
+            source += 4;
+        }
+    }
+
+    writeByteToPort(SEQUENCER_INDEX, REG_SEQUENCER_MASK);
+
     for (uint8_t plane = 0; plane < 4; plane++) {
-        uint8_t mask = 1 << plane;
+        writeByteToPort(SEQUENCER_DATA, 1 << plane);
 
-        // Select the current color plane for reading.
-        writeByteToPort(GRAPHICS_INDEX, REG_GRAPHICS_MAP_READ);
-        writeByteToPort(GRAPHICS_DATA, plane);
+        uint8_t *destination = GRAPHMODE_BUFFER + (page * PAGEDMODE_PAGE) + (row * TILE_SIZE * (PAGEDMODE_WIDTH >> 3)) + first;
+        const uint8_t *source = planes[plane];
 
-        // Set the write mask for the current plane.
-        writeByteToPort(SEQUENCER_INDEX, REG_SEQUENCER_MASK);
-        writeByteToPort(SEQUENCER_DATA, mask);
+        for (uint8_t line = 0; line < TILE_SIZE; line++) {
+            fastFastMemoryCopy(destination, source, columns);
+            destination += PAGEDMODE_WIDTH >> 3;
+            source += columns;
+        }
+    }
+}
 
-        // Process each row of the bitmap.
-        for (uint32_t row = 0; row < h; row++) {
-            // Calculate the starting offset into the packed pixels array for this row.
-            uint32_t row_offset = row * row_bytes;
 
-            // Calculate the starting pointer in the temporary buffer for this row.
-            // The temporary buffer stores 1 bit per pixel, so each row takes (w + 7) / 8 bytes.
-            uint8_t *screen_row = BITMAP_BUFFER + (row * w) / 8;
+void presentPage(const uint8_t *pixels) {
+    if (!getShadowBuffer() || !pixels) return;
 
-            // (Optional) Clear the row in the temporary buffer.
-            fastFastMemorySet(screen_row, 0, (w + 7) >> 3);
+    uint8_t page = visible_page ^ 1;
+    uint8_t *frame = page_frames[page];
+    bool valid = frame && page_valid[page];
 
-            // Process each pixel in the row.
-            for (uint32_t column = 0; column < w; column++) {
-                // For the packed 4bpp image, each byte holds two pixels.
-                uint32_t byte_index = row_offset + (column >> 1);
-                uint8_t packed = pixels[byte_index];
-                uint8_t color;
+    writeGraphicsRegister(REG_GRAPHICS_BIT_MASK, 0xFF);
 
-                // (column & 1) == 0?
-                if (column & 1) {
-                    // Odd column: extract the low nibble.
-                    color = packed & 0x0F;
-                } else {
-                    // Even column: extract the high nibble.
-                    color = packed >> 4;
-                }
+    // The hidden page holds the frame before the last one, only the tiles that differ go
+    for (uint16_t row = 0; row < PAGED_TILE_ROWS; row++) {
+        uint32_t offset = row * TILE_SIZE * PAGED_PITCH;
+        uint16_t first = 0;
 
-                // Determine the bit to set/clear in the temporary buffer.
-                uint8_t bit = 1 << (7 - (column & 7));
+        while (first < PAGED_TILE_COLUMNS) {
+            if (valid && !isTileChanged(pixels, frame, offset + (first * (TILE_SIZE >> 1)))) {
+                first++;
+                continue;
+            }
 
-                // Set or clear the bit based on the current plane's bit in the color.
-                if (color & mask) {
-                    *(screen_row + (column >> 3)) |= bit;  // Set bit in buffer.
-                } else {
-                    *(screen_row + (column >> 3)) &= ~bit;   // Clear bit in buffer.
-                }
+            uint16_t last = first + 1;
+            while ((last < PAGED_TILE_COLUMNS) && (!valid || isTileChanged(pixels, frame, offset + (last * (TILE_SIZE >> 1))))) {
+                last++;
             }
+
+            presentPageTiles(pixels, page, row, first, last - first);
+            first = last;
         }
+    }
 
-        // Calculate the starting offset in screen memory for the bitmap.
-        uint8_t *screen_offset = SCREEN_MEMORY; // Already adjusted for x and y.
+    if (frame) {
+        fastFastMemoryCopy(frame, pixels, PAGED_PITCH * PAGEDMODE_HEIGHT);
+        page_valid[page] = true;
+    }
+
+    // The page is shown from the next retrace on, until then the old one can't be touched
+    setDisplayStart(page * PAGEDMODE_PAGE, true);
+    visible_page = page;
+}
 
-        // Copy the entire temporary buffer to the corresponding location in screen memory.
-        for (uint32_t row = 0; row < h; row++) {
-            uint8_t *destination = screen_offset + (row * GRAPHMODE_WIDTH) / 8;
-            uint8_t *source = BITMAP_BUFFER + (row * w) / 8;
-            fastFastMemoryCopy(destination, source, w >> 3);
+
+/** Are all the tiles of [first, last) dirty on this tile row? */
+static inline bool isSpanDirty(uint16_t row, uint16_t first, uint16_t last) {
+    for (uint16_t i = first; i < last; i++) {
+        if (!dirty_tiles[row][i]) {
+            return false;
         }
     }
+    return true;
+}
+
+
+void presentScreen(void) {
+    if (!shadow_buffer) return;
+
+    // Write mode 0 with all the bits coming from the CPU
+    writeGraphicsRegister(REG_GRAPHICS_BIT_MASK, 0xFF);
+
+    for (uint16_t row = 0; row < TILE_ROWS; row++) {
+        uint16_t first = 0;
+
+        while (first < TILE_COLUMNS) {
+            if (!dirty_tiles[row][first]) {
+                first++;
+                continue;
+            }
+
+            uint16_t last = first;
+            while ((last < TILE_COLUMNS) && dirty_tiles[row][last]) {
+                last++;
+            }
+
+            // Grow the rectangle down while the next rows have the same span dirty
+            uint16_t bottom = row + 1;
+            while ((bottom < TILE_ROWS) && isSpanDirty(bottom, first, last)) {
+                bottom++;
+            }
+
+            for (uint16_t i = row; i < bottom; i++) {
+                fastFastMemorySet(&dirty_tiles[i][first], 0, last - first);
+            }
 
-    // Free the temporary buffer.
-    memoryFreeBlock(BITMAP_BUFFER);
+            presentRegion(first, row * TILE_SIZE, last - first, (bottom - row) * TILE_SIZE);
+            first = last;
+        }
+    }
 }
 
 
 void drawLine(uint8_t color, uint16_t fx, uint16_t fy, uint16_t sx, uint16_t sy) {
+    if (fy == sy) {
+        fillSpan(color, MIN(fx, sx), fy, ABS(sx - fx) + 1);
+        return;
+    }
+
     int16_t dx = ABS((sx - fx)); // delta X
     int16_t dy = -ABS((sy - fy)); // delta Y
     int8_t ix = (fx < sx) ? 1 : -1; // sign of X direction
@@ -344,14 +872,8 @@ void drawEmptyRect(uint8_t color, uint16_t x, uint16_t y, uint16_t w, uint16_t h
 
 
 void drawSolidRect(uint8_t color, uint16_t x, uint16_t y, uint16_t w, uint16_t h) {
-    drawLine(color, x, y, x, y + h);
-    drawLine(color, x, y, x + w, y);
-    drawLine(color, x + w, y, x + w, y + h);
-    drawLine(color, x, y + h, x + w, y + h);
-
-    for (uint16_t i = y; i < y + h; i++){
-        drawLine(color, x, i, x + w, i);
-    }
+    // Like the empty one, the right and bottom edges are included
+    fillRect(color, x, y, w + 1, h + 1);
 }
 
 
@@ -382,14 +904,207 @@ void drawEmptyCircle(uint8_t color, uint16_t cx, uint16_t cy, uint16_t r) {
 }
 
 
-void drawSolidCircle(uint8_t color, uint16_t cx, uint16_t cy, uint16_t r) {
-    for (int16_t y = -r; y <= r; y++) {
-        for (int16_t x = -r; x <= r; x++) {
-            if ((x*x + y*y) < (r*r - r)) {
-                plotPixel(color, cx + x, cy + y);
+/*
+ * A shape being filled, the context of fillColorSpan(). Once the eight rows of a tile row
+ * got their span, the tiles all of them cover are filled in the VGA memory like fillRect()
+ * does, instead of waiting for the present step.
+ */
+typedef struct {
+    uint8_t color;
+    uint8_t rows[TILE_ROWS];    // Bit n set once row n of the tile row got its span
+    int16_t left[TILE_ROWS];    // Columns covered by all those spans
+    int16_t right[TILE_ROWS];
+} fill_spans_t;
+
+
+static void initializeFillSpans(fill_spans_t *spans, uint8_t color) {
+    spans->color = color & 0x0F;
+
+    for (uint16_t i = 0; i < TILE_ROWS; i++) {
+        spans->rows[i] = 0;
+        spans->left[i] = 0;
+        spans->right[i] = GRAPHMODE_WIDTH;
+    }
+}
+
+
+/** Span callback of the drawing functions, the context is a fill_spans_t */
+static void fillColorSpan(void *context, int16_t x, int16_t y, uint16_t length) {
+    fill_spans_t *spans = (fill_spans_t *) context;
+    fillSpan(spans->color, x, y, length);
+
+    if (!shadow_buffer || (y < 0) || (y >= (int16_t) GRAPHMODE_HEIGHT)) return;
+
+    uint16_t band = y / TILE_SIZE;
+    uint8_t bit = 1 << (y % TILE_SIZE);
+
+    // A second span on a row means a gap, the tile row is left to the present step
+    if (spans->rows[band] & bit) {
+        spans->right[band] = spans->left[band];
+        return;
+    }
+
+    spans->rows[band] |= bit;
+    spans->left[band] = MAX(spans->left[band], x);
+    spans->right[band] = (int16_t) MIN((int32_t) spans->right[band], (int32_t) x + length);
+
+    if (spans->rows[band] == (uint8_t) ((1 << TILE_SIZE) - 1)) {
+        uint16_t first = (spans->left[band] + TILE_SIZE - 1) / TILE_SIZE;
+        uint16_t last = MAX(spans->right[band], 0) / TILE_SIZE;
+
+        if (first < last) {
+            fillTiles(spans->color, first, last, band, band + 1);
+        }
+    }
+}
+
+
+void scanCircle(int16_t cx, int16_t cy, uint16_t r, span_callback_t callback, void *context) {
+    // The pixels with x^2 + y^2 < r^2 - r, the half width only shrinks going down
+    int32_t limit = ((int32_t) r * r) - r;
+    int32_t half = r, halves = (int32_t) r * r; // half and half^2
+    int32_t squares = 0;                        // dy^2
+
+    for (int32_t dy = 0; dy <= r; dy++) {
+        if (dy) squares += (dy << 1) - 1;
+
+        while ((half >= 0) && ((halves + squares) >= limit)) {
+            halves -= (half << 1) - 1;
+            half--;
+        }
+
+        if (half < 0) break;
+
+        callback(context, cx - half, cy - dy, (half << 1) + 1);
+        if (dy) callback(context, cx - half, cy + dy, (half << 1) + 1);
+    }
+}
+
+
+/* An edge of a polygon being scanned, its first pixel on the current row is ceil(n / d) */
+typedef struct {
+    int32_t quotient, remainder;    // n = (quotient * d) + remainder, 0 <= remainder < d
+    int32_t step, step_remainder;   // What n grows each row, the same way
+    int32_t denominator;
+    int16_t top, bottom;            // Rows [top, bottom)
+} scan_edge_t;
+
+
+static inline int32_t floorDivide(int32_t a, int32_t b, int32_t *remainder) {
+    int32_t quotient = a / b;
+    int32_t rest = a - (quotient * b);
+
+    if (rest < 0) {
+        quotient--;
+        rest += b;
+    }
+
+    *remainder = rest;
+    return quotient;
+}
+
+
+bool scanPolygon(const Point *points, uint16_t count, int16_t top, int16_t bottom, span_callback_t callback, void *context) {
+    if (!points || (count < 3) || !callback) return false;
+
+    scan_edge_t *edges = (scan_edge_t *) memoryAllocateBlock(count * (sizeof(scan_edge_t) + sizeof(int32_t)));
+    if (!edges) return false;
+
+    int32_t *crossings = (int32_t *) (edges + count);
+    uint16_t used = 0;
+    int16_t first = bottom, last = top;
+
+    for (uint16_t i = 0; i < count; i++) {
+        // Far away vertices are clamped, so the edge math fits in 32 bits
+        int32_t x0 = MIN(MAX(points[i].x, -SCAN_LIMIT), SCAN_LIMIT);
+        int32_t y0 = MIN(MAX(points[i].y, -SCAN_LIMIT), SCAN_LIMIT);
+        int32_t x1 = MIN(MAX(points[(i + 1) % count].x, -SCAN_LIMIT), SCAN_LIMIT);
+        int32_t y1 = MIN(MAX(points[(i + 1) % count].y, -SCAN_LIMIT), SCAN_LIMIT);
+
+        if (y0 == y1) continue; // Horizontal edges cross no pixel center
+
+        if (y0 > y1) {
+            int32_t swap = x0; x0 = x1; x1 = swap;
+            swap = y0; y0 = y1; y1 = swap;
+        }
+
+        // Rows whose centers (y + 0.5) are inside [y0, y1), only the visible ones
+        int32_t start = MAX(y0, (int32_t) top);
+        int32_t end = MIN(y1, (int32_t) bottom);
+        if (start >= end) continue;
+
+        scan_edge_t *edge = &edges[used++];
+        int32_t dx = x1 - x0, dy = y1 - y0;
+
+        // At row r the edge is at x0 + dx * (2 * (r - y0) + 1) / (2 * dy), and the first
+        // pixel center at or right of it is ceil(that - 0.5)
+        edge->denominator = dy << 1;
+        edge->quotient = floorDivide((x0 * edge->denominator) + (dx * (((start - y0) << 1) + 1)) - dy, edge->denominator, &edge->remainder);
+        edge->step = floorDivide(dx * 2, edge->denominator, &edge->step_remainder);
+        edge->top = start;
+        edge->bottom = end;
+
+        first = MIN(first, (int16_t) start);
+        last = MAX(last, (int16_t) end);
+    }
+
+    for (int16_t y = first; y < last; y++) {
+        uint16_t crossed = 0;
+
+        for (uint16_t i = 0; i < used; i++) {
+            scan_edge_t *edge = &edges[i];
+            if ((y < edge->top) || (y >= edge->bottom)) continue;
+
+            int32_t x = edge->quotient + (edge->remainder ? 1 : 0);
+
+            // Sorted as they come, there are only a few per row
+            uint16_t j = crossed++;
+            while (j && (crossings[j - 1] > x)) {
+                crossings[j] = crossings[j - 1];
+                j--;
+            }
+            crossings[j] = x;
+
+            edge->quotient += edge->step;
+            edge->remainder += edge->step_remainder;
+            if (edge->remainder >= edge->denominator) {
+                edge->remainder -= edge->denominator;
+                edge->quotient++;
+            }
+        }
+
+        // Inside between each pair of crossings (even-odd rule)
+        for (uint16_t i = 0; (i + 1) < crossed; i += 2) {
+            if (crossings[i + 1] > crossings[i]) {
+                callback(context, crossings[i], y, crossings[i + 1] - crossings[i]);
             }
         }
     }
+
+    memoryFreeBlock(edges);
+    return true;
+}
+
+
+void drawSolidCircle(uint8_t color, uint16_t cx, uint16_t cy, uint16_t r) {
+    fill_spans_t spans;
+    initializeFillSpans(&spans, color);
+
+    scanCircle(cx, cy, r, fillColorSpan, &spans);
+}
+
+
+void fillPolygon(uint8_t color, const Point *points, uint16_t count) {
+    fill_spans_t spans;
+    initializeFillSpans(&spans, color);
+
+    scanPolygon(points, count, 0, GRAPHMODE_HEIGHT, fillColorSpan, &spans);
+}
+
+
+void fillTriangle(uint8_t color, Point a, Point b, Point c) {
+    Point points[3] = { a, b, c };
+    fillPolygon(color, points, 3);
 }
 
 
@@ -404,31 +1119,48 @@ void drawSolidCircle(uint8_t color, uint16_t cx, uint16_t cy, uint16_t r) {
  *              and the upper 4 bits represent the background color.
  */
 void drawCharacter(unsigned char character, uint16_t x, uint16_t y, uint8_t color) {
+    if ((x >= GRAPHMODE_WIDTH) || (y >= GRAPHMODE_HEIGHT) || !getShadowBuffer()) return;
+
     uint8_t fgcolor = color & 0x0F;        // Extract foreground color
     uint8_t bgcolor = (color >> 4) & 0x0F; // Extract background color
 
     // Get the glyph for the character from the font. The glyph is an 8x8 bitmap that represents the character
     // Each byte in the glyph represents one row of 8 pixels in the character
-    uint8_t *glyph = small_font + character * 8;
-
-    // The 8x8 font bitmap have 64 pixels per character, sooo ...
-    for (uint8_t i = 0; i < 64; i++) {
+    const uint8_t *glyph = small_font + character * 8;
 
-        // The hardcoded 64 could be a bad idea, but the performance is first LOL
+    // Across the right or bottom edge, pixel by pixel so only the visible part is drawn
+    if (((x + 8) > GRAPHMODE_WIDTH) || ((y + 8) > GRAPHMODE_HEIGHT)) {
+        for (uint8_t i = 0; i < 64; i++) {
+            uint8_t mask = 0x80 >> (i & 7);
+            plotPixel((glyph[i >> 3] & mask) ? fgcolor : bgcolor, x + (i & 7), y + (i >> 3));
+        }
+        return;
+    }
 
-        uint8_t cx = i & 7;       // i % 8.
-        uint8_t cy = i >> 3;      // i / 8.
+    uint8_t *pixel = shadow_buffer + (y * SHADOW_PITCH) + (x >> 1);
 
-        // Create a mask for the current pixel, the mask is a byte where only one bit is set
-        // The position of the set bit corresponds to the position of the pixel in the row
-        // For example, if cx is 0, the mask will be 10000000 in binary, if cx is 7, the mask will be 00000001
-        uint8_t mask = 1 << (7 - cx);
+    for (uint8_t row = 0; row < 8; row++, pixel += SHADOW_PITCH) {
+        // packed_table spreads the font row over the nibbles of 8 packed pixels, one bit
+        // each, so the colors go in with a multiply (the nibbles can't carry)
+        uint32_t bits = packed_table[glyph[row]];
+        uint32_t packed = (bits * fgcolor) | ((bits ^ 0x11111111U) * bgcolor);
 
-        // Draw the pixel at the corresponding position
-        // If the corresponding bit in the row is set (i.e., the bitwise AND of the row and the mask is not zero),
-        // then the pixel is drawn with the foreground color. Otherwise, it is drawn with the background color
-        plotPixel((glyph[cy] & mask) ? fgcolor : bgcolor, x + cx, y + cy);
+        if (!(x & 1)) {
+            // Four whole bytes, the row is stored at once
+            *(uint32_t *) pixel = packed;
+        } else {
+            // Half a byte off, every byte takes the end of one packed byte and the start of the next
+            uint8_t previous = pixel[0] & 0xF0;
+            for (uint8_t i = 0; i < 4; i++) {
+                uint8_t current = (uint8_t) (packed >> (i * 8));
+                pixel[i] = previous | (current >> 4);
+                previous = current << 4;
+            }
+            pixel[4] = previous | (pixel[4] & 0x0F);
+        }
     }
+
+    markScreenDirty(x, y, 8, 8);
 }
 
 
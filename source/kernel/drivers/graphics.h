@@ -26,6 +26,62 @@
 #define PX_WHITE            0xFF // White pixel color
 
 
+/** Magic of the planar images made by imgbin.py -p */
+#define PLANAR_MAGIC        "VPLN"
+
+/**
+ * Header of a planar image, followed by its four bitplanes one after the other.
+ * Each plane row has (width + 7) / 8 bytes, the leftmost pixel in the top bit.
+ */
+typedef struct {
+    char magic[4];
+    uint16_t width;
+    uint16_t height;
+} PACKED planar_header_t;
+
+
+/** Magic of the compressed planar images made by imgbin.py -c */
+#define COMPRESSED_MAGIC    "VPLZ"
+
+/**
+ * Header of a compressed planar image. The planes come one after the other like in
+ * a planar image, but each plane row is packed with PackBits: a control byte n from
+ * 0 to 127 is followed by n + 1 literal bytes, from -127 to -1 by a byte repeated
+ * 1 - n times.
+ */
+typedef struct {
+    char magic[4];
+    uint16_t width;
+    uint16_t height;
+    uint32_t size;      // Bytes of packed data after the header
+} PACKED compressed_header_t;
+
+
+
+
+/**
+ * All the drawing functions draw into a shadow framebuffer in system RAM, nothing
+ * is sure to reach the screen until presentScreen() is called.
+ */
+
+
+/**
+ * Uploads the parts of the shadow framebuffer that changed since the last call
+ * to the VGA memory, converted to planar format.
+ */
+void presentScreen(void);
+
+
+/**
+ * Marks an area of the screen as changed, so the next presentScreen() uploads it
+ * again (e.g. after the VGA memory was cleared by a mode switch).
+ *
+ * @param x The x-coordinate of the area
+ * @param y The y-coordinate of the area
+ * @param w The width of the area
+ * @param h The height of the area
+ */
+void markScreenDirty(int16_t x, int16_t y, uint16_t w, uint16_t h);
 
 
 /**
@@ -58,9 +114,56 @@ void fillScreen(uint8_t color);
 
 
 /**
- * @brief Draws a bitmap on the screen plane by plane.
+ * Fills a horizontal span of pixels, clipped to the screen.
  *
- * @note Supports up to 4 color planes, allowing 16-color graphics (4 bits per pixel).
+ * @param color The color of the span
+ * @param x The x-coordinate of the first pixel
+ * @param y The y-coordinate of the span
+ * @param length The number of pixels
+ */
+void fillSpan(uint8_t color, int16_t x, int16_t y, uint16_t length);
+
+
+/**
+ * Fills a rectangle, clipped to the screen. The 8x8 tiles it covers in full are
+ * filled in the VGA memory right away with set/reset, one write for 8 pixels.
+ *
+ * @param color The color of the rectangle
+ * @param x The x-coordinate of the top left corner
+ * @param y The y-coordinate of the top left corner
+ * @param w The width of the rectangle
+ * @param h The height of the rectangle
+ */
+void fillRect(uint8_t color, int16_t x, int16_t y, uint16_t w, uint16_t h);
+
+
+/**
+ * Copies a rectangle of the screen to another place, the two can overlap. When the
+ * x-coordinates and the width are multiples of 8 the copy is done in the VGA memory
+ * through the latches (write mode 1), one read and one write for 8 pixels, after a
+ * presentScreen() so the source is up to date.
+ *
+ * @param sx The x-coordinate of the source
+ * @param sy The y-coordinate of the source
+ * @param dx The x-coordinate of the destination
+ * @param dy The y-coordinate of the destination
+ * @param w The width of the rectangle
+ * @param h The height of the rectangle
+ */
+void copyRect(uint16_t sx, uint16_t sy, uint16_t dx, uint16_t dy, uint16_t w, uint16_t h);
+
+
+/**
+ * Scrolls the whole screen, with latch copies, and fills the uncovered lines.
+ *
+ * @param lines The lines to scroll, up when positive and down when negative
+ * @param color The color of the uncovered lines
+ */
+void scrollScreen(int16_t lines, uint8_t color);
+
+
+/**
+ * @brief Draws a bitmap on the screen.
  *
  * @param pixels    Pointer to the bitmap pixel data.
  * @param x         X coordinate of the top left corner of the bitmap.
@@ -68,7 +171,7 @@ void fillScreen(uint8_t color);
  * @param w         Width of the bitmap in pixels.
  * @param h         Height of the bitmap in pixels.
  *
- * @deprecated This is slow, we should use the fast double-bufferd version
+ * @deprecated Kept for compatibility, it's the same as drawBitmapFast() now.
  */
 void drawBitmap(uint8_t *pixels, uint16_t x, uint16_t y, uint16_t w, uint16_t h);
 
@@ -76,7 +179,8 @@ void drawBitmap(uint8_t *pixels, uint16_t x, uint16_t y, uint16_t w, uint16_t h)
 /**
  * @brief Draws a bitmap on the screen (fast version).
  *
- * @note Uses double-buffering to copy the bitmap completely in each plane.
+ * @note The bitmap is packed 4bpp (two pixels per byte, the left one in the high
+ *       nibble), the same format as the shadow framebuffer.
  *
  * @param pixels    Pointer to the bitmap pixel data.
  * @param x         X coordinate of the top left corner of the bitmap.
@@ -87,6 +191,51 @@ void drawBitmap(uint8_t *pixels, uint16_t x, uint16_t y, uint16_t w, uint16_t h)
 void drawBitmapFast(uint8_t *pixels, uint16_t x, uint16_t y, uint16_t w, uint16_t h);
 
 
+/**
+ * @brief Draws a planar image (see planar_header_t) on the screen.
+ *
+ * @note When x and the width are multiples of 8, each row of each plane goes to the
+ *       VGA memory with a single copy, with no conversion. Otherwise the image is
+ *       drawn through the shadow framebuffer like any other bitmap.
+ *
+ * @param image     Pointer to the image, starting with its header.
+ * @param x         X coordinate of the top left corner of the image.
+ * @param y         Y coordinate of the top left corner of the image.
+ */
+void drawPlanarBitmap(const uint8_t *image, uint16_t x, uint16_t y);
+
+
+/**
+ * @brief Draws a compressed planar image (see compressed_header_t) on the screen.
+ *
+ * @note The image is unpacked one plane row at a time, straight to the VGA memory
+ *       when x and the width are multiples of 8, otherwise through the shadow.
+ *
+ * @param image     Pointer to the image, starting with its header.
+ * @param x         X coordinate of the top left corner of the image.
+ * @param y         Y coordinate of the top left corner of the image.
+ */
+void drawCompressedBitmap(const uint8_t *image, uint16_t x, uint16_t y);
+
+
+/**
+ * Switches to the 320x240 paged mode (see paged_mode), with two pages that
+ * presentPage() draws and shows in turns.
+ */
+void initializePages(void);
+
+
+/**
+ * Shows a frame in the paged mode. The tiles that differ from what the page that is
+ * not on the screen holds (the frame before the last one) are uploaded there, and then
+ * the pages are flipped by changing the CRTC start address at the vertical retrace,
+ * so nothing is seen half drawn. An unchanged frame costs just the flip.
+ *
+ * @param pixels    A 320x240 packed 4bpp frame (two pixels per byte)
+ */
+void presentPage(const uint8_t *pixels);
+
+
 void drawLine(uint8_t color, uint16_t fx, uint16_t fy, uint16_t sx, uint16_t sy);
 
 
@@ -102,6 +251,31 @@ void drawEmptyCircle(uint8_t color, uint16_t cx, uint16_t cy, uint16_t r);
 void drawSolidCircle(uint8_t color, uint16_t cx, uint16_t cy, uint16_t r);
 
 
+/** Polygon vertices are clamped to this distance from the origin */
+#define SCAN_LIMIT  8192
+
+/** Called by the scan functions for each span of a shape, 'length' pixels from (x, y) */
+typedef void (*span_callback_t)(void *context, int16_t x, int16_t y, uint16_t length);
+
+/**
+ * Walk the rows of a filled circle, the half width of each row comes from the one
+ * above with additions only (like the midpoint algorithm).
+ */
+void scanCircle(int16_t cx, int16_t cy, uint16_t r, span_callback_t callback, void *context);
+
+/**
+ * Walk the rows [top, bottom) of a filled polygon (even-odd rule), a pixel is inside
+ * when its center is. The edges are stepped row by row with integer math, exact.
+ *
+ * @return False if there are less than 3 points or no memory for the edges
+ */
+bool scanPolygon(const Point *points, uint16_t count, int16_t top, int16_t bottom, span_callback_t callback, void *context);
+
+void fillPolygon(uint8_t color, const Point *points, uint16_t count);
+
+void fillTriangle(uint8_t color, Point a, Point b, Point c);
+
+
 void drawCharacter(unsigned char character, uint16_t x, uint16_t y, uint8_t color);
 
 
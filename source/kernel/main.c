@@ -1,6 +1,30 @@
 #include "butterfly.h"
 
 
+/** The compressed wallpapers, read from the boot disc, the 480px ones go in the middle */
+static const struct {
+    const char *path;
+    uint16_t x;
+} wallpapers[] = {
+    {"/assets/480_bigeye.plz", 80}, {"/assets/480_myfall.plz", 80}, {"/assets/480_myfood.plz", 80},
+    {"/assets/480_mylamb.plz", 80}, {"/assets/480_mylife.plz", 80}, {"/assets/480_mymind.plz", 80},
+    {"/assets/480_theman.plz", 80},
+    {"/assets/640_candle.plz", 0},  {"/assets/640_choice.plz", 0},  {"/assets/640_clouds.plz", 0},
+    {"/assets/640_myhill.plz", 0},  {"/assets/640_mypain.plz", 0},  {"/assets/640_mypath.plz", 0},
+    {"/assets/640_myroad.plz", 0},
+};
+
+
+/** Draw a compressed bitmap from the boot disc, nothing is drawn if it can't be read */
+static void drawAsset(const char *path, uint16_t x, uint16_t y) {
+    uint8_t *image = (uint8_t *) isoLoadFile(path, NULL);
+    if (!image) return;
+
+    drawCompressedBitmap(image, x, y);
+    memoryFreeBlock(image);
+}
+
+
 /**
  * Okay okay okay... there shouldn't be a shell inside a kernel...
  * this isn't userspace yet... but it's very useful, right? :)
@@ -33,6 +57,8 @@ void main(void) {
 
         } else if (strcmp(input, "SHUTDOWN") == 0) {
             printl(INFO, "Shutting down the system ...");
+            blkUnplug(BLK_ALL_DEVICES); // Don't lose the queued and cached writes
+            blkFlush(BLK_ALL_DEVICES);
             shutdownSound();
 
             setScreen(NULL);
@@ -40,7 +66,8 @@ void main(void) {
 
             initializeVGA(video_mode);
             fillScreen(PX_BLACK);
-            drawBitmapFast(candle_640, 0, 0, 640, 480);
+            drawAsset("/assets/640_candle.plz", 0, 0);
+            presentScreen();
 
             powerControl(POWER_SHUTDOWN);
 
@@ -49,6 +76,8 @@ void main(void) {
 
         } else if (strcmp(input, "REBOOT") == 0) {
             printl(INFO, "Rebooting the system ...");
+            blkUnplug(BLK_ALL_DEVICES);
+            blkFlush(BLK_ALL_DEVICES);
             shutdownSound();
             powerControl(POWER_REBOOT);
 
@@ -110,13 +139,13 @@ void main(void) {
             timerSleep(150);
             initializeVGA(video_mode);
 
-            fillScreen(PX_BLACK); timerSleep(20);
-            fillScreen(PX_GREEN); timerSleep(20);
-            fillScreen(PX_CYAN); timerSleep(20);
-            fillScreen(PX_RED); timerSleep(20);
-            fillScreen(PX_MAGENTA); timerSleep(20);
-            fillScreen(PX_BROWN); timerSleep(20);
-            fillScreen(PX_BLUE); timerSleep(20);
+            fillScreen(PX_BLACK); presentScreen(); timerSleep(20);
+            fillScreen(PX_GREEN); presentScreen(); timerSleep(20);
+            fillScreen(PX_CYAN); presentScreen(); timerSleep(20);
+            fillScreen(PX_RED); presentScreen(); timerSleep(20);
+            fillScreen(PX_MAGENTA); presentScreen(); timerSleep(20);
+            fillScreen(PX_BROWN); presentScreen(); timerSleep(20);
+            fillScreen(PX_BLUE); presentScreen(); timerSleep(20);
 
             drawCharset();
             drawString("- Two of the most famous products of Berkeley are LSD and Unix.\n\rI don't think that this is a coincidence ...", 8, 72, 0x10 | 0x0F);
@@ -129,9 +158,11 @@ void main(void) {
 
             drawEmptyCircle(PX_LTRED, 80, 328, 32);
             drawSolidCircle(PX_LTRED, 80, 408, 32);
+            fillTriangle(PX_YELLOW, (Point) {216, 440}, (Point) {280, 312}, (Point) {344, 440});
 
             // vertical line
             drawLine(PX_LTMAGENTA, 176, 152, 176, 440);
+            presentScreen();
 
 
         } else if (strcmp(input, "NOISE") == 0) {
@@ -150,6 +181,10 @@ void main(void) {
                 plotPixel(c, x + 1, y + 1);
                 plotPixel(c, x + 1, y);
                 plotPixel(c, x, y + 1);
+
+                if (!(counter & 0xFFF)) {
+                    presentScreen();
+                }
             }
 
 
@@ -166,6 +201,9 @@ void main(void) {
 
             bglPlayDemoEx();
 
+            timerSleep(100);
+            bglPlayPages();
+
             timerSleep(100);
             initializeVGA(text_mode);
             setScreen(NULL);
@@ -176,71 +214,154 @@ void main(void) {
             timerSleep(200);
             initializeVGA(video_mode);
             fillScreen(PX_BLACK);
+            presentScreen();
             timerSleep(200);
 
-            fillScreen(PX_BLACK);
-            drawBitmapFast(bigeye_480, 80, 0, 480, 480);
-            timerSleep(1024);
+            for (uint8_t i = 0; i < sizeof(wallpapers) / sizeof(wallpapers[0]); i++) {
+                fillScreen(PX_BLACK);
+                drawAsset(wallpapers[i].path, wallpapers[i].x, 0);
+                presentScreen();
+                timerSleep(1024);
+            }
 
-            fillScreen(PX_BLACK);
-            drawBitmapFast(myfall_480, 80, 0, 480, 480);
-            timerSleep(1024);
+            initializeVGA(text_mode);
+            setScreen(NULL);
 
-            fillScreen(PX_BLACK);
-            drawBitmapFast(myfood_480, 80, 0, 480, 480);
-            timerSleep(1024);
 
-            fillScreen(PX_BLACK);
-            drawBitmapFast(mylamb_480, 80, 0, 480, 480);
-            timerSleep(1024);
+        } else if (strcmp(input, "CPUID") == 0) {
+            processorGetStatus();
 
-            fillScreen(PX_BLACK);
-            drawBitmapFast(mylife_480, 80, 0, 480, 480);
-            timerSleep(1024);
 
-            fillScreen(PX_BLACK);
-            drawBitmapFast(mymind_480, 80, 0, 480, 480);
-            timerSleep(1024);
+        } else if (strcmp(input, "PCI") == 0) {
+            pciGetStatus();
 
-            fillScreen(PX_BLACK);
-            drawBitmapFast(theman_480, 80, 0, 480, 480);
-            timerSleep(1024);
 
+        } else if (strncmp(input, "VBE", 3) == 0) {
+            uint16_t width = 800, height = 600;
+            uint8_t bpp = 32;
 
-            fillScreen(PX_BLACK);
-            drawBitmapFast(candle_640, 0, 0, 640, 480);
-            timerSleep(1024);
+            // VBE [width height bpp]
+            char *argument = strtok(input + 3, " ");
+            if (argument) {
+                width = atoi(argument);
+                argument = strtok(NULL, " ");
+                height = argument ? atoi(argument) : 0;
+                argument = strtok(NULL, " ");
+                bpp = argument ? atoi(argument) : 0;
+            }
 
-            fillScreen(PX_BLACK);
-            drawBitmapFast(choice_640, 0, 0, 640, 480);
-            timerSleep(1024);
+            if (!bgaGetDevice()) {
+                bgaGetStatus();
+            } else if (!bgaSetMode(width, height, bpp)) {
+                printl(FAIL, "The mode %dx%dx%d is not supported\n\r", width, height, bpp);
+            } else {
+                bglPlayFramebuffer();
 
-            fillScreen(PX_BLACK);
-            drawBitmapFast(clouds_640, 0, 0, 640, 480);
-            timerSleep(1024);
+                bgaDisable();
+                initializeVGA(text_mode);
+                setScreen(NULL);
+            }
 
-            fillScreen(PX_BLACK);
-            drawBitmapFast(myhill_640, 0, 0, 640, 480);
-            timerSleep(1024);
 
-            fillScreen(PX_BLACK);
-            drawBitmapFast(mypain_640, 0, 0, 640, 480);
-            timerSleep(1024);
+        } else if (strcmp(input, "DISKS") == 0) {
+            ataGetStatus();
+            blkPartitionGetStatus();
 
-            fillScreen(PX_BLACK);
-            drawBitmapFast(mypath_640, 0, 0, 640, 480);
-            timerSleep(1024);
 
-            fillScreen(PX_BLACK);
-            drawBitmapFast(myroad_640, 0, 0, 640, 480);
-            timerSleep(1024);
+        } else if (strncmp(input, "PARTREAD ", 9) == 0) {
+            // PARTREAD <partition device> [lba], as DISKS lists them
+            char *device = strtok(input + 9, " ");
+            char *lba = strtok(NULL, " ");
+            uint8_t block[BLK_BLOCK_SIZE];
 
-            initializeVGA(text_mode);
-            setScreen(NULL);
+            if (!device) {
+                printl(FAIL, "Invalid command format\n\r");
+                return;
+            }
 
+            if (!blkPartitionRead((uint8_t) atoi(device), lba ? atoi(lba) : 0, 1, block)) {
+                printl(FAIL, "Cannot read that partition block\n\r");
+                return;
+            }
+
+            for (uint16_t i = 0; i < BLK_BLOCK_SIZE; i += 16) {
+                printf(" %03X:", i);
+                for (uint8_t j = 0; j < 16; j++) {
+                    printf(" %02X", block[i + j]);
+                }
+                printf("\n");
+            }
+
+
+        } else if (strncmp(input, "PARTWRITE ", 10) == 0) {
+            // PARTWRITE <partition device> <lba> <text>, the rest of the block is kept
+            char *device = strtok(input + 10, " ");
+            char *lba = strtok(NULL, " ");
+            char *text = strtok(NULL, "");
+            uint8_t block[BLK_BLOCK_SIZE];
+
+            if (!device || !lba || !text) {
+                printl(FAIL, "Invalid command format\n\r");
+                return;
+            }
+
+            if (!blkPartitionRead((uint8_t) atoi(device), atoi(lba), 1, block)) {
+                printl(FAIL, "Cannot read that partition block\n\r");
+                return;
+            }
+
+            memoryCopy(block, text, MIN((uint32_t) strlen(text), (uint32_t) BLK_BLOCK_SIZE));
+
+            if (blkPartitionWrite((uint8_t) atoi(device), atoi(lba), 1, block)) {
+                printl(INFO, "Block written, SYNC puts it on the disk\n\r");
+            } else {
+                printl(FAIL, "Cannot write that partition block\n\r");
+            }
+
+
+        } else if (strncmp(input, "DISKBENCH", 9) == 0) {
+            uint32_t sectors = 8;
+            bool write = false;
+
+            // DISKBENCH [sectors per request] [WRITE]
+            char *argument = strtok(input + 9, " ");
+            while (argument) {
+                if (strcmp(argument, "WRITE") == 0) {
+                    write = true;
+                } else {
+                    sectors = atoi(argument);
+                }
+                argument = strtok(NULL, " ");
+            }
+
+            diskBenchmark(sectors, write);
 
-        } else if (strcmp(input, "CPUID") == 0) {
-            processorGetStatus();
+
+        } else if (strncmp(input, "DISKSCAN ", 9) == 0) {
+            // DISKSCAN <device> [blocks], a disk (0 to 3) or a partition as DISKS lists them
+            char *device = strtok(input + 9, " ");
+            char *blocks = strtok(NULL, " ");
+
+            if (!device) {
+                printl(FAIL, "Invalid command format\n\r");
+                return;
+            }
+
+            diskScan((uint8_t) atoi(device), blocks ? (uint32_t) atoi(blocks) : 0);
+
+
+        } else if (strcmp(input, "CACHE") == 0) {
+            blkGetStatus();
+            blkQueueGetStatus();
+
+
+        } else if (strcmp(input, "SYNC") == 0) {
+            blkUnplug(BLK_ALL_DEVICES);
+            if (blkFlush(BLK_ALL_DEVICES)) {
+                printl(INFO, "Cached blocks written successfully\n\r");
+            } else {
+                printl(FAIL, "Some blocks could not be written\n\r");
+            }
 
 
         } else if (strcmp(input, "TEST") == 0) {
@@ -310,6 +431,20 @@ void main(void) {
             printf(" * %-15s -> %s\n", "CHARS",         "Get and print all the available characters");
             printf(" * %-15s -> %s\n", "HEAP",          "Query and display the heap information");
             printf(" * %-15s -> %s\n", "CPUID",         "Query and display the CPU information");
+            printf(" * %-15s -> %s\n", "PCI",           "Query and display the PCI devices");
+            printf(" * %-15s -> %s\n", "VBE",           "Show the BGA linear framebuffer, VBE [width height bpp]");
+            printf(" * %-15s -> %s\n", "DISKS",         "Query and display the disks and their partitions");
+            printf(" * %-15s -> %s\n", "PARTREAD",      "Dump a partition block, PARTREAD <device> [lba]");
+            printf(" * %-15s -> %s\n", "PARTWRITE",     "Write text into a partition block, PARTWRITE <device> <lba> <text>");
+            printf(" * %-15s -> %s\n", "DISKBENCH",     "Measure the disk, DISKBENCH [sectors] [WRITE]");
+            printf(" * %-15s -> %s\n", "DISKSCAN",      "Read a whole disk or partition, DISKSCAN <device> [blocks]");
+            printf(" * %-15s -> %s\n", "CACHE",         "Query and display the block cache and queue counters");
+            printf(" * %-15s -> %s\n", "SYNC",          "Write back the cached disk blocks");
+            printf(" * %-15s -> %s\n", "COMPRESS",      "Toggle the compression of a file");
+            printf(" * %-15s -> %s\n", "FSINFO",        "Query and display the file system information");
+            printf(" * %-15s -> %s\n", "CDLS",          "List a directory of the boot CD");
+            printf(" * %-15s -> %s\n", "CDCAT",         "Print a file of the boot CD");
+            printf(" * %-15s -> %s\n", "CDVIEW",        "Show a .bin, .pln or .plz wallpaper from the boot CD");
             printf(" * %-15s -> %s\n", "BUG",           "Throw a handled kernel exception");
             printf(" * %-15s -> %s\n", "BUGBUG",        "Throw a fatal handled kernel exception");
 
@@ -500,7 +635,11 @@ void main(void) {
 
             File *file = directory->files;
             while (file) {
-                printl("\033[33;40m\t *  \033[0m", "%s {%d bytes}\r\n", file->name, file->size);
+                if (file->flags & BFS_FILE_COMPRESSED) {
+                    printl("\033[33;40m\t *  \033[0m", "%s {%d bytes, %d stored}\r\n", file->name, file->size, bfsGetStoredSize(file));
+                } else {
+                    printl("\033[33;40m\t *  \033[0m", "%s {%d bytes}\r\n", file->name, file->size);
+                }
                 file = file->next;
             }
 
@@ -557,6 +696,106 @@ void main(void) {
                 ttyPrintLog(FAIL "Invalid command format\n\r");
             }
 
+
+        } else if (strncmp(input, "COMPRESS ", 9) == 0) {
+            File *file = bfsFindFile(input + 9);
+            if (file) {
+                bool enabled = !(file->flags & BFS_FILE_COMPRESSED);
+                bfsSetCompression(file, enabled);
+
+                printl(INFO, "Compression %s for %s (%d bytes, %d stored)\n\r",
+                    enabled ? "enabled" : "disabled", file->name, file->size, bfsGetStoredSize(file)
+                );
+            } else {
+                printl(FAIL, "Cannot find the file specified\n\r");
+            }
+
+
+        } else if (strcmp(input, "FSINFO") == 0) {
+            bfsGetStatus();
+
+
+        } else if (strncmp(input, "CDLS", 4) == 0) {
+            const char *path = input[4] == '\0' ? "/" : input + 5;
+
+            if (!isoListDirectory(path)) {
+                printl(FAIL, "Cannot find the directory specified\n\r");
+            }
+
+
+        } else if (strncmp(input, "CDCAT ", 6) == 0) {
+            iso_entry_t entry;
+
+            if (isoFindEntry(input + 6, &entry) && !entry.directory) {
+                char text[512];
+                uint32_t offset = 0;
+                uint32_t length;
+
+                while ((length = isoReadFile(&entry, offset, text, sizeof(text))) > 0) {
+                    printf("%.*s", length, text);
+                    offset += length;
+                }
+                printf("\n");
+            } else {
+                printl(FAIL, "Cannot find the file specified\n\r");
+            }
+
+
+        } else if (strncmp(input, "CDVIEW ", 7) == 0) {
+            iso_entry_t entry;
+
+            if (!isoFindEntry(input + 7, &entry) || entry.directory) {
+                printl(FAIL, "Cannot find the file specified\n\r");
+
+            } else {
+                uint8_t *image = (uint8_t *) memoryAllocateBlock(entry.size);
+
+                if (image && (isoReadFile(&entry, 0, image, entry.size) == entry.size)) {
+                    const planar_header_t *planar = (const planar_header_t *) image;
+                    bool is_planar = (entry.size >= sizeof(planar_header_t)) && (memoryCompare(planar->magic, PLANAR_MAGIC, 4) == 0);
+                    bool is_compressed = (entry.size >= sizeof(compressed_header_t)) && (memoryCompare(image, COMPRESSED_MAGIC, 4) == 0);
+                    bool is_packed = (entry.size == BMP_SIZE(640, 480)) || (entry.size == BMP_SIZE(480, 480));
+
+                    // Both are drawn straight from the buffer, so the file has to hold all the data
+                    if (is_planar && (entry.size < sizeof(planar_header_t) + (((planar->width + 7U) >> 3) * planar->height * 4U))) {
+                        is_planar = false;
+                    }
+
+                    if (is_compressed && (((const compressed_header_t *) image)->size > entry.size - sizeof(compressed_header_t))) {
+                        is_compressed = false;
+                    }
+
+                    if (is_planar || is_compressed || is_packed) {
+                        initializeVGA(video_mode);
+                        fillScreen(PX_BLACK);
+
+                        if (is_planar) {
+                            drawPlanarBitmap(image, (planar->width < 640) ? (640 - planar->width) / 2 : 0, 0);
+                        } else if (is_compressed) {
+                            uint16_t width = ((const compressed_header_t *) image)->width;
+                            drawCompressedBitmap(image, (width < 640) ? (640 - width) / 2 : 0, 0);
+                        } else {
+                            uint16_t width = (entry.size == BMP_SIZE(640, 480)) ? 640 : 480;
+                            drawBitmapFast(image, (640 - width) / 2, 0, width, 480);
+                        }
+
+                        presentScreen();
+                        timerSleep(1024);
+
+                        initializeVGA(text_mode);
+                        setScreen(NULL);
+                    } else {
+                        printl(FAIL, "The file is not a packed (.bin), planar (.pln) or compressed (.plz) bitmap\n\r");
+                    }
+                } else {
+                    printl(FAIL, "Cannot read the file from the CD\n\r");
+                }
+
+                if (image) {
+                    memoryFreeBlock(image);
+                }
+            }
+
         } else {
             // We dont validate empty buffers :)
             if (strlen(input) != 0) {
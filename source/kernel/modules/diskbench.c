@@ -0,0 +1,311 @@
+#include "diskbench.h"
+#include "terminal.h"
+
+#include "../../common/randomly.h"
+
+#include "../CPU/CPU.h"
+#include "../drivers/ATA/ata.h"
+#include "../drivers/BLK/cache.h"
+#include "../drivers/BLK/queue.h"
+#include "../memory/heap.h"
+
+/*
+ * Every request is timed with the TSC (calibrated against the PIT), the PIT alone
+ * ticks every 10 ms, which is longer than most requests take.
+ */
+
+typedef struct {
+    const char *name;
+    uint32_t requests;
+    uint32_t errors;
+    uint64_t cycles;    // Time spent in the requests
+    uint64_t minimum;
+    uint64_t maximum;
+    uint32_t histogram[BENCH_BUCKETS];
+} bench_result_t;
+
+#define BENCH_BAR_WIDTH 32
+
+static const char bench_bar[BENCH_BAR_WIDTH + 1] = "################################";
+
+static uint32_t bench_frequency; // TSC kHz
+
+
+/** Print to the console and to the serial port */
+static void benchPrint(const char *format, ...) {
+    va_list args, copy;
+
+    va_start(args, format);
+    va_copy(copy, args);
+
+    vprintf(format, args);
+    vfprintf(serial, format, copy);
+
+    va_end(copy);
+    va_end(args);
+}
+
+
+static inline uint32_t benchMicroseconds(uint64_t cycles) {
+    return (uint32_t) (((double) (int64_t) cycles * 1000.0) / bench_frequency);
+}
+
+
+static void benchRecord(bench_result_t *result, uint64_t cycles) {
+    uint32_t microseconds = benchMicroseconds(cycles);
+    uint8_t bucket = 0;
+
+    // Bucket n holds the latencies below 2^(n+1) us, the last one everything above
+    while ((bucket < (BENCH_BUCKETS - 1)) && (microseconds >= (2U << bucket))) {
+        bucket++;
+    }
+
+    result->histogram[bucket]++;
+    result->cycles += cycles;
+    result->minimum = MIN(result->minimum, cycles);
+    result->maximum = MAX(result->maximum, cycles);
+    result->requests++;
+}
+
+
+static void benchReport(const bench_result_t *result, uint32_t sectors) {
+    if (!result->requests) {
+        benchPrint(" * %-16s failed (%d errors)\n", result->name, result->errors);
+        return;
+    }
+
+    double seconds = ((double) (int64_t) result->cycles) / (bench_frequency * 1000.0);
+    double bytes = (double) result->requests * sectors * ATA_SECTOR_SIZE;
+
+    uint32_t iops = (uint32_t) (result->requests / seconds);
+    uint32_t speed = (uint32_t) ((bytes * 100.0) / (seconds * 1048576.0)); // Hundredths of MB/s
+
+    benchPrint(" * %-16s %d IOPS, %d.%02d MB/s, latency %d/%d/%d us (min/avg/max)",
+        result->name, iops, speed / 100, speed % 100,
+        benchMicroseconds(result->minimum),
+        (uint32_t) ((seconds * 1000000.0) / result->requests),
+        benchMicroseconds(result->maximum)
+    );
+
+    if (result->errors) {
+        benchPrint(", %d errors", result->errors);
+    }
+    benchPrint("\n");
+
+    // Only the range of buckets that got something
+    int8_t first = 0, last = BENCH_BUCKETS - 1;
+    uint32_t peak = 0;
+
+    while ((first < last) && !result->histogram[first]) first++;
+    while ((last > first) && !result->histogram[last]) last--;
+
+    for (int8_t i = first; i <= last; i++) {
+        peak = MAX(peak, result->histogram[i]);
+    }
+
+    for (int8_t i = first; i <= last; i++) {
+        int width = (int) ((result->histogram[i] * BENCH_BAR_WIDTH + peak - 1) / peak);
+
+        if (i < (BENCH_BUCKETS - 1)) {
+            benchPrint("     < %6d us | %-32.*s %d\n", 2U << i, width, bench_bar, result->histogram[i]);
+        } else {
+            benchPrint("     >= %5d us | %-32.*s %d\n", 1U << i, width, bench_bar, result->histogram[i]);
+        }
+    }
+}
+
+
+/**
+ * Run a pass of requests of 'sectors' sectors, sequential from the first sector after the
+ * reserved ones or random all over the disk (within the first 2 TB). Cached passes read
+ * through a block cache stream.
+ */
+static void benchRun(bench_result_t *result, uint8_t bus, uint8_t drive, uint64_t disk, uint32_t sectors, uint8_t *buffer, bool random, bool write, bool cached) {
+    // Everything above the reserved sectors, the write passes can't go there anyway
+    uint64_t usable = (disk > ATA_RESERVED_SECTORS) ? (disk - ATA_RESERVED_SECTORS) : 0;
+    uint32_t span = (uint32_t) MIN(usable, (uint64_t) 0xFFFFFFFF);
+    uint32_t slots = span / sectors;
+    uint32_t requests = random ? BENCH_RANDOM_REQUESTS : MIN(BENCH_BYTES / (sectors * ATA_SECTOR_SIZE), slots);
+
+    blk_stream_t stream;
+    blkStreamInit(&stream, BLK_DEVICE(bus, drive));
+
+    result->requests = 0;
+    result->errors = 0;
+    result->cycles = 0;
+    result->minimum = (uint64_t) -1;
+    result->maximum = 0;
+
+    for (uint8_t i = 0; i < BENCH_BUCKETS; i++) {
+        result->histogram[i] = 0;
+    }
+
+    for (uint32_t i = 0; (i < requests) && slots; i++) {
+        uint64_t lba = ATA_RESERVED_SECTORS + ((uint64_t) (random ? (randomGet() % slots) : i) * sectors);
+        bool success;
+
+        // Writes put back what is already there, so the disk content survives
+        if (write && !ataRead(bus, drive, lba, sectors, buffer)) {
+            result->errors++;
+            continue;
+        }
+
+        uint64_t start = processorGetCycles();
+
+        if (cached) {
+            success = blkStreamRead(&stream, lba, sectors, buffer);
+        } else if (write) {
+            success = ataWrite(bus, drive, lba, sectors, buffer);
+        } else {
+            success = ataRead(bus, drive, lba, sectors, buffer);
+        }
+
+        uint64_t cycles = processorGetCycles() - start;
+
+        if (success) {
+            benchRecord(result, cycles);
+        } else {
+            result->errors++;
+        }
+    }
+}
+
+
+void diskBenchmark(uint32_t sectors, bool write) {
+    static const char *modes[2] = { "PIO", "DMA" };
+
+    const ata_device_t *device = NULL;
+    uint8_t bus = 0, drive = 0;
+
+    // The first ATA disk, in bus/drive order
+    for (uint8_t i = 0; !device && (i < 4); i++) {
+        bus = i >> 1;
+        drive = i & 1;
+
+        device = ataGetDevice(bus, drive);
+        if (device && (device->atapi || !device->sectors)) {
+            device = NULL;
+        }
+    }
+
+    if (!device) {
+        printl(FAIL, "There is no ATA disk to measure\n\r");
+        return;
+    }
+
+    if (!sectors || (sectors > ATA_MAX_SECTORS)) {
+        printl(FAIL, "The request size must be 1 to %d sectors\n\r", ATA_MAX_SECTORS);
+        return;
+    }
+
+    // Page aligned, so the DMA path can take it
+    uint32_t pages = ((sectors * ATA_SECTOR_SIZE) + 4095) / 4096;
+    uint8_t *buffer = (uint8_t *) memoryAllocatePages(pages);
+
+    if (!buffer) {
+        printl(FAIL, "Unable to allocate the benchmark buffer\n\r");
+        return;
+    }
+
+    // The raw passes go around the cache, so it must not hold anything newer than the disk
+    blkUnplug(BLK_ALL_DEVICES);
+    blkFlush(BLK_ALL_DEVICES);
+
+    bench_frequency = processorGetFrequency();
+
+    printl(INFO, "Disk benchmark on %d:%d %s, %d sectors per request\n", bus, drive, device->model, sectors);
+    fprintf(serial, "[BENCH] %d:%d %s, %d sectors per request, TSC at %d kHz\n", bus, drive, device->model, sectors, bench_frequency);
+
+    bool dma = ataEnableDMA(false);
+    bench_result_t result;
+
+    for (uint8_t mode = 0; mode < (device->dma ? 2 : 1); mode++) {
+        char name[24];
+        ataEnableDMA(mode == 1);
+
+        benchPrint("\n");
+
+        sprintf(name, "%s seq read", modes[mode]);
+        result.name = name;
+        benchRun(&result, bus, drive, device->sectors, sectors, buffer, false, false, false);
+        benchReport(&result, sectors);
+
+        sprintf(name, "%s random read", modes[mode]);
+        benchRun(&result, bus, drive, device->sectors, sectors, buffer, true, false, false);
+        benchReport(&result, sectors);
+
+        if (write) {
+            sprintf(name, "%s seq write", modes[mode]);
+            benchRun(&result, bus, drive, device->sectors, sectors, buffer, false, true, false);
+            benchReport(&result, sectors);
+
+            sprintf(name, "%s random write", modes[mode]);
+            benchRun(&result, bus, drive, device->sectors, sectors, buffer, true, true, false);
+            benchReport(&result, sectors);
+        }
+    }
+
+    ataEnableDMA(dma);
+
+    // The cache with readahead, as the filesystems see the disk
+    benchPrint("\n");
+    result.name = "Cached seq read";
+    benchRun(&result, bus, drive, device->sectors, sectors, buffer, false, false, true);
+    benchReport(&result, sectors);
+    benchPrint("\n");
+
+    memoryFreePages(buffer);
+}
+
+
+void diskScan(uint8_t device, uint64_t blocks) {
+    blk_stream_t stream;
+    blkStreamInit(&stream, device);
+
+    if (!stream.sectors) {
+        printl(FAIL, "There is no disk or partition %d\n\r", device);
+        return;
+    }
+
+    blocks = blocks ? MIN(blocks, stream.sectors) : stream.sectors;
+
+    uint8_t *buffer = (uint8_t *) memoryAllocateBlock(SCAN_BLOCKS * BLK_BLOCK_SIZE);
+    if (!buffer) {
+        printl(FAIL, "Unable to allocate the scan buffer\n\r");
+        return;
+    }
+
+    bench_frequency = processorGetFrequency();
+    benchPrint("Scanning %d blocks of device %d ...\n", (uint32_t) blocks, device);
+
+    uint32_t bad = 0;
+    uint64_t start = processorGetCycles();
+
+    for (uint64_t lba = 0; lba < blocks; lba += SCAN_BLOCKS) {
+        uint32_t count = (uint32_t) MIN(blocks - lba, (uint64_t) SCAN_BLOCKS);
+
+        if (blkStreamRead(&stream, lba, count, buffer)) {
+            continue;
+        }
+
+        // Block by block to find the bad ones, the stream turns sequential again after the first
+        for (uint32_t i = 0; i < count; i++) {
+            if (blkStreamRead(&stream, lba + i, 1, buffer)) {
+                continue;
+            }
+
+            if (bad < SCAN_REPORTED) {
+                printf(" * Block %d can't be read\n", (uint32_t) (lba + i));
+            }
+            fprintf(serial, "[SCAN] Block %d of device %d can't be read\n", (uint32_t) (lba + i), device);
+            bad++;
+        }
+    }
+
+    double seconds = ((double) (int64_t) (processorGetCycles() - start)) / (bench_frequency * 1000.0);
+    uint32_t speed = (seconds > 0.0) ? (uint32_t) (((double) (int64_t) blocks * BLK_BLOCK_SIZE * 100.0) / (seconds * 1048576.0)) : 0;
+
+    benchPrint(" * %d blocks read, %d unreadable, %d.%02d MB/s\n\n", (uint32_t) (blocks - bad), bad, speed / 100, speed % 100);
+
+    memoryFreeBlock(buffer);
+}
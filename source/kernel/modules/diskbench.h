@@ -0,0 +1,40 @@
+#ifndef _UTIL_DISKBENCH_H
+#define _UTIL_DISKBENCH_H 1
+
+#include "../../common/common.h"
+
+/** Data moved by each sequential pass */
+#define BENCH_BYTES             (4 * 1024 * 1024)
+
+/** Requests made by each random pass */
+#define BENCH_RANDOM_REQUESTS   256
+
+/** Latency histogram buckets, powers of two of microseconds */
+#define BENCH_BUCKETS           16
+
+/** Blocks read at a time by the scan */
+#define SCAN_BLOCKS             8
+
+/** Unreadable blocks listed on the console, the rest only go to the serial port */
+#define SCAN_REPORTED           16
+
+/**
+ * Measure the first ATA disk with sequential and random requests, with PIO and DMA
+ * (when available) and through the block cache. The results (IOPS, MB/s and the
+ * latency histogram) go to the console and the serial port.
+ *
+ * @param sectors   Sectors per request, 1 to ATA_MAX_SECTORS
+ * @param write     Also measure writes, each block is read first and written back as is
+ */
+void diskBenchmark(uint32_t sectors, bool write);
+
+/**
+ * Read a disk or a partition from start to end through a block cache stream (so with
+ * readahead), and report the unreadable blocks and the throughput.
+ *
+ * @param device    Block device, a disk (BLK_DEVICE()) or a partition
+ * @param blocks    Blocks to read from the start, 0 for the whole device
+ */
+void diskScan(uint8_t device, uint64_t blocks);
+
+#endif /* _UTIL_DISKBENCH_H */